@@ -0,0 +1,121 @@
+// Cost of the binding itself, without sockets or uWS: marshalling helpers, FFI entry points and the dispatch of
+// requests and websocket messages. The HTTP and websocket handlers are invoked through their FFI callbacks from
+// this thread, the way the native loop invokes them.
+//
+//   deno bench -A --unstable benchmarks/ffi_bench.ts
+//
+// run.ts --compare measures the same routes end to end against native_server.cpp, the difference is what the
+// binding adds per request.
+
+import ffi, { specializations } from '../src/ffi.ts';
+import { _internals, App, packWebsocketBehaviorBuffer, toCString } from '../src/app.ts';
+import { Struct } from "https://deno.land/x/struct@1.0.0/mod.ts";
+
+const { encode, encodeTransient, getBuffer, getStringFromPointer, packHeaders, getWebSocket, HttpRequest, HttpResponse } = _internals;
+const encoder = new TextEncoder();
+
+const small = 'Hello, World!';
+const medium = JSON.stringify({ items: Array.from({ length: 40 }, (_, id) => ({ id, name: `item ${id}`, active: id % 2 === 0 })) });
+const bytes = encoder.encode(medium);
+
+Deno.bench({ name: 'TextEncoder.encode 13 B', group: 'encode', baseline: true, fn: () => { encoder.encode(small); } });
+Deno.bench({ name: 'encode 13 B', group: 'encode', fn: () => { encode(small); } });
+Deno.bench({ name: 'encodeTransient 13 B', group: 'encode', fn: () => { encodeTransient(small); } });
+Deno.bench({ name: `encode ${bytes.length} B`, group: 'encode', fn: () => { encode(medium); } });
+Deno.bench({ name: `encodeTransient ${bytes.length} B`, group: 'encode', fn: () => { encodeTransient(medium); } });
+Deno.bench({ name: 'encode Uint8Array', group: 'encode', fn: () => { encode(bytes); } });
+Deno.bench({ name: 'toCString', group: 'encode', fn: () => { toCString('/api/users/:id'); } });
+
+const pointer = Deno.UnsafePointer.of(bytes);
+Deno.bench({ name: 'getBuffer', group: 'decode', baseline: true, fn: () => { getBuffer(pointer, 13); } });
+Deno.bench({ name: 'getStringFromPointer 13 B', group: 'decode', fn: () => { getStringFromPointer(pointer, 13); } });
+Deno.bench({ name: `getStringFromPointer ${bytes.length} B`, group: 'decode', fn: () => { getStringFromPointer(pointer, bytes.length); } });
+
+const headerParts = ['content-type', 'application/json', 'cache-control', 'no-store', 'x-request-id', '0123456789abcdef']
+  .map((part) => encoder.encode(part));
+Deno.bench({ name: 'packHeaders 3 headers', group: 'pack', baseline: true, fn: () => { packHeaders(headerParts); } });
+Deno.bench({
+  name: 'Struct.pack websocket behavior', group: 'pack', fn: () => {
+    Struct.pack("<iiii???billlllllll", [0, 16 * 1024 * 1024, 12, 64 * 1024, false, true, true, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0]);
+  }
+});
+// creates the open and close callbacks every time, as registering a route does
+Deno.bench({ name: 'packWebsocketBehaviorBuffer', group: 'pack', n: 1000, fn: () => { packWebsocketBehaviorBuffer(0, null, {}); } });
+
+const app = App();
+const worker = app.unsafeHandle;
+const stats = new BigUint64Array(11);
+const statsPointer = Deno.UnsafePointer.of(stats);
+Deno.bench({ name: 'uws_loop_stats', group: 'ffi call', baseline: true, fn: () => { ffi.uws_loop_stats(worker, statsPointer, 0); } });
+Deno.bench({ name: 'uws_get_metrics, too small', group: 'ffi call', fn: () => { ffi.uws_get_metrics(statsPointer, 0); } });
+
+// request snapshot in the layout written by write_request_snapshot
+function snapshot(method: string, url: string, query: string, headers: [string, string][]): Uint8Array {
+  const fields = [method, url, query, ...headers.flat()].map((field) => encoder.encode(field));
+  const table = 12 + fields.length * 8;
+  const size = table + fields.reduce((sum, field) => sum + field.length, 0);
+  const buffer = new Uint8Array(size);
+  const view = new DataView(buffer.buffer);
+  view.setUint32(0, size, true);
+  view.setUint32(4, 0, true);
+  view.setUint32(8, headers.length, true);
+  let offset = table;
+  fields.forEach((field, i) => {
+    view.setUint32(12 + i * 8, offset, true);
+    view.setUint32(16 + i * 8, field.length, true);
+    buffer.set(field, offset);
+    offset += field.length;
+  });
+  return buffer;
+}
+
+const request = snapshot('GET', '/plaintext', '', [
+  ['host', '127.0.0.1:9001'],
+  ['user-agent', 'Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36'],
+  ['accept', '*/*'],
+  ['accept-encoding', 'gzip, deflate, br'],
+  ['connection', 'keep-alive'],
+]);
+const requestPointer = Deno.UnsafePointer.of(request);
+// stand-ins for the res, req and ws the loop passes, never dereferenced by the handlers below
+const fakeRes = Deno.UnsafePointer.create(1n);
+const fakeReq = Deno.UnsafePointer.create(2n);
+const fakeWs = Deno.UnsafePointer.create(3n);
+
+// same body as the dispatcher of TemplatedApp routes, the handler must not call into the binding with the fake res
+function dispatcher(handler: (res: InstanceType<typeof HttpResponse>, req: InstanceType<typeof HttpRequest>) => void) {
+  const callback = new Deno.UnsafeCallback(
+    { parameters: ["pointer", "pointer", "pointer", "usize"], result: "void" } as const,
+    (res, req, snapshot, length) => {
+      const request = HttpRequest._acquire(worker, req, snapshot, length);
+      const response = HttpResponse._acquire(specializations[0], worker, res, request);
+      try {
+        handler(response, request);
+      } finally {
+        request._release();
+        response._recycle();
+      }
+    });
+  return new Deno.UnsafeFnPointer(callback.pointer, callback.definition);
+}
+
+const empty = new Deno.UnsafeFnPointer(
+  new Deno.UnsafeCallback({ parameters: ["pointer", "pointer", "pointer", "usize"], result: "void" } as const, () => {}).pointer,
+  { parameters: ["pointer", "pointer", "pointer", "usize"], result: "void" } as const);
+const bare = dispatcher(() => {});
+const reading = dispatcher((_res, req) => {
+  req.getUrl();
+  req.getHeader('user-agent');
+});
+Deno.bench({ name: 'empty callback', group: 'http dispatch', baseline: true, fn: () => { empty.call(fakeRes, fakeReq, requestPointer, request.length); } });
+Deno.bench({ name: 'request and response wrappers', group: 'http dispatch', fn: () => { bare.call(fakeRes, fakeReq, requestPointer, request.length); } });
+Deno.bench({ name: 'wrappers, url and one header', group: 'http dispatch', fn: () => { reading.call(fakeRes, fakeReq, requestPointer, request.length); } });
+
+// same body as the message handler of packWebsocketBehaviorBuffer
+const message = new Deno.UnsafeFnPointer(
+  new Deno.UnsafeCallback({ parameters: ["pointer", "pointer", "usize", "u8"], result: "void" } as const, (ws, messagePtr, length, _opcode) => {
+    getWebSocket(specializations[0], worker, ws);
+    getBuffer(messagePtr, length);
+  }).pointer,
+  { parameters: ["pointer", "pointer", "usize", "u8"], result: "void" } as const);
+Deno.bench({ name: `websocket message ${bytes.length} B`, group: 'websocket dispatch', fn: () => { message.call(fakeWs, pointer, bytes.length, 2); } });
@@ -0,0 +1,419 @@
+/*
+ * HTTP/1.1 load generator on top of the vendored uSockets, see run.ts for the scenarios.
+ *
+ * http_load [-h host] [-P port] [-c connections] [-p pipeline] [-d seconds] [-w warmup seconds]
+ *           [-m method] [-u path] [-H "key: value"]... [-b body bytes]
+ *
+ * Every connection keeps pipeline requests in flight, a new one is sent for every response. Prints one JSON object
+ * with the request rate and latency percentiles in microseconds measured after the warmup.
+ */
+
+#include <libusockets.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define MAX_PIPELINE 256
+#define MAX_HEADERS 64
+#define HEAD_LIMIT 16384
+
+/* 8 linear sub buckets per power of two microseconds, the same layout the bindings use */
+#define SUB_BUCKET_BITS 3
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define BUCKETS ((40 - SUB_BUCKET_BITS + 2) * SUB_BUCKETS)
+
+struct connection {
+    /* send times of the requests in flight, oldest first */
+    uint64_t sent[MAX_PIPELINE];
+    int head;
+    int in_flight;
+    /* rest of a batch the socket did not take yet and requests waiting for it */
+    const char *unsent_data;
+    int unsent;
+    int queued;
+    /* response parser */
+    char head_buffer[HEAD_LIMIT];
+    int head_length;
+    long long body_remaining;
+};
+
+static const char *host = "127.0.0.1";
+static int port = 9001;
+static int connections = 64;
+static int pipeline = 1;
+static int duration = 10;
+static int warmup = 2;
+
+static char *request;
+static int request_length;
+static char *batch;
+
+static int measuring = 0;
+static uint64_t responses = 0;
+static uint64_t errors = 0;
+static uint64_t bytes_in = 0;
+static uint64_t counts[BUCKETS];
+static uint64_t latency_max = 0;
+static uint64_t started;
+static struct us_timer_t *timer;
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int bucket_index(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+    {
+        return (int)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    int i = (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + (int)((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    return i < BUCKETS ? i : BUCKETS - 1;
+}
+
+static uint64_t bucket_upper(int i)
+{
+    if (i < SUB_BUCKETS)
+    {
+        return i;
+    }
+    int exponent = i / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint64_t sub = i % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub + 1) << (exponent - SUB_BUCKET_BITS)) - 1;
+}
+
+static uint64_t percentile(double q)
+{
+    uint64_t rank = (uint64_t)(q * responses + 0.999999);
+    uint64_t seen = 0;
+    if (!rank)
+    {
+        rank = 1;
+    }
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+        {
+            return bucket_upper(i) < latency_max ? bucket_upper(i) : latency_max;
+        }
+    }
+    return latency_max;
+}
+
+static void record(struct connection *c)
+{
+    uint64_t latency = now_us() - c->sent[c->head];
+    c->head = (c->head + 1) % MAX_PIPELINE;
+    c->in_flight--;
+    if (!measuring)
+    {
+        return;
+    }
+    responses++;
+    counts[bucket_index(latency)]++;
+    if (latency > latency_max)
+    {
+        latency_max = latency;
+    }
+}
+
+static void flush(struct us_socket_t *s, struct connection *c)
+{
+    while (1)
+    {
+        if (c->unsent)
+        {
+            int written = us_socket_write(0, s, c->unsent_data, c->unsent, 0);
+            c->unsent_data += written;
+            c->unsent -= written;
+            if (c->unsent)
+            {
+                return;
+            }
+        }
+        if (!c->queued)
+        {
+            return;
+        }
+        int count = c->queued < pipeline ? c->queued : pipeline;
+        c->queued -= count;
+        c->unsent_data = batch;
+        c->unsent = request_length * count;
+    }
+}
+
+static void send_requests(struct us_socket_t *s, struct connection *c, int count)
+{
+    uint64_t now = now_us();
+    for (int i = 0; i < count; i++)
+    {
+        c->sent[(c->head + c->in_flight) % MAX_PIPELINE] = now;
+        c->in_flight++;
+    }
+    c->queued += count;
+    flush(s, c);
+}
+
+/* content-length of a response head, chunked responses are not expected from the benchmark server */
+static long long content_length(const char *head, int length)
+{
+    for (int i = 0; i + 16 < length; i++)
+    {
+        if ((head[i] == '\n') && strncasecmp(head + i + 1, "content-length:", 15) == 0)
+        {
+            return strtoll(head + i + 16, NULL, 10);
+        }
+    }
+    return 0;
+}
+
+/* returns the number of complete responses in data */
+static int parse(struct connection *c, const char *data, int length)
+{
+    int complete = 0;
+    while (length > 0)
+    {
+        if (c->body_remaining > 0)
+        {
+            int take = length < c->body_remaining ? length : (int)c->body_remaining;
+            c->body_remaining -= take;
+            data += take;
+            length -= take;
+            if (!c->body_remaining)
+            {
+                complete++;
+            }
+            continue;
+        }
+        int take = length < HEAD_LIMIT - c->head_length ? length : HEAD_LIMIT - c->head_length;
+        memcpy(c->head_buffer + c->head_length, data, take);
+        int searched = c->head_length > 3 ? c->head_length - 3 : 0;
+        c->head_length += take;
+        char *end = NULL;
+        for (int i = searched; i + 3 < c->head_length; i++)
+        {
+            if (memcmp(c->head_buffer + i, "\r\n\r\n", 4) == 0)
+            {
+                end = c->head_buffer + i + 4;
+                break;
+            }
+        }
+        if (!end)
+        {
+            if (c->head_length == HEAD_LIMIT)
+            {
+                return -1;
+            }
+            return complete;
+        }
+        int used = (int)(end - c->head_buffer) - (c->head_length - take);
+        c->body_remaining = content_length(c->head_buffer, (int)(end - c->head_buffer));
+        c->head_length = 0;
+        data += used;
+        length -= used;
+        if (!c->body_remaining)
+        {
+            complete++;
+        }
+    }
+    return complete;
+}
+
+static struct us_socket_t *on_open(struct us_socket_t *s, int is_client, char *ip, int ip_length)
+{
+    struct connection *c = (struct connection *)us_socket_ext(0, s);
+    memset(c, 0, sizeof(*c));
+    send_requests(s, c, pipeline);
+    return s;
+}
+
+static struct us_socket_t *on_data(struct us_socket_t *s, char *data, int length)
+{
+    struct connection *c = (struct connection *)us_socket_ext(0, s);
+    if (measuring)
+    {
+        bytes_in += length;
+    }
+    int complete = parse(c, data, length);
+    if (complete < 0)
+    {
+        errors++;
+        return us_socket_close(0, s, 0, NULL);
+    }
+    for (int i = 0; i < complete; i++)
+    {
+        record(c);
+    }
+    if (complete)
+    {
+        send_requests(s, c, complete);
+    }
+    return s;
+}
+
+static struct us_socket_t *on_writable(struct us_socket_t *s)
+{
+    flush(s, (struct connection *)us_socket_ext(0, s));
+    return s;
+}
+
+static struct us_socket_t *on_close(struct us_socket_t *s, int code, void *reason)
+{
+    if (measuring)
+    {
+        errors++;
+    }
+    return s;
+}
+
+static struct us_socket_t *on_end(struct us_socket_t *s)
+{
+    return us_socket_close(0, s, 0, NULL);
+}
+
+static struct us_socket_t *on_timeout(struct us_socket_t *s)
+{
+    return s;
+}
+
+static void on_timer(struct us_timer_t *t)
+{
+    if (!measuring)
+    {
+        measuring = 1;
+        started = now_us();
+        us_timer_set(timer, on_timer, duration * 1000, 0);
+        return;
+    }
+    double seconds = (now_us() - started) / 1e6;
+    printf("{\"connections\":%d,\"pipeline\":%d,\"seconds\":%.3f,\"requests\":%llu,\"errors\":%llu,\"bytesIn\":%llu,"
+           "\"rps\":%.1f,\"latency\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}\n",
+           connections, pipeline, seconds, (unsigned long long)responses, (unsigned long long)errors,
+           (unsigned long long)bytes_in, responses / seconds,
+           (unsigned long long)percentile(0.5), (unsigned long long)percentile(0.9),
+           (unsigned long long)percentile(0.99), (unsigned long long)percentile(0.999),
+           (unsigned long long)latency_max);
+    fflush(stdout);
+    exit(0);
+}
+
+static void on_wakeup(struct us_loop_t *loop) {}
+static void on_pre(struct us_loop_t *loop) {}
+static void on_post(struct us_loop_t *loop) {}
+
+static void usage()
+{
+    fprintf(stderr, "usage: http_load [-h host] [-P port] [-c connections] [-p pipeline] [-d seconds] [-w warmup seconds]"
+                    " [-m method] [-u path] [-H \"key: value\"]... [-b body bytes]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *method = "GET";
+    const char *path = "/";
+    const char *headers[MAX_HEADERS];
+    int header_count = 0;
+    long body_length = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-' || !argv[i][1] || argv[i][2] || i + 1 >= argc)
+        {
+            usage();
+        }
+        const char *value = argv[++i];
+        switch (argv[i - 1][1])
+        {
+        case 'h': host = value; break;
+        case 'P': port = atoi(value); break;
+        case 'c': connections = atoi(value); break;
+        case 'p': pipeline = atoi(value); break;
+        case 'd': duration = atoi(value); break;
+        case 'w': warmup = atoi(value); break;
+        case 'm': method = value; break;
+        case 'u': path = value; break;
+        case 'b': body_length = atol(value); break;
+        case 'H':
+            if (header_count == MAX_HEADERS)
+            {
+                usage();
+            }
+            headers[header_count++] = value;
+            break;
+        default: usage();
+        }
+    }
+    if (connections < 1 || pipeline < 1 || pipeline > MAX_PIPELINE || duration < 1 || warmup < 0 || body_length < 0)
+    {
+        usage();
+    }
+
+    size_t capacity = 256 + strlen(method) + strlen(path) + strlen(host) + body_length;
+    for (int i = 0; i < header_count; i++)
+    {
+        capacity += strlen(headers[i]) + 2;
+    }
+    request = malloc(capacity);
+    request_length = snprintf(request, capacity, "%s %s HTTP/1.1\r\nHost: %s:%d\r\n", method, path, host, port);
+    for (int i = 0; i < header_count; i++)
+    {
+        request_length += snprintf(request + request_length, capacity - request_length, "%s\r\n", headers[i]);
+    }
+    if (body_length)
+    {
+        request_length += snprintf(request + request_length, capacity - request_length, "Content-Length: %ld\r\n", body_length);
+    }
+    request_length += snprintf(request + request_length, capacity - request_length, "\r\n");
+    memset(request + request_length, 'x', body_length);
+    request_length += body_length;
+
+    /* the requests of a pipeline are written at once */
+    batch = malloc((size_t)request_length * pipeline);
+    for (int i = 0; i < pipeline; i++)
+    {
+        memcpy(batch + (size_t)request_length * i, request, request_length);
+    }
+
+    struct us_loop_t *loop = us_create_loop(0, on_wakeup, on_pre, on_post, 0);
+    struct us_socket_context_options_t options = {};
+    struct us_socket_context_t *context = us_create_socket_context(0, loop, 0, options);
+    us_socket_context_on_open(0, context, on_open);
+    us_socket_context_on_data(0, context, on_data);
+    us_socket_context_on_writable(0, context, on_writable);
+    us_socket_context_on_close(0, context, on_close);
+    us_socket_context_on_end(0, context, on_end);
+    us_socket_context_on_timeout(0, context, on_timeout);
+
+    for (int i = 0; i < connections; i++)
+    {
+        if (!us_socket_context_connect(0, context, host, port, NULL, 0, sizeof(struct connection)))
+        {
+            fprintf(stderr, "cannot connect to %s:%d\n", host, port);
+            return 1;
+        }
+    }
+
+    timer = us_create_timer(loop, 0, 0);
+    if (warmup)
+    {
+        us_timer_set(timer, on_timer, warmup * 1000, 0);
+    }
+    else
+    {
+        measuring = 1;
+        started = now_us();
+        us_timer_set(timer, on_timer, duration * 1000, 0);
+    }
+    us_loop_run(loop);
+    return 0;
+}
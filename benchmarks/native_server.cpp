@@ -0,0 +1,87 @@
+// The routes of server.ts written directly against uWS, the baseline run.ts --compare measures the binding against.
+// Runs on the same libuv loop and build flags as bindings/libuwebsockets.cpp, without any JS in the way.
+
+#include "App.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+int main(int argc, char **argv)
+{
+    int port = argc > 1 ? atoi(argv[1]) : 9001;
+    const std::string_view plaintext = "Hello, World!";
+
+    uWS::App app;
+    app.get("/plaintext", [plaintext](auto *res, auto *) {
+        res->writeHeader("Content-Type", "text/plain")->end(plaintext);
+    }).get("/json", [plaintext](auto *res, auto *) {
+        // the JSON.stringify of server.ts, serialized per request
+        std::string json = "{\"message\":\"";
+        json.append(plaintext);
+        json.append("\"}");
+        res->writeHeader("Content-Type", "application/json")->end(json);
+    }).get("/headers", [plaintext](auto *res, auto *req) {
+        std::string agent(req->getHeader("user-agent"));
+        std::string language(req->getHeader("accept-language"));
+        res->writeStatus("200 OK")
+            ->writeHeader("Content-Type", "text/plain")
+            ->writeHeader("Cache-Control", "no-store")
+            ->writeHeader("X-Frame-Options", "DENY")
+            ->writeHeader("X-Content-Type-Options", "nosniff")
+            ->writeHeader("Referrer-Policy", "no-referrer")
+            ->writeHeader("Strict-Transport-Security", "max-age=63072000")
+            ->writeHeader("X-Request-Agent", agent)
+            ->writeHeader("X-Request-Language", language)
+            ->end(plaintext);
+    }).post("/echo", [](auto *res, auto *) {
+        // collectBody of server.ts: buffered natively, 413 above 1 MiB
+        auto *body = new std::string;
+        res->onAborted([body]() {
+            delete body;
+        });
+        res->onData([res, body](std::string_view chunk, bool last) {
+            if (body->length() + chunk.length() > 1024 * 1024)
+            {
+                delete body;
+                res->writeStatus("413 Payload Too Large")->end({}, true);
+                return;
+            }
+            body->append(chunk);
+            if (last)
+            {
+                res->end(std::to_string(body->length()));
+                delete body;
+            }
+        });
+    }).ws<int>("/ws", {
+        .message = [](auto *ws, std::string_view message, uWS::OpCode opCode) {
+            ws->send(message, opCode);
+        }
+    }).ws<int>("/fanout", {
+        .open = [](auto *ws) {
+            ws->subscribe("fanout");
+        },
+        .message = [&app](auto *, std::string_view message, uWS::OpCode opCode) {
+            app.publish("fanout", message, opCode);
+        }
+    }).ws<int>("/chat", {
+        .open = [](auto *ws) {
+            ws->subscribe("chat");
+        },
+        .message = [&app](auto *, std::string_view message, uWS::OpCode opCode) {
+            app.publish("chat", message, opCode);
+        }
+    }).listen(port, [port](auto *token) {
+        if (token)
+        {
+            printf("listening\n");
+            fflush(stdout);
+        }
+        else
+        {
+            fprintf(stderr, "Failed to listen to port %d\n", port);
+            exit(1);
+        }
+    }).run();
+}
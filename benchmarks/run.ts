@@ -0,0 +1,129 @@
+// Runs the HTTP scenarios against benchmarks/server.ts over loopback and prints one JSON report.
+//
+//   make -C bindings && make -C benchmarks
+//   deno run -A --unstable benchmarks/run.ts [--duration=10] [--warmup=2] [--connections=64] [--port=9001]
+//                                            [--only=plaintext,json] [--out=report.json]
+//                                            [--server=deno|native] [--compare]
+//
+// Latencies are microseconds. Compare reports of two builds with the same arguments on an otherwise idle machine.
+// --server=native runs the scenarios against native_server.cpp, the same routes without the binding. --compare runs
+// both and adds the binding overhead per request, the difference of the time per request of a saturated loop.
+
+const options: Record<string, string> = {};
+for (const arg of Deno.args) {
+  const [key, value] = arg.replace(/^--/, '').split('=');
+  options[key] = value ?? 'true';
+}
+const port = options.port ?? '9001';
+const common = [
+  '-P', port,
+  '-c', options.connections ?? '64',
+  '-d', options.duration ?? '10',
+  '-w', options.warmup ?? '2',
+];
+
+// typical browser request headers for the header heavy scenario
+const browserHeaders = [
+  'User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36',
+  'Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8',
+  'Accept-Language: en-US,en;q=0.9',
+  'Accept-Encoding: gzip, deflate, br',
+  'Cache-Control: max-age=0',
+  'Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; consent=1',
+  'Referer: http://127.0.0.1/index.html',
+  'Sec-Fetch-Dest: document',
+  'Sec-Fetch-Mode: navigate',
+  'Sec-Fetch-Site: same-origin',
+  'Sec-Fetch-User: ?1',
+  'Upgrade-Insecure-Requests: 1',
+  'DNT: 1',
+  'Connection: keep-alive',
+];
+
+const scenarios: { name: string, args: string[] }[] = [
+  { name: 'plaintext', args: ['-u', '/plaintext'] },
+  { name: 'json', args: ['-u', '/json'] },
+  { name: 'headers', args: ['-u', '/headers', ...browserHeaders.flatMap((header) => ['-H', header])] },
+  { name: 'post', args: ['-m', 'POST', '-u', '/echo', '-b', '4096'] },
+  { name: 'pipelined', args: ['-u', '/plaintext', '-p', '16'] },
+];
+const only = options.only?.split(',');
+
+async function startServer(kind: string): Promise<Deno.ChildProcess> {
+  const command = kind === 'native'
+    ? new Deno.Command(new URL('./native_server', import.meta.url).pathname, { args: [port], stdout: 'piped' })
+    : new Deno.Command(Deno.execPath(), {
+      args: ['run', '-A', '--unstable', new URL('./server.ts', import.meta.url).pathname, port],
+      stdout: 'piped',
+    });
+  const server = command.spawn();
+  const lines = server.stdout.pipeThrough(new TextDecoderStream()).getReader();
+  let output = '';
+  while (!output.includes('listening')) {
+    const { value, done } = await lines.read();
+    if (done) {
+      console.error(`${kind} benchmark server exited before listening`);
+      Deno.exit(1);
+    }
+    output += value;
+  }
+  lines.releaseLock();
+  return server;
+}
+
+async function runScenarios(kind: string) {
+  const server = await startServer(kind);
+  const results = [];
+  try {
+    for (const scenario of scenarios) {
+      if (only && !only.includes(scenario.name)) continue;
+      const load = await new Deno.Command(new URL('./http_load', import.meta.url).pathname, {
+        args: [...common, ...scenario.args],
+        stdout: 'piped',
+      }).output();
+      if (!load.success) {
+        throw new Error(`${scenario.name} failed with exit code ${load.code}`);
+      }
+      const result = { name: scenario.name, ...JSON.parse(new TextDecoder().decode(load.stdout)) };
+      console.error(`${kind} ${result.name}: ${result.rps} req/s, p50 ${result.latency.p50}us, p99 ${result.latency.p99}us, p99.9 ${result.latency.p999}us`);
+      results.push(result);
+    }
+  } finally {
+    server.kill();
+    await server.status;
+  }
+  return results;
+}
+
+const kinds = options.compare ? ['deno', 'native'] : [options.server ?? 'deno'];
+const runs: Record<string, any[]> = {};
+for (const kind of kinds) {
+  runs[kind] = await runScenarios(kind);
+}
+
+// both servers run a single loop, so 1 / rps is the time the loop spends per request
+const overhead = options.compare ? runs.deno.map((result, i) => {
+  const native = runs.native[i];
+  const perRequest = 1e6 / result.rps - 1e6 / native.rps;
+  console.error(`${result.name}: binding adds ${perRequest.toFixed(2)}us per request`);
+  return {
+    name: result.name,
+    usPerRequest: Math.round(perRequest * 100) / 100,
+    p50: result.latency.p50 - native.latency.p50,
+    p99: result.latency.p99 - native.latency.p99,
+  };
+}) : undefined;
+
+const report = JSON.stringify({
+  date: new Date().toISOString(),
+  deno: Deno.version.deno,
+  cpus: navigator.hardwareConcurrency,
+  server: options.compare ? undefined : kinds[0],
+  scenarios: options.compare ? runs.deno : runs[kinds[0]],
+  native: options.compare ? runs.native : undefined,
+  overhead,
+}, null, 2);
+if (options.out) {
+  await Deno.writeTextFile(options.out, report + '\n');
+}
+console.log(report);
@@ -0,0 +1,57 @@
+import { App } from '../mod.ts';
+
+// routes hit by the scenarios of run.ts and ws_run.ts
+const port = Number(Deno.args[0] ?? 9001);
+const plaintext = 'Hello, World!';
+
+const app = App();
+app.get('/plaintext', (res) => {
+    res.writeHeader('Content-Type', 'text/plain').end(plaintext);
+}).get('/json', (res) => {
+    res.writeHeader('Content-Type', 'application/json').end(JSON.stringify({ message: plaintext }));
+}).get('/headers', (res, req) => {
+    const agent = req.getHeader('user-agent');
+    const language = req.getHeader('accept-language');
+    res.writeStatus('200 OK')
+        .writeHeader('Content-Type', 'text/plain')
+        .writeHeader('Cache-Control', 'no-store')
+        .writeHeader('X-Frame-Options', 'DENY')
+        .writeHeader('X-Content-Type-Options', 'nosniff')
+        .writeHeader('Referrer-Policy', 'no-referrer')
+        .writeHeader('Strict-Transport-Security', 'max-age=63072000')
+        .writeHeader('X-Request-Agent', agent)
+        .writeHeader('X-Request-Language', language)
+        .end(plaintext);
+}).post('/echo', async (res) => {
+    try {
+        const body = await res.collectBody(1024 * 1024);
+        res.end(String(body.byteLength));
+    } catch {
+        // aborted or answered with 413 natively
+    }
+}).ws('/ws', {
+    message: (ws, message, isBinary) => {
+        ws.send(message, isBinary);
+    }
+}).ws('/fanout', {
+    open: (ws) => {
+        ws.subscribe('fanout');
+    },
+    message: (_ws, message, isBinary) => {
+        app.publish('fanout', message, isBinary);
+    }
+}).ws('/chat', {
+    open: (ws) => {
+        ws.subscribe('chat');
+    },
+    message: (_ws, message, isBinary) => {
+        app.publish('chat', message, isBinary);
+    }
+}).listen(port, (token) => {
+    if (token) {
+        console.log('listening');
+    } else {
+        console.error('Failed to listen to port ' + port);
+        Deno.exit(1);
+    }
+});
@@ -0,0 +1,603 @@
+/*
+ * WebSocket load generator on top of the vendored uSockets, see ws_run.ts for the scenarios.
+ *
+ * ws_load [-h host] [-P port] [-c connections] [-d seconds] [-w warmup seconds] [-u path] [-s payload bytes]
+ *         [-m echo|fanout|chat] [-S senders] [-r messages per second per sender] [-l source,addresses]
+ *
+ * echo:   every connection sends a message and the next one when the echo arrives, or at -r per second.
+ * fanout: the first -S connections send at -r per second, the server publishes every message to all connections.
+ * chat:   every connection sends at -r per second, the server publishes every message to all connections.
+ *
+ * Every message carries its send time, the delivery latency is measured by the receiving connection. Prints one
+ * JSON object with the delivery rate and latency percentiles in microseconds measured after the warmup. Opening
+ * more than ~28k connections to one address needs more source addresses, e.g. -l 127.0.0.2,127.0.0.3.
+ */
+
+#include <libusockets.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define MAX_CONNECTING 256
+#define MAX_SOURCES 64
+#define TICK_MS 10
+
+/* 8 linear sub buckets per power of two microseconds, the same layout the bindings use */
+#define SUB_BUCKET_BITS 3
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define BUCKETS ((40 - SUB_BUCKET_BITS + 2) * SUB_BUCKETS)
+
+enum mode { ECHO, FANOUT, CHAT };
+
+struct connection {
+    int index;
+    int upgraded;
+    /* handshake response, only the status line is checked */
+    int head_length;
+    int head_crlf;
+    /* frame parser */
+    unsigned char header[10];
+    int header_length;
+    int header_needed;
+    int in_payload;
+    int opcode;
+    uint64_t payload_remaining;
+    unsigned char control[125];
+    int control_length;
+    unsigned char stamp[8];
+    int stamp_length;
+    /* bytes the socket did not take yet */
+    char *backlog;
+    int backlog_length;
+    int backlog_capacity;
+    /* messages owed by the rate limiter */
+    double credit;
+};
+
+static const char *host = "127.0.0.1";
+static int port = 9001;
+static int connections = 1000;
+static int duration = 10;
+static int warmup = 2;
+static const char *path = "/ws";
+static int payload_length = 32;
+static enum mode mode = ECHO;
+static int senders = 1;
+static double rate = 0;
+static char *sources[MAX_SOURCES];
+static int source_count = 0;
+
+static struct us_socket_context_t *context;
+static struct us_socket_t **sockets;
+static int next_connection = 0;
+static int connecting = 0;
+static int upgraded = 0;
+static int failed = 0;
+static uint64_t connect_started;
+static double connect_seconds;
+
+static char *handshake;
+static int handshake_length;
+static char *frame;
+static int frame_length;
+static int stamp_offset;
+
+static int measuring = 0;
+static uint64_t sent = 0;
+static uint64_t received = 0;
+static uint64_t errors = 0;
+static uint64_t counts[BUCKETS];
+static uint64_t latency_max = 0;
+static uint64_t started;
+static struct us_timer_t *timer;
+static struct us_timer_t *ticker;
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int bucket_index(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+    {
+        return (int)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    int i = (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + (int)((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    return i < BUCKETS ? i : BUCKETS - 1;
+}
+
+static uint64_t bucket_upper(int i)
+{
+    if (i < SUB_BUCKETS)
+    {
+        return i;
+    }
+    int exponent = i / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint64_t sub = i % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub + 1) << (exponent - SUB_BUCKET_BITS)) - 1;
+}
+
+static uint64_t percentile(double q)
+{
+    uint64_t rank = (uint64_t)(q * received + 0.999999);
+    uint64_t seen = 0;
+    if (!rank)
+    {
+        rank = 1;
+    }
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+        {
+            return bucket_upper(i) < latency_max ? bucket_upper(i) : latency_max;
+        }
+    }
+    return latency_max;
+}
+
+static void write_or_queue(struct us_socket_t *s, struct connection *c, const char *data, int length)
+{
+    int written = c->backlog_length ? 0 : us_socket_write(0, s, data, length, 0);
+    if (written == length)
+    {
+        return;
+    }
+    if (c->backlog_length + length - written > c->backlog_capacity)
+    {
+        c->backlog_capacity = (c->backlog_length + length - written) * 2;
+        c->backlog = realloc(c->backlog, c->backlog_capacity);
+    }
+    memcpy(c->backlog + c->backlog_length, data + written, length - written);
+    c->backlog_length += length - written;
+}
+
+static void flush(struct us_socket_t *s, struct connection *c)
+{
+    if (!c->backlog_length)
+    {
+        return;
+    }
+    int written = us_socket_write(0, s, c->backlog, c->backlog_length, 0);
+    memmove(c->backlog, c->backlog + written, c->backlog_length - written);
+    c->backlog_length -= written;
+}
+
+/* binary frame with a zero mask key, so the payload goes out as is */
+static void send_message(struct us_socket_t *s, struct connection *c)
+{
+    uint64_t now = now_us();
+    memcpy(frame + stamp_offset, &now, sizeof(now));
+    write_or_queue(s, c, frame, frame_length);
+    if (measuring)
+    {
+        sent++;
+    }
+}
+
+static void send_pong(struct us_socket_t *s, struct connection *c)
+{
+    char pong[6 + 125] = {(char)0x8A, (char)(0x80 | c->control_length), 0, 0, 0, 0};
+    memcpy(pong + 6, c->control, c->control_length);
+    write_or_queue(s, c, pong, 6 + c->control_length);
+}
+
+static void delivered(struct us_socket_t *s, struct connection *c)
+{
+    if (measuring && c->stamp_length == sizeof(uint64_t))
+    {
+        uint64_t stamp;
+        memcpy(&stamp, c->stamp, sizeof(stamp));
+        uint64_t latency = now_us() - stamp;
+        received++;
+        counts[bucket_index(latency)]++;
+        if (latency > latency_max)
+        {
+            latency_max = latency;
+        }
+    }
+    if (mode == ECHO && rate == 0)
+    {
+        send_message(s, c);
+    }
+}
+
+/* returns 0 once the socket was closed */
+static int frame_complete(struct us_socket_t *s, struct connection *c)
+{
+    switch (c->opcode)
+    {
+    case 1:
+    case 2:
+        delivered(s, c);
+        return 1;
+    case 8:
+        us_socket_close(0, s, 0, NULL);
+        return 0;
+    case 9:
+        send_pong(s, c);
+        return 1;
+    default:
+        return 1;
+    }
+}
+
+/* server frames are unmasked and, from uWS, never fragmented */
+static int parse_frames(struct us_socket_t *s, struct connection *c, const char *data, int length)
+{
+    while (length > 0)
+    {
+        if (!c->in_payload)
+        {
+            c->header[c->header_length++] = (unsigned char)*data++;
+            length--;
+            if (c->header_length == 2)
+            {
+                if (c->header[1] & 0x80)
+                {
+                    return -1;
+                }
+                int short_length = c->header[1] & 127;
+                c->header_needed = 2 + (short_length == 126 ? 2 : short_length == 127 ? 8 : 0);
+            }
+            if (c->header_length < 2 || c->header_length < c->header_needed)
+            {
+                continue;
+            }
+            uint64_t payload = c->header[1] & 127;
+            if (payload >= 126)
+            {
+                payload = 0;
+                for (int i = 2; i < c->header_needed; i++)
+                {
+                    payload = payload << 8 | c->header[i];
+                }
+            }
+            c->opcode = c->header[0] & 15;
+            c->header_length = 0;
+            c->payload_remaining = payload;
+            c->control_length = 0;
+            c->stamp_length = 0;
+            if (c->opcode >= 8 && payload > sizeof(c->control))
+            {
+                return -1;
+            }
+            if (!payload)
+            {
+                if (!frame_complete(s, c))
+                {
+                    return 0;
+                }
+                continue;
+            }
+            c->in_payload = 1;
+            continue;
+        }
+        int take = c->payload_remaining < (uint64_t)length ? (int)c->payload_remaining : length;
+        if (c->opcode >= 8)
+        {
+            memcpy(c->control + c->control_length, data, take);
+            c->control_length += take;
+        }
+        else if (c->stamp_length < (int)sizeof(c->stamp))
+        {
+            int stamp = take < (int)sizeof(c->stamp) - c->stamp_length ? take : (int)sizeof(c->stamp) - c->stamp_length;
+            memcpy(c->stamp + c->stamp_length, data, stamp);
+            c->stamp_length += stamp;
+        }
+        c->payload_remaining -= take;
+        data += take;
+        length -= take;
+        if (!c->payload_remaining)
+        {
+            c->in_payload = 0;
+            if (!frame_complete(s, c))
+            {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static void on_timer(struct us_timer_t *t);
+
+static void connected()
+{
+    if (upgraded + failed < connections)
+    {
+        return;
+    }
+    connect_seconds = (now_us() - connect_started) / 1e6;
+    fprintf(stderr, "%d connections upgraded, %d failed in %.2fs\n", upgraded, failed, connect_seconds);
+    if (!upgraded)
+    {
+        exit(1);
+    }
+    if (warmup)
+    {
+        us_timer_set(timer, on_timer, warmup * 1000, 0);
+    }
+    else
+    {
+        on_timer(timer);
+    }
+}
+
+static void connect_more()
+{
+    while (next_connection < connections && connecting < MAX_CONNECTING)
+    {
+        const char *source = source_count ? sources[next_connection % source_count] : NULL;
+        struct us_socket_t *s = us_socket_context_connect(0, context, host, port, source, 0, sizeof(struct connection));
+        if (!s)
+        {
+            failed++;
+            next_connection++;
+            connected();
+            continue;
+        }
+        struct connection *c = (struct connection *)us_socket_ext(0, s);
+        memset(c, 0, sizeof(*c));
+        c->index = next_connection++;
+        connecting++;
+    }
+}
+
+static struct us_socket_t *on_open(struct us_socket_t *s, int is_client, char *ip, int ip_length)
+{
+    write_or_queue(s, (struct connection *)us_socket_ext(0, s), handshake, handshake_length);
+    return s;
+}
+
+static struct us_socket_t *on_data(struct us_socket_t *s, char *data, int length)
+{
+    struct connection *c = (struct connection *)us_socket_ext(0, s);
+    if (!c->upgraded)
+    {
+        static const char status[] = "HTTP/1.1 101";
+        while (length > 0 && c->head_crlf < 4)
+        {
+            if (c->head_length < (int)sizeof(status) - 1 && *data != status[c->head_length])
+            {
+                return us_socket_close(0, s, 0, NULL);
+            }
+            c->head_crlf = *data == "\r\n\r\n"[c->head_crlf] ? c->head_crlf + 1 : *data == '\r';
+            c->head_length++;
+            data++;
+            length--;
+        }
+        if (c->head_crlf < 4)
+        {
+            return s;
+        }
+        c->upgraded = 1;
+        sockets[c->index] = s;
+        upgraded++;
+        connecting--;
+        connect_more();
+        connected();
+        if (mode == ECHO && rate == 0)
+        {
+            send_message(s, c);
+        }
+    }
+    if (parse_frames(s, c, data, length) < 0)
+    {
+        errors++;
+        return us_socket_close(0, s, 0, NULL);
+    }
+    return s;
+}
+
+static struct us_socket_t *on_writable(struct us_socket_t *s)
+{
+    flush(s, (struct connection *)us_socket_ext(0, s));
+    return s;
+}
+
+static struct us_socket_t *on_close(struct us_socket_t *s, int code, void *reason)
+{
+    struct connection *c = (struct connection *)us_socket_ext(0, s);
+    free(c->backlog);
+    c->backlog = NULL;
+    if (c->upgraded)
+    {
+        sockets[c->index] = NULL;
+        if (measuring)
+        {
+            errors++;
+        }
+        return s;
+    }
+    failed++;
+    connecting--;
+    connect_more();
+    connected();
+    return s;
+}
+
+static struct us_socket_t *on_end(struct us_socket_t *s)
+{
+    return us_socket_close(0, s, 0, NULL);
+}
+
+static struct us_socket_t *on_timeout(struct us_socket_t *s)
+{
+    return s;
+}
+
+static void on_tick(struct us_timer_t *t)
+{
+    if (rate == 0)
+    {
+        return;
+    }
+    int count = mode == FANOUT ? (senders < connections ? senders : connections) : connections;
+    for (int i = 0; i < count; i++)
+    {
+        struct us_socket_t *s = sockets[i];
+        if (!s)
+        {
+            continue;
+        }
+        struct connection *c = (struct connection *)us_socket_ext(0, s);
+        c->credit += rate * TICK_MS / 1000;
+        while (c->credit >= 1)
+        {
+            c->credit--;
+            send_message(s, c);
+        }
+    }
+}
+
+static void on_timer(struct us_timer_t *t)
+{
+    if (!measuring)
+    {
+        measuring = 1;
+        started = now_us();
+        us_timer_set(timer, on_timer, duration * 1000, 0);
+        return;
+    }
+    static const char *modes[] = {"echo", "fanout", "chat"};
+    double seconds = (now_us() - started) / 1e6;
+    printf("{\"mode\":\"%s\",\"connections\":%d,\"failed\":%d,\"connectSeconds\":%.3f,\"senders\":%d,\"rate\":%g,"
+           "\"payload\":%d,\"seconds\":%.3f,\"sent\":%llu,\"received\":%llu,\"errors\":%llu,\"sentPerSecond\":%.1f,"
+           "\"mps\":%.1f,\"latency\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}\n",
+           modes[mode], upgraded, failed, connect_seconds, mode == FANOUT ? senders : upgraded, rate, payload_length,
+           seconds, (unsigned long long)sent, (unsigned long long)received, (unsigned long long)errors,
+           sent / seconds, received / seconds,
+           (unsigned long long)percentile(0.5), (unsigned long long)percentile(0.9),
+           (unsigned long long)percentile(0.99), (unsigned long long)percentile(0.999),
+           (unsigned long long)latency_max);
+    fflush(stdout);
+    exit(0);
+}
+
+static void on_wakeup(struct us_loop_t *loop) {}
+static void on_pre(struct us_loop_t *loop) {}
+static void on_post(struct us_loop_t *loop) {}
+
+static void usage()
+{
+    fprintf(stderr, "usage: ws_load [-h host] [-P port] [-c connections] [-d seconds] [-w warmup seconds] [-u path]"
+                    " [-s payload bytes] [-m echo|fanout|chat] [-S senders] [-r messages per second per sender]"
+                    " [-l source,addresses]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-' || !argv[i][1] || argv[i][2] || i + 1 >= argc)
+        {
+            usage();
+        }
+        char *value = argv[++i];
+        switch (argv[i - 1][1])
+        {
+        case 'h': host = value; break;
+        case 'P': port = atoi(value); break;
+        case 'c': connections = atoi(value); break;
+        case 'd': duration = atoi(value); break;
+        case 'w': warmup = atoi(value); break;
+        case 'u': path = value; break;
+        case 's': payload_length = atoi(value); break;
+        case 'S': senders = atoi(value); break;
+        case 'r': rate = atof(value); break;
+        case 'm':
+            if (strcmp(value, "echo") == 0) mode = ECHO;
+            else if (strcmp(value, "fanout") == 0) mode = FANOUT;
+            else if (strcmp(value, "chat") == 0) mode = CHAT;
+            else usage();
+            break;
+        case 'l':
+            for (char *source = strtok(value, ","); source && source_count < MAX_SOURCES; source = strtok(NULL, ","))
+            {
+                sources[source_count++] = source;
+            }
+            break;
+        default: usage();
+        }
+    }
+    /* the send time is the first 8 bytes of every payload */
+    if (connections < 1 || duration < 1 || warmup < 0 || payload_length < (int)sizeof(uint64_t) || senders < 1 || rate < 0
+        || (mode != ECHO && rate == 0))
+    {
+        usage();
+    }
+
+    /* every connection is a descriptor, the soft limit is usually far below tens of thousands */
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    size_t capacity = 256 + strlen(path) + strlen(host);
+    handshake = malloc(capacity);
+    handshake_length = snprintf(handshake, capacity,
+                                "GET %s HTTP/1.1\r\nHost: %s:%d\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n",
+                                path, host, port);
+
+    frame = malloc(14 + payload_length);
+    frame[0] = (char)0x82;
+    if (payload_length < 126)
+    {
+        frame[1] = (char)(0x80 | payload_length);
+        stamp_offset = 2;
+    }
+    else if (payload_length < 65536)
+    {
+        frame[1] = (char)(0x80 | 126);
+        frame[2] = (char)(payload_length >> 8);
+        frame[3] = (char)payload_length;
+        stamp_offset = 4;
+    }
+    else
+    {
+        frame[1] = (char)(0x80 | 127);
+        for (int i = 0; i < 8; i++)
+        {
+            frame[2 + i] = (char)((uint64_t)payload_length >> (56 - 8 * i));
+        }
+        stamp_offset = 10;
+    }
+    memset(frame + stamp_offset, 0, 4);
+    stamp_offset += 4;
+    memset(frame + stamp_offset, 'x', payload_length);
+    frame_length = stamp_offset + payload_length;
+
+    sockets = calloc(connections, sizeof(*sockets));
+
+    struct us_loop_t *loop = us_create_loop(0, on_wakeup, on_pre, on_post, 0);
+    struct us_socket_context_options_t options = {};
+    context = us_create_socket_context(0, loop, 0, options);
+    us_socket_context_on_open(0, context, on_open);
+    us_socket_context_on_data(0, context, on_data);
+    us_socket_context_on_writable(0, context, on_writable);
+    us_socket_context_on_close(0, context, on_close);
+    us_socket_context_on_end(0, context, on_end);
+    us_socket_context_on_timeout(0, context, on_timeout);
+
+    timer = us_create_timer(loop, 0, 0);
+    ticker = us_create_timer(loop, 0, 0);
+    us_timer_set(ticker, on_tick, TICK_MS, TICK_MS);
+
+    connect_started = now_us();
+    connect_more();
+    us_loop_run(loop);
+    return 0;
+}
@@ -0,0 +1,105 @@
+// Runs the WebSocket scenarios against benchmarks/server.ts over loopback and prints one JSON report.
+//
+//   make -C bindings && make -C benchmarks
+//   ulimit -n 200000
+//   deno run -A --unstable benchmarks/ws_run.ts [--duration=10] [--warmup=2] [--connections=N] [--port=9001]
+//                                               [--payload=32] [--sources=127.0.0.2,127.0.0.3]
+//                                               [--only=echo,fanout] [--server=deno|native] [--out=report.json]
+//
+// Every scenario gets a fresh server. Latencies are microseconds from send to delivery. rssPerConnection is the
+// growth of the server resident set over its idle size divided by the connections, in bytes, sampled while the
+// scenario runs. --connections overrides the connections of every scenario, more than ~28k need --sources.
+
+const options: Record<string, string> = {};
+for (const arg of Deno.args) {
+  const [key, value] = arg.replace(/^--/, '').split('=');
+  options[key] = value ?? 'true';
+}
+const port = options.port ?? '9001';
+const common = [
+  '-P', port,
+  '-d', options.duration ?? '10',
+  '-w', options.warmup ?? '2',
+  '-s', options.payload ?? '32',
+  ...(options.sources ? ['-l', options.sources] : []),
+];
+
+const scenarios: { name: string, connections: number, args: string[] }[] = [
+  // closed loop, one message in flight per connection
+  { name: 'echo', connections: 1000, args: ['-m', 'echo', '-u', '/ws'] },
+  // one publisher, every message delivered to every connection
+  { name: 'fanout', connections: 20000, args: ['-m', 'fanout', '-u', '/fanout', '-S', '1', '-r', '50'] },
+  // everyone publishes to everyone, connections squared deliveries per message round
+  { name: 'chat', connections: 1000, args: ['-m', 'chat', '-u', '/chat', '-r', '1'] },
+];
+const only = options.only?.split(',');
+const kind = options.server ?? 'deno';
+
+async function startServer(): Promise<Deno.ChildProcess> {
+  const command = kind === 'native'
+    ? new Deno.Command(new URL('./native_server', import.meta.url).pathname, { args: [port], stdout: 'piped' })
+    : new Deno.Command(Deno.execPath(), {
+      args: ['run', '-A', '--unstable', new URL('./server.ts', import.meta.url).pathname, port],
+      stdout: 'piped',
+    });
+  const server = command.spawn();
+  const lines = server.stdout.pipeThrough(new TextDecoderStream()).getReader();
+  let output = '';
+  while (!output.includes('listening')) {
+    const { value, done } = await lines.read();
+    if (done) {
+      console.error(`${kind} benchmark server exited before listening`);
+      Deno.exit(1);
+    }
+    output += value;
+  }
+  lines.releaseLock();
+  return server;
+}
+
+async function rss(pid: number): Promise<number> {
+  const status = await Deno.readTextFile(`/proc/${pid}/status`);
+  return Number(status.match(/VmRSS:\s+(\d+) kB/)?.[1] ?? 0) * 1024;
+}
+
+const results = [];
+for (const scenario of scenarios) {
+  if (only && !only.includes(scenario.name)) continue;
+  const connections = Number(options.connections ?? scenario.connections);
+  const server = await startServer();
+  try {
+    const idle = await rss(server.pid);
+    let peak = idle;
+    const sampler = setInterval(async () => {
+      peak = Math.max(peak, await rss(server.pid).catch(() => 0));
+    }, 250);
+    const load = await new Deno.Command(new URL('./ws_load', import.meta.url).pathname, {
+      args: [...common, '-c', String(connections), ...scenario.args],
+      stdout: 'piped',
+    }).output();
+    clearInterval(sampler);
+    if (!load.success) {
+      throw new Error(`${scenario.name} failed with exit code ${load.code}`);
+    }
+    const result = JSON.parse(new TextDecoder().decode(load.stdout));
+    const rssPerConnection = Math.round((peak - idle) / result.connections);
+    console.error(`${scenario.name}: ${result.mps} msg/s delivered, p50 ${result.latency.p50}us, p99 ${result.latency.p99}us, ` +
+      `p99.9 ${result.latency.p999}us, ${rssPerConnection} B/connection`);
+    results.push({ name: scenario.name, ...result, rssIdle: idle, rssPeak: peak, rssPerConnection });
+  } finally {
+    server.kill();
+    await server.status;
+  }
+}
+
+const report = JSON.stringify({
+  date: new Date().toISOString(),
+  deno: Deno.version.deno,
+  cpus: navigator.hardwareConcurrency,
+  server: kind,
+  scenarios: results,
+}, null, 2);
+if (options.out) {
+  await Deno.writeTextFile(options.out, report + '\n');
+}
+console.log(report);
@@ -6,21 +6,2872 @@
 #include <string_view>
 #include "App.h"
 #include <optional>
-extern "C"
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
+#include <cctype>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cstddef>
+#include <future>
+#include <cerrno>
+#include <list>
+#include <chrono>
+#include <charconv>
+#include <cmath>
+#include <uv.h>
+#include <zlib.h>
+#ifdef UWS_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+
+struct Pool;
+struct ResponseCache;
+struct RouteMetrics;
+
+/* single producer (uv thread), single consumer (deno) ring of request records, see uws_app_batched */
+struct RequestRing {
+    /* shared with deno, followed by capacity bytes of records */
+    struct Shared {
+        std::atomic<uint32_t> head;
+        std::atomic<uint32_t> tail;
+        uint32_t capacity;
+        std::atomic<uint32_t> dropped;
+    } *shared;
+    char *data;
+    /* head is only moved by the producer, kept here while a record is being written */
+    uint32_t reserved;
+    std::mutex m;
+    std::condition_variable cv;
+    std::atomic<bool> waiting{false};
+    /* responses handed to deno which were neither answered nor aborted, with the sequence of their request.
+     * uWS reuses the address of an aborted response, the sequence tells a late answer from the new request, uv thread only */
+    std::unordered_map<void *, uint64_t> pending;
+    uint64_t sequence = 0;
+};
+
+struct PublishNode;
+
+/* lock free multi producer stack drained by the loop once per iteration, see publish_enqueue */
+struct PublishQueue {
+    std::atomic<PublishNode *> head{nullptr};
+    std::atomic<uint64_t> sequence{0};
+    /* results of tracked publishes until deno takes them */
+    std::mutex m;
+    std::condition_variable cv;
+    std::unordered_map<uint64_t, std::vector<uint8_t>> results;
+};
+
+/* inbound messages of one batched websocket route, handed to deno once per loop iteration, uv thread only */
+struct MessageBatch {
+    uws_websocket_message_batch_handler handler;
+    std::string records;
+    unsigned int count = 0;
+};
+
+/* written by the loop thread, read by uws_loop_stats while it runs. Times are nanoseconds */
+struct LoopStats {
+    std::atomic<uint64_t> iterations{0};
+    std::atomic<uint64_t> wakeups{0};
+    /* tasks given to loop->defer which did not run yet */
+    std::atomic<uint64_t> deferred{0};
+    std::atomic<uint64_t> deferred_max{0};
+    /* calls into deno, the loop is blocked meanwhile */
+    std::atomic<uint64_t> callbacks{0};
+    std::atomic<uint64_t> callback_time{0};
+    std::atomic<uint64_t> callback_max{0};
+    /* time spent waiting for events, sampled with the lag timer */
+    std::atomic<uint64_t> idle_time{0};
+    /* how late the lag timer fired */
+    std::atomic<uint64_t> lag{0};
+    std::atomic<uint64_t> lag_max{0};
+    uint64_t started = 0;
+    uint64_t last_tick = 0;
+};
+
+static void atomic_max(std::atomic<uint64_t> &target, uint64_t value)
+{
+    uint64_t current = target.load(std::memory_order_relaxed);
+    while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+/* response of a measured route between dispatch and end */
+struct InflightRequest {
+    RouteMetrics *route;
+    std::chrono::steady_clock::time_point start;
+    /* index of the status class, 1 for 2xx */
+    unsigned int status;
+    uint64_t written;
+};
+
+struct Worker {
+    uws_app_t *app;
+    struct uWS::Loop *loop;
+    std::shared_ptr<std::thread> thread;
+    /* fulfilled by the worker thread once loop and app exist, a promise cannot lose the wakeup like a bare
+       condition variable could */
+    std::promise<void> started;
+    /* set when the worker is one of the loops of a pool */
+    Pool *pool = nullptr;
+    RequestRing *ring = nullptr;
+    /* request snapshot handed to method and upgrade handlers, reused for every request of this loop */
+    std::vector<char> snapshot;
+    PublishQueue publishes;
+    /* open websockets of this loop, uv thread only */
+    std::unordered_set<void *> websockets;
+    /* compression of each websocket route, by its socket context, recorded for upgrades deno completes */
+    std::unordered_map<void *, uws_compress_options_t> websocket_compression;
+    /* websockets which negotiated permessage-deflate without server context takeover, those take the deflated
+       payload of a prepared message as it is. The upgrade sets upgrade_shared_deflate, the open handler it calls
+       picks it up */
+    std::unordered_set<void *> shared_deflate;
+    bool upgrade_shared_deflate = false;
+    /* one per websocket route registered with message_batch, flushed by the post handler */
+    std::vector<MessageBatch *> message_batches;
+    /* gzip and deflate streams and the output buffer of uws_res_end_compressed, reused by every response of
+       this loop. Only the deno thread compresses so one of each is enough */
+    z_stream *deflaters[2] = {};
+    std::string compressed;
+    /* created by the first cached route */
+    ResponseCache *cache = nullptr;
+    size_t cache_limit = 16 * 1024 * 1024;
+    LoopStats stats;
+    /* set by uws_app_metrics, routes registered afterwards are measured */
+    std::atomic<bool> metrics{false};
+    std::mutex inflight_lock;
+    std::unordered_map<void *, InflightRequest> inflight;
+    uv_loop_t *uv_loop = nullptr;
+    /* listen sockets of this loop and the inherited listen fds it accepts from, uv thread only */
+    std::vector<struct us_listen_socket_t *> listen_sockets;
+    std::vector<uv_poll_t *> adopted;
+    /* open HTTP connections, counted by a filter handler, uv thread only */
+    std::unordered_set<void *> connections;
+    /* set once uws_app_close started draining, uv thread only */
+    bool closing = false;
+    bool drained = false;
+    bool stopped = false;
+    std::atomic<bool> close_requested{false};
+    /* fulfilled by the worker thread once its loop returned, with whether the drain finished before the timeout */
+    std::promise<bool> closed;
+    std::shared_future<bool> stopped_future = closed.get_future().share();
+};
+
+struct Pool {
+    std::vector<Worker *> workers;
+};
+
+/* loop->defer keeping the queue depth for uws_loop_stats */
+template <typename F>
+static void worker_defer(Worker *w, F &&task)
+{
+    atomic_max(w->stats.deferred_max, w->stats.deferred.fetch_add(1, std::memory_order_relaxed) + 1);
+    w->stats.wakeups.fetch_add(1, std::memory_order_relaxed);
+    w->loop->defer([w, task = std::forward<F>(task)]() mutable {
+        w->stats.deferred.fetch_sub(1, std::memory_order_relaxed);
+        task();
+    });
+}
+
+/* measures how long the loop thread is blocked in a deno callback */
+struct CallbackScope {
+    Worker *w;
+    uint64_t start;
+
+    explicit CallbackScope(Worker *w) : w(w), start(uv_hrtime()) {}
+
+    ~CallbackScope()
+    {
+        uint64_t elapsed = uv_hrtime() - start;
+        w->stats.callbacks.fetch_add(1, std::memory_order_relaxed);
+        w->stats.callback_time.fetch_add(elapsed, std::memory_order_relaxed);
+        atomic_max(w->stats.callback_max, elapsed);
+    }
+};
+
+template <bool SSL, typename H>
+static void app_route(uWS::TemplatedApp<SSL> *app, uws_method_t method, const std::string &pattern, H &&handler)
+{
+    switch (method)
+    {
+    case METHOD_GET: app->get(pattern, std::forward<H>(handler)); break;
+    case METHOD_POST: app->post(pattern, std::forward<H>(handler)); break;
+    case METHOD_OPTIONS: app->options(pattern, std::forward<H>(handler)); break;
+    case METHOD_DELETE: app->del(pattern, std::forward<H>(handler)); break;
+    case METHOD_PATCH: app->patch(pattern, std::forward<H>(handler)); break;
+    case METHOD_PUT: app->put(pattern, std::forward<H>(handler)); break;
+    case METHOD_HEAD: app->head(pattern, std::forward<H>(handler)); break;
+    case METHOD_CONNECT: app->connect(pattern, std::forward<H>(handler)); break;
+    case METHOD_TRACE: app->trace(pattern, std::forward<H>(handler)); break;
+    case METHOD_ANY: app->any(pattern, std::forward<H>(handler)); break;
+    }
+}
+
+static const char *METHOD_NAMES[] = {"GET", "POST", "OPTIONS", "DELETE", "PATCH", "PUT", "HEAD", "CONNECT", "TRACE", "ANY"};
+
+/* hdr style histogram of microseconds, 8 linear sub buckets per power of two keep the error below 12.5% */
+struct LatencyHistogram {
+    static const int SUB_BUCKET_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    /* up to 2^40 microseconds */
+    static const int BUCKETS = (40 - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+    std::atomic<uint64_t> counts[BUCKETS]{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+
+    static int index(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+        {
+            return (int)value;
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        int i = (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + (int)((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+        return std::min(i, BUCKETS - 1);
+    }
+
+    /* highest value counted by bucket i */
+    static uint64_t upper(int i)
+    {
+        if (i < SUB_BUCKETS)
+        {
+            return i;
+        }
+        int exponent = i / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        uint64_t sub = i % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (exponent - SUB_BUCKET_BITS)) - 1;
+    }
+
+    void record(uint64_t value)
+    {
+        counts[index(value)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        atomic_max(max, value);
+    }
+
+    uint64_t percentile(double q) const
+    {
+        uint64_t total = count.load(std::memory_order_relaxed);
+        if (!total)
+        {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * total));
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+            {
+                return std::min(upper(i), max.load(std::memory_order_relaxed));
+            }
+        }
+        return max.load(std::memory_order_relaxed);
+    }
+
+    /* requests that took at most value */
+    uint64_t count_below(uint64_t value) const
+    {
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS && upper(i) <= value; i++)
+        {
+            seen += counts[i].load(std::memory_order_relaxed);
+        }
+        return seen;
+    }
+};
+
+/* shared by the loops of a pool registering the same route */
+struct RouteMetrics {
+    std::string method;
+    std::string pattern;
+    std::atomic<uint64_t> requests{0};
+    /* 1xx to 5xx */
+    std::atomic<uint64_t> statuses[5]{};
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    /* from dispatch until end was called */
+    LatencyHistogram latency;
+};
+
+struct WebSocketMetrics {
+    std::string pattern;
+    std::atomic<uint64_t> opened{0};
+    std::atomic<uint64_t> closed{0};
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> bytes_in{0};
+};
+
+/* process wide, entries live as long as the process */
+struct MetricsRegistry {
+    std::mutex m;
+    std::list<RouteMetrics> routes;
+    std::list<WebSocketMetrics> websockets;
+
+    RouteMetrics *route(uws_method_t method, const std::string &pattern)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        for (auto &route : routes)
+        {
+            if (route.method == METHOD_NAMES[method] && route.pattern == pattern)
+            {
+                return &route;
+            }
+        }
+        routes.emplace_back();
+        routes.back().method = METHOD_NAMES[method];
+        routes.back().pattern = pattern;
+        return &routes.back();
+    }
+
+    WebSocketMetrics *websocket(const std::string &pattern)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        for (auto &websocket : websockets)
+        {
+            if (websocket.pattern == pattern)
+            {
+                return &websocket;
+            }
+        }
+        websockets.emplace_back();
+        websockets.back().pattern = pattern;
+        return &websockets.back();
+    }
+};
+
+static MetricsRegistry metrics_registry;
+
+static unsigned int status_class(std::string_view status)
+{
+    if (status.length() && status[0] >= '1' && status[0] <= '5')
+    {
+        return status[0] - '1';
+    }
+    return 1;
+}
+
+static void metrics_record(RouteMetrics *route, unsigned int status, uint64_t bytes, std::chrono::steady_clock::time_point start)
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    route->statuses[status].fetch_add(1, std::memory_order_relaxed);
+    route->bytes_out.fetch_add(bytes, std::memory_order_relaxed);
+    route->latency.record(elapsed.count());
+}
+
+static void metrics_start(Worker *w, void *res, RouteMetrics *route, uWS::HttpRequest *req)
+{
+    uint64_t length = 0;
+    std::string_view content_length = req->getHeader("content-length");
+    std::from_chars(content_length.data(), content_length.data() + content_length.length(), length);
+    route->requests.fetch_add(1, std::memory_order_relaxed);
+    route->bytes_in.fetch_add(length, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(w->inflight_lock);
+    /* replaces the entry of an aborted response which lived at the same address */
+    w->inflight[res] = InflightRequest{route, std::chrono::steady_clock::now(), 1, 0};
+}
+
+static void metrics_status(Worker *w, void *res, std::string_view status)
+{
+    if (!w->metrics.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(w->inflight_lock);
+    auto inflight = w->inflight.find(res);
+    if (inflight != w->inflight.end())
+    {
+        inflight->second.status = status_class(status);
+    }
+}
+
+static void metrics_write(Worker *w, void *res, uint64_t bytes)
+{
+    if (!w->metrics.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(w->inflight_lock);
+    auto inflight = w->inflight.find(res);
+    if (inflight != w->inflight.end())
+    {
+        inflight->second.written += bytes;
+    }
+}
+
+static void metrics_end(Worker *w, void *res, uint64_t bytes)
+{
+    if (!w->metrics.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(w->inflight_lock);
+    auto found = w->inflight.find(res);
+    if (found == w->inflight.end())
+    {
+        return;
+    }
+    InflightRequest inflight = found->second;
+    w->inflight.erase(found);
+    lock.unlock();
+    metrics_record(inflight.route, inflight.status, inflight.written + bytes, inflight.start);
+}
+
+static void append_escaped(std::string &out, std::string_view value)
+{
+    for (char c : value)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out.push_back('\\');
+            out.push_back(c);
+        }
+        else if (c == '\n')
+        {
+            out.append("\\n");
+        }
+        else
+        {
+            out.push_back(c);
+        }
+    }
+}
+
+static std::string metrics_json()
+{
+    static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+    std::lock_guard<std::mutex> lock(metrics_registry.m);
+    std::string out = "{\"routes\":[";
+    for (auto &route : metrics_registry.routes)
+    {
+        if (out.back() != '[')
+        {
+            out.push_back(',');
+        }
+        out.append("{\"method\":\"").append(route.method).append("\",\"pattern\":\"");
+        append_escaped(out, route.pattern);
+        out.append("\",\"requests\":").append(std::to_string(route.requests.load()));
+        out.append(",\"statuses\":[");
+        for (int i = 0; i < 5; i++)
+        {
+            out.append(i ? "," : "").append(std::to_string(route.statuses[i].load()));
+        }
+        out.append("],\"bytesIn\":").append(std::to_string(route.bytes_in.load()));
+        out.append(",\"bytesOut\":").append(std::to_string(route.bytes_out.load()));
+        out.append(",\"latency\":{\"count\":").append(std::to_string(route.latency.count.load()));
+        out.append(",\"sum\":").append(std::to_string(route.latency.sum.load()));
+        out.append(",\"max\":").append(std::to_string(route.latency.max.load()));
+        out.append(",\"percentiles\":[");
+        for (int i = 0; i < 4; i++)
+        {
+            out.append(i ? "," : "").append(std::to_string(route.latency.percentile(QUANTILES[i])));
+        }
+        out.append("]}}");
+    }
+    out.append("],\"websockets\":[");
+    for (auto &websocket : metrics_registry.websockets)
+    {
+        if (out.back() != '[')
+        {
+            out.push_back(',');
+        }
+        out.append("{\"pattern\":\"");
+        append_escaped(out, websocket.pattern);
+        out.append("\",\"opened\":").append(std::to_string(websocket.opened.load()));
+        out.append(",\"closed\":").append(std::to_string(websocket.closed.load()));
+        out.append(",\"messages\":").append(std::to_string(websocket.messages.load()));
+        out.append(",\"bytesIn\":").append(std::to_string(websocket.bytes_in.load()));
+        out.append("}");
+    }
+    out.append("]}");
+    return out;
+}
+
+/* text exposition format, the latency histogram is folded into the usual seconds buckets */
+static std::string metrics_prometheus()
+{
+    static const std::pair<uint64_t, const char *> BOUNDS[] = {
+        {500, "0.0005"}, {1000, "0.001"}, {2500, "0.0025"}, {5000, "0.005"}, {10000, "0.01"}, {25000, "0.025"}, {50000, "0.05"},
+        {100000, "0.1"}, {250000, "0.25"}, {500000, "0.5"}, {1000000, "1"}, {2500000, "2.5"}, {5000000, "5"}, {10000000, "10"}};
+    static const char *STATUSES[] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+    std::lock_guard<std::mutex> lock(metrics_registry.m);
+    std::string out;
+    auto labels = [&out](const RouteMetrics &route) {
+        out.append("{method=\"").append(route.method).append("\",route=\"");
+        append_escaped(out, route.pattern);
+        out.push_back('"');
+    };
+    out.append("# TYPE uws_http_requests_total counter\n");
+    for (auto &route : metrics_registry.routes)
+    {
+        for (int i = 0; i < 5; i++)
+        {
+            out.append("uws_http_requests_total");
+            labels(route);
+            out.append(",status=\"").append(STATUSES[i]).append("\"} ").append(std::to_string(route.statuses[i].load())).append("\n");
+        }
+    }
+    out.append("# TYPE uws_http_received_bytes_total counter\n");
+    for (auto &route : metrics_registry.routes)
+    {
+        out.append("uws_http_received_bytes_total");
+        labels(route);
+        out.append("} ").append(std::to_string(route.bytes_in.load())).append("\n");
+    }
+    out.append("# TYPE uws_http_sent_bytes_total counter\n");
+    for (auto &route : metrics_registry.routes)
+    {
+        out.append("uws_http_sent_bytes_total");
+        labels(route);
+        out.append("} ").append(std::to_string(route.bytes_out.load())).append("\n");
+    }
+    out.append("# TYPE uws_http_request_duration_seconds histogram\n");
+    for (auto &route : metrics_registry.routes)
+    {
+        for (auto &bound : BOUNDS)
+        {
+            out.append("uws_http_request_duration_seconds_bucket");
+            labels(route);
+            out.append(",le=\"").append(bound.second).append("\"} ").append(std::to_string(route.latency.count_below(bound.first))).append("\n");
+        }
+        out.append("uws_http_request_duration_seconds_bucket");
+        labels(route);
+        out.append(",le=\"+Inf\"} ").append(std::to_string(route.latency.count.load())).append("\n");
+        out.append("uws_http_request_duration_seconds_sum");
+        labels(route);
+        out.append("} ").append(std::to_string(route.latency.sum.load() / 1e6)).append("\n");
+        out.append("uws_http_request_duration_seconds_count");
+        labels(route);
+        out.append("} ").append(std::to_string(route.latency.count.load())).append("\n");
+    }
+    static const char *WEBSOCKET_COUNTERS[] = {"uws_websocket_opened_total", "uws_websocket_closed_total", "uws_websocket_messages_total", "uws_websocket_received_bytes_total"};
+    for (int i = 0; i < 4; i++)
+    {
+        out.append("# TYPE ").append(WEBSOCKET_COUNTERS[i]).append(" counter\n");
+        for (auto &websocket : metrics_registry.websockets)
+        {
+            const std::atomic<uint64_t> *values[] = {&websocket.opened, &websocket.closed, &websocket.messages, &websocket.bytes_in};
+            out.append(WEBSOCKET_COUNTERS[i]).append("{route=\"");
+            append_escaped(out, websocket.pattern);
+            out.append("\"} ").append(std::to_string(values[i]->load())).append("\n");
+        }
+    }
+    return out;
+}
+
+/* route parameters are the pattern segments starting with ':' */
+static unsigned int count_parameters(std::string_view pattern)
+{
+    unsigned int count = 0;
+    for (size_t i = 1; i < pattern.length(); i++)
+    {
+        if (pattern[i] == ':' && pattern[i - 1] == '/')
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+/* request snapshot, little endian u32 fields:
+ *   size, parameter count, header count,
+ *   (offset, length) pairs of method, url, query, every parameter, every header key and value,
+ *   followed by the bytes they point to. Offsets are relative to the snapshot start. */
+static size_t request_snapshot_size(uWS::HttpRequest *req, unsigned int parameters)
+{
+    size_t fields = 3 + parameters;
+    size_t bytes = req->getCaseSensitiveMethod().length() + req->getUrl().length() + req->getQuery().length();
+    for (unsigned int i = 0; i < parameters; i++)
+    {
+        bytes += req->getParameter(i).length();
+    }
+    for (auto header : *req)
+    {
+        fields += 2;
+        bytes += header.first.length() + header.second.length();
+    }
+    return 12 + fields * 8 + bytes;
+}
+
+static void write_request_snapshot(uWS::HttpRequest *req, unsigned int parameters, size_t size, char *dest)
+{
+    uint32_t *table = (uint32_t *) dest;
+    uint32_t offset = 12 + (3 + parameters) * 8;
+    uint32_t headers = 0;
+    for (auto header : *req)
+    {
+        (void) header;
+        headers++;
+    }
+    offset += headers * 16;
+    table[0] = size;
+    table[1] = parameters;
+    table[2] = headers;
+    uint32_t *field = table + 3;
+    auto put = [&](std::string_view value) {
+        memcpy(dest + offset, value.data(), value.length());
+        *field++ = offset;
+        *field++ = value.length();
+        offset += value.length();
+    };
+    put(req->getCaseSensitiveMethod());
+    put(req->getUrl());
+    put(req->getQuery());
+    for (unsigned int i = 0; i < parameters; i++)
+    {
+        put(req->getParameter(i));
+    }
+    for (auto header : *req)
+    {
+        put(header.first);
+        put(header.second);
+    }
+}
+
+enum RequestRecordType : uint32_t {
+    RECORD_PADDING = 0,
+    RECORD_REQUEST = 1,
+    RECORD_ABORTED = 2
+};
+
+/* every record starts with: u32 size, u32 type, u32 route, u32 reserved, u64 res, u64 sequence */
+static const uint32_t REQUEST_RECORD_HEADER = 32;
+
+static RequestRing *create_request_ring(uint32_t capacity)
+{
+    // capacity is rounded up to a power of two so positions can wrap with a mask
+    uint32_t rounded = 4096;
+    while (rounded < capacity)
+    {
+        rounded <<= 1;
+    }
+    RequestRing *ring = new RequestRing();
+    char *memory = (char *) aligned_alloc(64, sizeof(RequestRing::Shared) + rounded);
+    ring->shared = new (memory) RequestRing::Shared();
+    ring->shared->capacity = rounded;
+    ring->data = memory + sizeof(RequestRing::Shared);
+    return ring;
+}
+
+/* returns where a record of size bytes can be written or nullptr when the ring is full */
+static char *ring_reserve(RequestRing *ring, uint32_t size)
+{
+    uint32_t capacity = ring->shared->capacity;
+    uint32_t head = ring->shared->head.load(std::memory_order_relaxed);
+    uint32_t tail = ring->shared->tail.load(std::memory_order_acquire);
+    uint32_t offset = head & (capacity - 1);
+    uint32_t contiguous = capacity - offset;
+    // records never wrap, the end of the ring is skipped with a padding record
+    uint32_t needed = size <= contiguous ? size : size + contiguous;
+    if (capacity - (head - tail) < needed)
+    {
+        return nullptr;
+    }
+    if (size > contiguous)
+    {
+        uint32_t *padding = (uint32_t *) (ring->data + offset);
+        padding[0] = contiguous;
+        padding[1] = RECORD_PADDING;
+        head += contiguous;
+        offset = 0;
+    }
+    ring->reserved = head;
+    return ring->data + offset;
+}
+
+static void ring_commit(RequestRing *ring, uint32_t size)
+{
+    ring->shared->head.store(ring->reserved + size, std::memory_order_seq_cst);
+    // only take the lock when deno sleeps in uws_request_ring_wait
+    if (ring->waiting.load(std::memory_order_seq_cst))
+    {
+        std::lock_guard lk(ring->m);
+        ring->cv.notify_one();
+    }
+}
+
+static bool ring_push_request(RequestRing *ring, uint32_t route, void *res, uint64_t sequence, uWS::HttpRequest *req, unsigned int parameters)
+{
+    size_t snapshot = request_snapshot_size(req, parameters);
+    uint32_t size = (REQUEST_RECORD_HEADER + snapshot + 7) & ~7u;
+    char *record = size < ring->shared->capacity ? ring_reserve(ring, size) : nullptr;
+    if (!record)
+    {
+        ring->shared->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    uint32_t *header = (uint32_t *) record;
+    header[0] = size;
+    header[1] = RECORD_REQUEST;
+    header[2] = route;
+    header[3] = 0;
+    memcpy(record + 16, &res, sizeof(void *));
+    memcpy(record + 24, &sequence, sizeof(uint64_t));
+    write_request_snapshot(req, parameters, snapshot, record + REQUEST_RECORD_HEADER);
+    ring_commit(ring, size);
+    return true;
+}
+
+static void ring_push_aborted(RequestRing *ring, void *res, uint64_t sequence)
+{
+    char *record = ring_reserve(ring, REQUEST_RECORD_HEADER);
+    if (!record)
+    {
+        // deno finds out when answering, uws_ring_res_end ignores aborted responses
+        ring->shared->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint32_t *header = (uint32_t *) record;
+    header[0] = REQUEST_RECORD_HEADER;
+    header[1] = RECORD_ABORTED;
+    header[2] = 0;
+    header[3] = 0;
+    memcpy(record + 16, &res, sizeof(void *));
+    memcpy(record + 24, &sequence, sizeof(uint64_t));
+    ring_commit(ring, REQUEST_RECORD_HEADER);
+}
+
+template <bool SSL>
+static void app_batched(Worker *w, uws_method_t method, std::string pattern, uint32_t route)
+{
+    uWS::TemplatedApp<SSL> *uwsApp = (uWS::TemplatedApp<SSL> *)w->app;
+    unsigned int parameters = count_parameters(pattern);
+    app_route(uwsApp, method, pattern, [w, route, parameters](auto *res, auto *req) {
+        RequestRing *ring = w->ring;
+        uint64_t sequence = ++ring->sequence;
+        if (!ring_push_request(ring, route, res, sequence, req, parameters))
+        {
+            res->writeStatus("503 Service Unavailable")->end();
+            return;
+        }
+        ring->pending[res] = sequence;
+        res->onAborted([ring, res, sequence]() {
+            auto it = ring->pending.find(res);
+            if (it != ring->pending.end() && it->second == sequence)
+            {
+                ring->pending.erase(it);
+                ring_push_aborted(ring, res, sequence);
+            }
+        });
+    });
+}
+
+/* headers are packed as u32 key length, key, u32 value length, value */
+template <typename F>
+static void for_each_packed_header(std::string_view headers, F &&f)
+{
+    auto next = [&headers](std::string_view &field) {
+        uint32_t length;
+        if (headers.length() < 4)
+        {
+            return false;
+        }
+        memcpy(&length, headers.data(), 4);
+        headers.remove_prefix(4);
+        field = headers.substr(0, length);
+        headers.remove_prefix(field.length());
+        return true;
+    };
+    std::string_view key, value;
+    while (next(key) && next(value))
+    {
+        f(key, value);
+    }
+}
+
+template <bool SSL>
+static void write_packed_headers(uWS::HttpResponse<SSL> *res, std::string_view headers)
+{
+    for_each_packed_header(headers, [res](std::string_view key, std::string_view value) {
+        res->writeHeader(key, value);
+    });
+}
+
+/* status and headers parsed once, the views point into storage */
+struct HeaderBlock {
+    std::string storage;
+    std::string_view status;
+    std::vector<std::pair<std::string_view, std::string_view>> headers;
+};
+
+static void fill_header_block(HeaderBlock &block, std::string_view status, std::string_view packed_headers)
+{
+    block.storage.reserve(status.length() + packed_headers.length());
+    block.storage.append(status);
+    block.storage.append(packed_headers);
+    std::string_view storage = block.storage;
+    block.status = storage.substr(0, status.length());
+    for_each_packed_header(storage.substr(status.length()), [&block](std::string_view key, std::string_view value) {
+        block.headers.emplace_back(key, value);
+    });
+}
+
+static std::shared_ptr<HeaderBlock> make_header_block(std::string_view status, std::string_view packed_headers)
+{
+    auto block = std::make_shared<HeaderBlock>();
+    fill_header_block(*block, status, packed_headers);
+    return block;
+}
+
+template <bool SSL>
+static void write_header_block(uWS::HttpResponse<SSL> *res, const HeaderBlock &block)
+{
+    if (block.status.length())
+    {
+        res->writeStatus(block.status);
+    }
+    for (auto &header : block.headers)
+    {
+        res->writeHeader(header.first, header.second);
+    }
+}
+
+/* prepared header blocks and bodies, registered once and kept for the lifetime of the process.
+   Lookups from any loop are lock free */
+template <typename T>
+struct PreparedRegistry {
+    static const uint32_t CAPACITY = 4096;
+    std::atomic<uint32_t> count{0};
+    std::atomic<T *> slots[CAPACITY];
+
+    /* ids start at 1, 0 when the registry is full */
+    uint32_t add(T *item)
+    {
+        uint32_t index = count.fetch_add(1, std::memory_order_relaxed);
+        if (index >= CAPACITY)
+        {
+            delete item;
+            return 0;
+        }
+        slots[index].store(item, std::memory_order_release);
+        return index + 1;
+    }
+
+    T *get(uint32_t id)
+    {
+        return id && id <= CAPACITY ? slots[id - 1].load(std::memory_order_acquire) : nullptr;
+    }
+};
+
+static PreparedRegistry<HeaderBlock> prepared_headers;
+static PreparedRegistry<std::string> prepared_bodies;
+
+static void metrics_prepared(Worker *w, void *res, unsigned int headers_id, unsigned int body_id, size_t body_length)
+{
+    if (!w->metrics.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    HeaderBlock *head = prepared_headers.get(headers_id);
+    std::string *body = body_id ? prepared_bodies.get(body_id) : nullptr;
+    if (head)
+    {
+        metrics_status(w, res, head->status);
+    }
+    metrics_end(w, res, body ? body->length() : body_length);
+}
+
+/* unknown ids write no headers and an empty body */
+template <bool SSL>
+static void res_end_prepared(uWS::HttpResponse<SSL> *res, uint32_t headers_id, uint32_t body_id, std::string_view body, bool close_connection)
+{
+    const HeaderBlock *block = prepared_headers.get(headers_id);
+    if (body_id)
+    {
+        const std::string *prepared = prepared_bodies.get(body_id);
+        body = prepared ? std::string_view(*prepared) : std::string_view();
+    }
+    res->cork([res, block, body, close_connection]() {
+        if (block)
+        {
+            write_header_block(res, *block);
+        }
+        res->end(body, close_connection);
+    });
+}
+
+/* answered from the route handler without calling into deno */
+struct StaticResponse {
+    std::shared_ptr<HeaderBlock> head;
+    std::string body;
+};
+
+template <bool SSL>
+static void app_static_response(Worker *w, uws_method_t method, const std::string &pattern, std::shared_ptr<StaticResponse> response)
+{
+    uWS::TemplatedApp<SSL> *uwsApp = (uWS::TemplatedApp<SSL> *)w->app;
+    app_route(uwsApp, method, pattern, [response](auto *res, auto *req) {
+        write_header_block(res, *response->head);
+        res->end(response->body);
+    });
+}
+
+/* GET responses filled by deno through uws_res_end_cached and answered from the route handler until they expire.
+   Looked up on the uv thread and filled from the deno thread, hence the lock */
+struct CachedResponse {
+    std::string key;
+    StaticResponse response;
+    std::chrono::steady_clock::time_point expires;
+    size_t size;
+};
+
+struct ResponseCache {
+    std::mutex m;
+    size_t limit;
+    size_t bytes = 0;
+    /* most recently used first */
+    std::list<std::shared_ptr<CachedResponse>> lru;
+    std::unordered_map<std::string_view, std::list<std::shared_ptr<CachedResponse>>::iterator> entries;
+    /* keys of the misses handed to deno, replaced when the response address is reused */
+    std::unordered_map<void *, std::string> pending;
+    std::string key;
+
+    void erase(std::list<std::shared_ptr<CachedResponse>>::iterator it)
+    {
+        bytes -= (*it)->size;
+        entries.erase((*it)->key);
+        lru.erase(it);
+    }
+
+    std::shared_ptr<CachedResponse> find(std::string_view key)
+    {
+        auto entry = entries.find(key);
+        if (entry == entries.end())
+        {
+            return nullptr;
+        }
+        if ((*entry->second)->expires <= std::chrono::steady_clock::now())
+        {
+            erase(entry->second);
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, entry->second);
+        return *entry->second;
+    }
+
+    void insert(std::shared_ptr<CachedResponse> response)
+    {
+        auto entry = entries.find(response->key);
+        if (entry != entries.end())
+        {
+            erase(entry->second);
+        }
+        if (response->size > limit)
+        {
+            return;
+        }
+        while (bytes + response->size > limit)
+        {
+            erase(std::prev(lru.end()));
+        }
+        bytes += response->size;
+        lru.push_front(response);
+        entries.emplace(response->key, lru.begin());
+    }
+};
+
+/* method, full url and the vary header values, separated by newlines which cannot appear in any of them */
+static void build_cache_key(std::string &key, uWS::HttpRequest *req, const std::vector<std::string> &vary)
+{
+    key.assign(req->getCaseSensitiveMethod());
+    key.push_back('\n');
+    key.append(req->getFullUrl());
+    for (auto &header : vary)
+    {
+        key.push_back('\n');
+        key.append(req->getHeader(header));
+    }
+}
+
+/* drops the key of a miss ended some other way than uws_res_end_cached, or aborted, before its address is reused */
+static void cache_forget(Worker *w, void *res)
+{
+    ResponseCache *cache = w->cache;
+    if (!cache)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(cache->m);
+    cache->pending.erase(res);
+}
+
+/* true when the request was answered from the cache, otherwise its key waits for uws_res_end_cached.
+   A miss drops its key when aborted, until deno installs its own abort handler, which does the same */
+template <bool SSL>
+static bool cache_serve(Worker *w, uWS::HttpResponse<SSL> *res, uWS::HttpRequest *req, const std::vector<std::string> &vary)
+{
+    ResponseCache *cache = w->cache;
+    std::unique_lock<std::mutex> lock(cache->m);
+    build_cache_key(cache->key, req, vary);
+    std::shared_ptr<CachedResponse> cached = cache->find(cache->key);
+    if (!cached)
+    {
+        cache->pending[res] = cache->key;
+        lock.unlock();
+        res->onAborted([w, res]() {
+            cache_forget(w, res);
+        });
+        return false;
+    }
+    lock.unlock();
+    metrics_status(w, res, cached->response.head->status);
+    metrics_end(w, res, cached->response.body.length());
+    res->cork([&]() {
+        write_header_block(res, *cached->response.head);
+        res->end(cached->response.body);
+    });
+    return true;
+}
+
+/* headers were written already, they are repeated here for the cached copy */
+template <bool SSL>
+static void res_end_cached(Worker *w, uWS::HttpResponse<SSL> *res, unsigned int ttl, std::string_view status, std::string_view headers, std::string_view body, bool close_connection)
+{
+    ResponseCache *cache = w->cache;
+    if (cache)
+    {
+        std::lock_guard<std::mutex> lock(cache->m);
+        auto pending = cache->pending.find(res);
+        if (pending != cache->pending.end())
+        {
+            if (ttl)
+            {
+                auto cached = std::make_shared<CachedResponse>();
+                cached->key = std::move(pending->second);
+                cached->response.head = make_header_block(status, headers);
+                cached->response.body = body;
+                cached->expires = std::chrono::steady_clock::now() + std::chrono::milliseconds(ttl);
+                cached->size = cached->key.length() + status.length() + headers.length() + body.length();
+                cache->insert(std::move(cached));
+            }
+            cache->pending.erase(pending);
+        }
+    }
+    res->end(body, close_connection);
+}
+
+/* writes total body bytes taken from source.chunk(offset, total). An empty chunk closes the connection, unless the
+   source is waiting() for more, it then resumes the pump itself */
+template <bool SSL, typename Source>
+static bool pump_response(uWS::HttpResponse<SSL> *res, Source &source, uintmax_t total, bool close_connection)
+{
+    uintmax_t offset = res->getWriteOffset();
+    while (offset < total)
+    {
+        std::string_view chunk = source.chunk(offset, total);
+        if (!chunk.length())
+        {
+            if (source.waiting())
+            {
+                return false;
+            }
+            res->close();
+            return true;
+        }
+        auto [ok, done] = res->tryEnd(chunk, total, close_connection);
+        if (done)
+        {
+            return true;
+        }
+        if (!ok)
+        {
+            return false;
+        }
+        offset = res->getWriteOffset();
+    }
+    return true;
+}
+
+/* streams the body with tryEnd and continues from onWritable while the socket is backpressured.
+   Returns true when the response finished before returning, the source is then released by the caller */
+template <bool SSL, typename Source>
+static bool stream_response(uWS::HttpResponse<SSL> *res, std::shared_ptr<Source> source, uintmax_t total, bool close_connection = false)
+{
+    if (!total)
+    {
+        res->end({}, close_connection);
+        return true;
+    }
+    if (pump_response(res, *source, total, close_connection))
+    {
+        return true;
+    }
+    res->onWritable([res, source, total, close_connection](uintmax_t) {
+        return pump_response(res, *source, total, close_connection);
+    });
+    /* the source is released together with the handlers */
+    res->onAborted([]() {});
+    return false;
+}
+
+/* body borrowed from deno, release hands it back once the response finished or was aborted */
+struct OwnedSource {
+    const char *data;
+    void (*release)(const char *data);
+
+    std::string_view chunk(uintmax_t written, uintmax_t total)
+    {
+        return std::string_view(data + written, total - written);
+    }
+
+    bool waiting() const
+    {
+        return false;
+    }
+
+    ~OwnedSource()
+    {
+        if (release)
+        {
+            release(data);
+        }
+    }
+};
+
+template <bool SSL>
+static bool res_end_owned(uWS::HttpResponse<SSL> *res, const char *data, size_t length, bool close_connection, void (*release)(const char *data))
+{
+    auto source = std::make_shared<OwnedSource>();
+    source->data = data;
+    source->release = release;
+    if (stream_response(res, source, length, close_connection))
+    {
+        /* deno still owns a body that was written right away */
+        source->release = nullptr;
+        return true;
+    }
+    return false;
+}
+
+/* reads the body from a file descriptor on the loop thread, positioned reads for files and non blocking reads for
+   pipes, which resume from a uv_poll once readable. The buffer keeps the bytes tryEnd could not write yet, handler
+   reports the outcome once the response is released */
+struct FdSource {
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    Worker *w;
+    int fd;
+    uint64_t offset;
+    uint64_t total;
+    bool close_fd;
+    bool seekable = true;
+    bool failed = false;
+    bool completed = false;
+    /* the pipe had nothing to read, poll is waiting for it */
+    bool empty_pipe = false;
+    /* flags of a pipe before O_NONBLOCK was added, restored when the caller keeps the fd */
+    int pipe_flags = -1;
+    uv_poll_t *poll = nullptr;
+    std::weak_ptr<FdSource> self;
+    std::vector<char> buffer;
+    uintmax_t buffer_start = 0;
+    size_t buffer_length = 0;
+    uws_res_t *res;
+    void (*handler)(uws_res_t *res, bool completed, void *optional_data);
+    void *optional_data;
+
+    std::string_view chunk(uintmax_t written, uintmax_t total)
+    {
+        if (written >= buffer_start && written < buffer_start + buffer_length)
+        {
+            return std::string_view(buffer.data() + (written - buffer_start), buffer_length - (written - buffer_start));
+        }
+        size_t length = (size_t)std::min<uintmax_t>(buffer.size(), total - written);
+        ssize_t n;
+        do
+        {
+            n = seekable ? pread(fd, buffer.data(), length, offset + written) : read(fd, buffer.data(), length);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0 && !seekable && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            empty_pipe = true;
+            return {};
+        }
+        if (n <= 0)
+        {
+            failed = true;
+            return {};
+        }
+        buffer_start = written;
+        buffer_length = n;
+        return std::string_view(buffer.data(), n);
+    }
+
+    bool waiting() const
+    {
+        return empty_pipe;
+    }
+
+    ~FdSource()
+    {
+        if (poll)
+        {
+            uv_close((uv_handle_t *)poll, [](uv_handle_t *handle) {
+                delete (uv_poll_t *)handle;
+            });
+        }
+        if (close_fd)
+        {
+            close(fd);
+        }
+        else if (pipe_flags >= 0)
+        {
+            fcntl(fd, F_SETFL, pipe_flags);
+        }
+        CallbackScope scope(w);
+        handler(res, completed, optional_data);
+    }
+};
+
+template <bool SSL>
+static bool pump_fd(uWS::HttpResponse<SSL> *res, const std::shared_ptr<FdSource> &source);
+
+template <bool SSL>
+static void fd_readable(uv_poll_t *poll, int status, int)
+{
+    uv_poll_stop(poll);
+    /* the source stops the poll before it goes away, the lock keeps it alive while the pump may end the response */
+    std::shared_ptr<FdSource> source = ((FdSource *)poll->data)->self.lock();
+    if (!source)
+    {
+        return;
+    }
+    source->empty_pipe = false;
+    uWS::HttpResponse<SSL> *res = (uWS::HttpResponse<SSL> *)source->res;
+    if (status < 0)
+    {
+        source->failed = true;
+        res->close();
+        return;
+    }
+    pump_fd(res, source);
+}
+
+/* pumps until the response finished, the socket is backpressured or the pipe is empty, which starts the poll */
+template <bool SSL>
+static bool pump_fd(uWS::HttpResponse<SSL> *res, const std::shared_ptr<FdSource> &source)
+{
+    if (pump_response(res, *source, source->total, false))
+    {
+        source->completed = !source->failed;
+        return true;
+    }
+    if (source->empty_pipe)
+    {
+        if (!source->poll)
+        {
+            source->poll = new uv_poll_t;
+            uv_poll_init(source->w->uv_loop, source->poll, source->fd);
+            source->poll->data = source.get();
+        }
+        uv_poll_start(source->poll, UV_READABLE, fd_readable<SSL>);
+    }
+    return false;
+}
+
+template <bool SSL>
+static void res_stream_fd(Worker *w, uWS::HttpResponse<SSL> *res, int fd, uint64_t offset, uint64_t length, bool close_fd,
+                          void (*handler)(uws_res_t *res, bool completed, void *optional_data),
+                          void (*aborted)(uws_res_t *res, void *optional_data), void *optional_data)
+{
+    auto source = std::make_shared<FdSource>();
+    source->self = source;
+    source->w = w;
+    source->fd = fd;
+    source->offset = offset;
+    source->total = length;
+    source->close_fd = close_fd;
+    source->buffer.resize((size_t)std::min<uint64_t>(length, FdSource::BUFFER_SIZE));
+    source->res = (uws_res_t *)res;
+    source->handler = handler;
+    source->optional_data = optional_data;
+    if (!length)
+    {
+        res->end({});
+        source->completed = true;
+        return;
+    }
+    /* a blocking read of a pipe would stall every connection of the loop. The flag is shared with every descriptor of
+       the pipe, the source restores it */
+    if (lseek(fd, 0, SEEK_CUR) < 0 && errno == ESPIPE)
+    {
+        source->seekable = false;
+        int flags = fcntl(fd, F_GETFL);
+        if (flags >= 0 && !(flags & O_NONBLOCK))
+        {
+            source->pipe_flags = flags;
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        }
+    }
+    if (pump_fd(res, source))
+    {
+        return;
+    }
+    res->onWritable([res, source](uintmax_t) {
+        /* finishing the response releases this handler */
+        std::shared_ptr<FdSource> pumped = source;
+        /* nothing is left to write while the pipe is empty, the poll resumes */
+        return pump_fd(res, pumped) || pumped->empty_pipe;
+    });
+    /* the source is released together with the handlers, which reports the abort after the abort handler */
+    res->onAborted([w, res, aborted, optional_data]() {
+        CallbackScope scope(w);
+        aborted((uws_res_t *)res, optional_data);
+    });
+}
+
+/* the body is built natively and handed to deno once, bodies above max_length are answered with 413 */
+template <bool SSL>
+static void res_collect_body(Worker *w, uWS::HttpResponse<SSL> *res, size_t max_length, size_t expected_length,
+                             void (*handler)(uws_res_t *res, const char *body, size_t length, bool ok, void *optional_data),
+                             void (*aborted)(uws_res_t *res, void *optional_data), void *optional_data)
+{
+    if (expected_length > max_length)
+    {
+        cache_forget(w, res);
+        res->writeStatus("413 Payload Too Large")->end({}, true);
+        handler((uws_res_t *)res, nullptr, 0, false, optional_data);
+        return;
+    }
+    // done once handler ran, uWS may still hand over chunks that were already read
+    auto collected = std::make_shared<std::pair<std::string, bool>>();
+    collected->first.reserve(expected_length);
+    res->onAborted([w, res, aborted, optional_data]() {
+        cache_forget(w, res);
+        aborted((uws_res_t *)res, optional_data);
+    });
+    res->onData([w, res, collected, max_length, handler, optional_data](std::string_view chunk, bool is_end) {
+        std::string &body = collected->first;
+        if (collected->second)
+        {
+            return;
+        }
+        if (body.length() + chunk.length() > max_length)
+        {
+            collected->second = true;
+            /* replacing the data handler destroys this lambda, so nothing captured is used afterwards. Closing
+               stops further chunks */
+            uWS::HttpResponse<SSL> *response = res;
+            auto *done = handler;
+            void *data = optional_data;
+            cache_forget(w, response);
+            response->onData([](std::string_view, bool) {});
+            response->writeStatus("413 Payload Too Large")->end({}, true);
+            done((uws_res_t *)response, nullptr, 0, false, data);
+            return;
+        }
+        body.append(chunk);
+        if (is_end)
+        {
+            collected->second = true;
+            handler((uws_res_t *)res, body.data(), body.length(), true, optional_data);
+        }
+    });
+}
+
+/* read only mapping of a served file, shared by the cache and the responses still streaming it */
+struct MappedFile {
+    char *data = nullptr;
+    size_t size = 0;
+    dev_t dev = 0;
+    ino_t ino = 0;
+    struct timespec mtime = {};
+    std::string etag;
+
+    ~MappedFile()
+    {
+        if (data)
+        {
+            munmap(data, size);
+        }
+    }
+};
+
+struct MappedSource {
+    std::shared_ptr<MappedFile> file;
+    size_t offset;
+
+    std::string_view chunk(uintmax_t written, uintmax_t total)
+    {
+        return std::string_view(file->data + offset + written, total - written);
+    }
+
+    bool waiting() const
+    {
+        return false;
+    }
+};
+
+/* files are expected to be replaced rather than truncated in place while they are served */
+static std::shared_ptr<MappedFile> map_file(const std::string &path, const struct stat &st)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    auto file = std::make_shared<MappedFile>();
+    file->size = st.st_size;
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->mtime = st.st_mtim;
+    if (file->size)
+    {
+        void *data = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return nullptr;
+        }
+        file->data = (char *)data;
+    }
+    close(fd);
+    char etag[64];
+    int length = snprintf(etag, sizeof(etag), "\"%llx-%llx-%llx\"", (unsigned long long)st.st_ino, (unsigned long long)st.st_size,
+                          (unsigned long long)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec);
+    file->etag.assign(etag, length);
+    return file;
+}
+
+/* one per serveStatic call, only touched from the loop it was registered on */
+struct FileServer {
+    std::string root;
+    size_t prefix_length;
+    std::string index;
+    std::string cache_control;
+    bool precompressed;
+    size_t cache_limit;
+    size_t cached = 0;
+    std::unordered_map<std::string, std::shared_ptr<MappedFile>> files;
+};
+
+/* the stat per request keeps the cache coherent with the disk without a watcher */
+static std::shared_ptr<MappedFile> file_server_open(FileServer *server, const std::string &path)
+{
+    struct stat st;
+    auto cached = server->files.find(path);
+    if (stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+    {
+        if (cached != server->files.end())
+        {
+            server->cached -= cached->second->size;
+            server->files.erase(cached);
+        }
+        return nullptr;
+    }
+    if (cached != server->files.end())
+    {
+        auto &file = cached->second;
+        if (file->dev == st.st_dev && file->ino == st.st_ino && file->size == (size_t)st.st_size &&
+            file->mtime.tv_sec == st.st_mtim.tv_sec && file->mtime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            return file;
+        }
+        server->cached -= file->size;
+        server->files.erase(cached);
+    }
+    auto file = map_file(path, st);
+    if (file && file->size <= server->cache_limit)
+    {
+        while (server->cached + file->size > server->cache_limit && !server->files.empty())
+        {
+            server->cached -= server->files.begin()->second->size;
+            server->files.erase(server->files.begin());
+        }
+        server->files.emplace(path, file);
+        server->cached += file->size;
+    }
+    return file;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* percent decodes the url path, rejects anything that could leave the root */
+static std::optional<std::string> decode_file_path(std::string_view url)
+{
+    std::string path;
+    path.reserve(url.length() + 1);
+    for (size_t i = 0; i < url.length(); i++)
+    {
+        char c = url[i];
+        if (c == '%')
+        {
+            int high = i + 2 < url.length() ? hex_value(url[i + 1]) : -1;
+            int low = high < 0 ? -1 : hex_value(url[i + 2]);
+            if (low < 0)
+            {
+                return std::nullopt;
+            }
+            c = (char)(high * 16 + low);
+            i += 2;
+        }
+        if (c == '\0' || c == '\\')
+        {
+            return std::nullopt;
+        }
+        path.push_back(c);
+    }
+    if (path.empty() || path[0] != '/')
+    {
+        path.insert(path.begin(), '/');
+    }
+    for (size_t start = 1; start <= path.length();)
+    {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos)
+        {
+            end = path.length();
+        }
+        if (path.compare(start, end - start, "..") == 0)
+        {
+            return std::nullopt;
+        }
+        start = end + 1;
+    }
+    return path;
+}
+
+static std::string_view trim(std::string_view value)
+{
+    while (value.length() && (value.front() == ' ' || value.front() == '\t'))
+    {
+        value.remove_prefix(1);
+    }
+    while (value.length() && (value.back() == ' ' || value.back() == '\t'))
+    {
+        value.remove_suffix(1);
+    }
+    return value;
+}
+
+/* true when coding is listed in accept-encoding with a non zero quality */
+static bool accepts_encoding(std::string_view accept, std::string_view coding)
+{
+    while (accept.length())
+    {
+        size_t comma = accept.find(',');
+        std::string_view item = accept.substr(0, comma);
+        accept.remove_prefix(comma == std::string_view::npos ? accept.length() : comma + 1);
+        size_t semicolon = item.find(';');
+        if (trim(item.substr(0, semicolon)) != coding)
+        {
+            continue;
+        }
+        if (semicolon == std::string_view::npos)
+        {
+            return true;
+        }
+        std::string_view parameter = trim(item.substr(semicolon + 1));
+        if (parameter.substr(0, 2) != "q=" && parameter.substr(0, 2) != "Q=")
+        {
+            return true;
+        }
+        return std::strtod(std::string(parameter.substr(2)).c_str(), nullptr) > 0;
+    }
+    return false;
+}
+
+static constexpr int DEFLATE_LEVEL = 6;
+static constexpr int BROTLI_QUALITY = 5;
+
+/* compresses body into w->compressed, as gzip or as zlib wrapped deflate (the http deflate coding) */
+static bool deflate_body(Worker *w, bool gzip, std::string_view body)
+{
+    z_stream *&stream = w->deflaters[gzip];
+    if (!stream)
+    {
+        stream = new z_stream{};
+        if (deflateInit2(stream, DEFLATE_LEVEL, Z_DEFLATED, gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            delete stream;
+            stream = nullptr;
+            return false;
+        }
+    }
+    else
+    {
+        deflateReset(stream);
+    }
+    w->compressed.resize(deflateBound(stream, body.length()));
+    stream->next_in = (Bytef *)body.data();
+    stream->avail_in = body.length();
+    stream->next_out = (Bytef *)w->compressed.data();
+    stream->avail_out = w->compressed.length();
+    bool ok = deflate(stream, Z_FINISH) == Z_STREAM_END;
+    w->compressed.resize(stream->total_out);
+    return ok;
+}
+
+#ifdef UWS_WITH_BROTLI
+static bool brotli_body(Worker *w, std::string_view body)
+{
+    size_t length = BrotliEncoderMaxCompressedSize(body.length());
+    if (!length)
+    {
+        return false;
+    }
+    w->compressed.resize(length);
+    bool ok = BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, body.length(),
+                                    (const uint8_t *)body.data(), &length, (uint8_t *)w->compressed.data());
+    w->compressed.resize(length);
+    return ok;
+}
+#endif
+
+template <bool SSL>
+static void res_end_compressed(Worker *w, uWS::HttpResponse<SSL> *res, std::string_view accept, unsigned int encodings, size_t min_length, std::string_view body, bool close_connection)
+{
+    std::string_view encoding;
+    if (body.length() >= min_length)
+    {
+#ifdef UWS_WITH_BROTLI
+        if ((encodings & CONTENT_ENCODING_BROTLI) && accepts_encoding(accept, "br") && brotli_body(w, body))
+        {
+            encoding = "br";
+        }
+#endif
+        if (!encoding.length() && (encodings & CONTENT_ENCODING_GZIP) && accepts_encoding(accept, "gzip") && deflate_body(w, true, body))
+        {
+            encoding = "gzip";
+        }
+        if (!encoding.length() && (encodings & CONTENT_ENCODING_DEFLATE) && accepts_encoding(accept, "deflate") && deflate_body(w, false, body))
+        {
+            encoding = "deflate";
+        }
+    }
+    /* incompressible bodies are sent as they are */
+    if (encoding.length() && w->compressed.length() >= body.length())
+    {
+        encoding = {};
+    }
+    metrics_end(w, res, encoding.length() ? w->compressed.length() : body.length());
+    cache_forget(w, res);
+    res->cork([&]() {
+        res->writeHeader("Vary", "Accept-Encoding");
+        if (encoding.length())
+        {
+            res->writeHeader("Content-Encoding", encoding);
+            res->end(w->compressed, close_connection);
+        }
+        else
+        {
+            res->end(body, close_connection);
+        }
+    });
+}
+
+
+static std::string_view file_content_type(std::string_view path)
+{
+    static const std::pair<std::string_view, std::string_view> types[] = {
+        {".html", "text/html; charset=utf-8"},
+        {".htm", "text/html; charset=utf-8"},
+        {".css", "text/css; charset=utf-8"},
+        {".js", "text/javascript; charset=utf-8"},
+        {".mjs", "text/javascript; charset=utf-8"},
+        {".json", "application/json"},
+        {".map", "application/json"},
+        {".txt", "text/plain; charset=utf-8"},
+        {".xml", "application/xml"},
+        {".svg", "image/svg+xml"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".webp", "image/webp"},
+        {".avif", "image/avif"},
+        {".ico", "image/x-icon"},
+        {".wasm", "application/wasm"},
+        {".woff", "font/woff"},
+        {".woff2", "font/woff2"},
+        {".ttf", "font/ttf"},
+        {".pdf", "application/pdf"},
+        {".mp3", "audio/mpeg"},
+        {".mp4", "video/mp4"},
+        {".webm", "video/webm"},
+    };
+    size_t dot = path.rfind('.');
+    if (dot != std::string_view::npos && path.find('/', dot) == std::string_view::npos)
+    {
+        std::string_view extension = path.substr(dot);
+        for (auto &type : types)
+        {
+            if (extension.length() == type.first.length() &&
+                std::equal(extension.begin(), extension.end(), type.first.begin(), [](char a, char b) { return tolower(a) == b; }))
+            {
+                return type.second;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+/* single byte range, returns false when the header is present but unsatisfiable */
+static bool parse_range(std::string_view range, size_t size, size_t &start, size_t &length)
+{
+    start = 0;
+    length = size;
+    if (range.substr(0, 6) != "bytes=" || range.find(',') != std::string_view::npos)
+    {
+        /* multiple ranges are answered with the whole file */
+        return true;
+    }
+    range.remove_prefix(6);
+    size_t dash = range.find('-');
+    if (dash == std::string_view::npos)
+    {
+        return true;
+    }
+    auto number = [](std::string_view digits, size_t &value) {
+        digits = trim(digits);
+        if (digits.empty())
+        {
+            return false;
+        }
+        value = 0;
+        for (char c : digits)
+        {
+            if (c < '0' || c > '9')
+            {
+                return false;
+            }
+            value = value * 10 + (c - '0');
+        }
+        return true;
+    };
+    size_t first, last;
+    bool has_first = number(range.substr(0, dash), first);
+    bool has_last = number(range.substr(dash + 1), last);
+    if (!has_first)
+    {
+        if (!has_last || !last)
+        {
+            return false;
+        }
+        start = size - std::min(last, size);
+        length = size - start;
+        return length > 0;
+    }
+    if (first >= size)
+    {
+        return false;
+    }
+    if (!has_last || last >= size)
+    {
+        last = size - 1;
+    }
+    if (last < first)
+    {
+        return false;
+    }
+    start = first;
+    length = last - first + 1;
+    return true;
+}
+
+template <bool SSL>
+static void serve_file(FileServer *server, uWS::HttpResponse<SSL> *res, uWS::HttpRequest *req, bool head)
+{
+    std::optional<std::string> relative = decode_file_path(req->getUrl().substr(server->prefix_length));
+    if (!relative)
+    {
+        res->writeStatus("400 Bad Request")->end();
+        return;
+    }
+    std::string path = server->root + *relative;
+    if (path.back() == '/')
+    {
+        path += server->index;
+    }
+    auto file = file_server_open(server, path);
+    if (!file)
+    {
+        res->writeStatus("404 Not Found")->end();
+        return;
+    }
+
+    std::string_view range = req->getHeader("range");
+    std::string_view if_range = req->getHeader("if-range");
+    if (if_range.length() && if_range != file->etag)
+    {
+        range = {};
+    }
+
+    /* precompressed siblings are only used for whole responses */
+    std::string_view encoding;
+    std::shared_ptr<MappedFile> body = file;
+    if (server->precompressed && !range.length())
+    {
+        std::string_view accept = req->getHeader("accept-encoding");
+        std::shared_ptr<MappedFile> variant;
+        if (accepts_encoding(accept, "br") && (variant = file_server_open(server, path + ".br")))
+        {
+            encoding = "br";
+        }
+        else if (accepts_encoding(accept, "gzip") && (variant = file_server_open(server, path + ".gz")))
+        {
+            encoding = "gzip";
+        }
+        if (variant)
+        {
+            body = variant;
+        }
+    }
+
+    std::string_view if_none_match = req->getHeader("if-none-match");
+    if (if_none_match.length() && (if_none_match == "*" || if_none_match.find(body->etag) != std::string_view::npos))
+    {
+        res->writeStatus("304 Not Modified");
+        res->writeHeader("etag", body->etag);
+        if (server->precompressed)
+        {
+            res->writeHeader("vary", "accept-encoding");
+        }
+        res->endWithoutBody();
+        return;
+    }
+
+    size_t start, length;
+    if (!parse_range(range, body->size, start, length))
+    {
+        res->writeStatus("416 Range Not Satisfiable");
+        res->writeHeader("content-range", "bytes */" + std::to_string(body->size));
+        res->end();
+        return;
+    }
+    bool partial = length != body->size;
+    if (partial)
+    {
+        res->writeStatus("206 Partial Content");
+        res->writeHeader("content-range", "bytes " + std::to_string(start) + "-" + std::to_string(start + length - 1) + "/" + std::to_string(body->size));
+    }
+    res->writeHeader("content-type", file_content_type(path));
+    res->writeHeader("etag", body->etag);
+    res->writeHeader("accept-ranges", "bytes");
+    if (server->cache_control.length())
+    {
+        res->writeHeader("cache-control", server->cache_control);
+    }
+    if (encoding.length())
+    {
+        res->writeHeader("content-encoding", encoding);
+    }
+    if (server->precompressed)
+    {
+        res->writeHeader("vary", "accept-encoding");
+    }
+    if (head)
+    {
+        res->endWithoutBody(length);
+        return;
+    }
+    stream_response(res, std::make_shared<MappedSource>(MappedSource{body, start}), length);
+}
+
+template <bool SSL>
+static void app_serve_static(Worker *w, const std::string &prefix, std::shared_ptr<FileServer> server)
+{
+    uWS::TemplatedApp<SSL> *uwsApp = (uWS::TemplatedApp<SSL> *)w->app;
+    std::string pattern = prefix + "/*";
+    uwsApp->get(pattern, [server](auto *res, auto *req) {
+        serve_file(server.get(), res, req, false);
+    });
+    uwsApp->head(pattern, [server](auto *res, auto *req) {
+        serve_file(server.get(), res, req, true);
+    });
+}
+
+template <bool SSL>
+static void ring_res_end(Worker *w, void *res, uint64_t sequence, std::string status, std::string headers, std::string body, bool close_connection)
+{
+    worker_defer(w, [w, res, sequence, status = std::move(status), headers = std::move(headers), body = std::move(body), close_connection]() {
+        // answered only if the request was not aborted, a later request may have taken over its address
+        auto it = w->ring->pending.find(res);
+        if (it == w->ring->pending.end() || it->second != sequence)
+        {
+            return;
+        }
+        w->ring->pending.erase(it);
+        uWS::HttpResponse<SSL> *uwsRes = (uWS::HttpResponse<SSL> *)res;
+        uwsRes->cork([&]() {
+            if (status.length())
+            {
+                uwsRes->writeStatus(status);
+            }
+            write_packed_headers(uwsRes, headers);
+            uwsRes->end(body, close_connection);
+        });
+    });
+}
+
+/* vary is set for cached routes, only GET and HEAD are cached as other responses depend on the request body */
+template <bool SSL>
+static void app_method(Worker *w, uws_method_t method, const std::string &pattern, uws_method_handler handler, std::shared_ptr<std::vector<std::string>> vary = nullptr)
+{
+    uWS::TemplatedApp<SSL> *uwsApp = (uWS::TemplatedApp<SSL> *)w->app;
+    if (handler == nullptr)
+    {
+        app_route(uwsApp, method, pattern, nullptr);
+        return;
+    }
+    if (method != METHOD_GET && method != METHOD_HEAD)
+    {
+        vary = nullptr;
+    }
+    if (vary && !w->cache)
+    {
+        w->cache = new ResponseCache();
+        w->cache->limit = w->cache_limit;
+    }
+    RouteMetrics *measured = w->metrics ? metrics_registry.route(method, pattern) : nullptr;
+    unsigned int parameters = count_parameters(pattern);
+    app_route(uwsApp, method, pattern, [w, handler, parameters, vary, measured](auto *res, auto *req) {
+        if (measured)
+        {
+            metrics_start(w, res, measured, req);
+        }
+        if (vary && cache_serve(w, res, req, *vary))
+        {
+            return;
+        }
+        // the whole request is handed over at once instead of one ffi call per getter
+        size_t size = request_snapshot_size(req, parameters);
+        if (w->snapshot.size() < size)
+        {
+            w->snapshot.resize(size);
+        }
+        write_request_snapshot(req, parameters, size, w->snapshot.data());
+        CallbackScope scope(w);
+        handler((uws_res_t *)res, (uws_req_t *)req, w->snapshot.data(), size);
+    });
+}
+
+static void app_method(int ssl, Worker *w, uws_method_t method, const char *pattern, uws_method_handler handler)
+{
+    worker_defer(w, [ssl, w, method, pattern = std::string(pattern), handler]() {
+        if (ssl)
+        {
+            app_method<true>(w, method, pattern, handler);
+        }
+        else
+        {
+            app_method<false>(w, method, pattern, handler);
+        }
+    });
+}
+
+/* comma separated request header names, lower cased */
+static std::shared_ptr<std::vector<std::string>> parse_vary(std::string_view vary_headers)
+{
+    auto vary = std::make_shared<std::vector<std::string>>();
+    while (vary_headers.length())
+    {
+        size_t comma = vary_headers.find(',');
+        std::string header(trim(vary_headers.substr(0, comma)));
+        vary_headers.remove_prefix(comma == std::string_view::npos ? vary_headers.length() : comma + 1);
+        if (header.length())
+        {
+            std::transform(header.begin(), header.end(), header.begin(), [](unsigned char c) { return std::tolower(c); });
+            vary->push_back(std::move(header));
+        }
+    }
+    return vary;
+}
+
+static void app_cached_method(int ssl, Worker *w, uws_method_t method, const char *pattern, std::string_view vary_headers, uws_method_handler handler)
+{
+    auto vary = parse_vary(vary_headers);
+    worker_defer(w, [ssl, w, method, pattern = std::string(pattern), handler, vary]() {
+        if (ssl)
+        {
+            app_method<true>(w, method, pattern, handler, vary);
+        }
+        else
+        {
+            app_method<false>(w, method, pattern, handler, vary);
+        }
+    });
+}
+
+/* one entry of uws_app_register_routes, vary is null for routes which are not cached */
+struct RouteEntry {
+    uws_method_t method;
+    std::string pattern;
+    uws_method_handler handler;
+    std::shared_ptr<std::vector<std::string>> vary;
+};
+
+/* bytes of one entry of a route table ahead of the strings, see uws_app_register_routes */
+static const size_t ROUTE_ENTRY_SIZE = 24;
+static const uint32_t ROUTE_NOT_CACHED = 0xffffffff;
+
+/* parses a route table on the calling thread, returns false when it is truncated */
+static bool parse_route_table(std::string_view table, std::vector<RouteEntry> &routes)
+{
+    if (table.length() < 4)
+    {
+        return false;
+    }
+    uint32_t count;
+    memcpy(&count, table.data(), 4);
+    if ((table.length() - 4) / ROUTE_ENTRY_SIZE < count)
+    {
+        return false;
+    }
+    const char *entry = table.data() + 4;
+    std::string_view strings = table.substr(4 + (size_t)count * ROUTE_ENTRY_SIZE);
+    routes.reserve(count);
+    for (uint32_t i = 0; i < count; i++, entry += ROUTE_ENTRY_SIZE)
+    {
+        uint32_t method, pattern_length, vary_length;
+        uint64_t handler;
+        memcpy(&method, entry, 4);
+        memcpy(&pattern_length, entry + 4, 4);
+        memcpy(&vary_length, entry + 8, 4);
+        memcpy(&handler, entry + 16, 8);
+        size_t strings_length = pattern_length + (vary_length == ROUTE_NOT_CACHED ? 0 : vary_length);
+        if (strings.length() < strings_length)
+        {
+            return false;
+        }
+        RouteEntry route{(uws_method_t)method, std::string(strings.substr(0, pattern_length)), (uws_method_handler)(uintptr_t)handler, nullptr};
+        if (vary_length != ROUTE_NOT_CACHED)
+        {
+            route.vary = parse_vary(strings.substr(pattern_length, vary_length));
+        }
+        strings.remove_prefix(strings_length);
+        routes.push_back(std::move(route));
+    }
+    return true;
+}
+
+template <bool SSL>
+static void app_routes(Worker *w, const std::vector<RouteEntry> &routes)
+{
+    for (const RouteEntry &route : routes)
+    {
+        app_method<SSL>(w, route.method, route.pattern, route.handler, route.vary);
+    }
+}
+
+/* ws is null for app wide publishes, topic and payload are shared by the copies queued on every loop of a pool */
+struct PublishMessage {
+    void *ws;
+    std::shared_ptr<const std::string> topic;
+    std::shared_ptr<const std::string> message;
+    uws_opcode_t opcode;
+    bool compress;
+};
+
+static std::shared_ptr<const std::string> shared_bytes(std::string_view bytes)
+{
+    return std::make_shared<const std::string>(bytes);
+}
+
+/* one enqueue, a batch is a single node so its messages keep their order and share a sequence */
+struct PublishNode {
+    PublishNode *next;
+    /* 0 when nobody waits for the results */
+    uint64_t sequence;
+    std::vector<PublishMessage> messages;
+};
+
+static uint64_t publish_push(Worker *w, std::vector<PublishMessage> messages, bool track)
+{
+    PublishQueue &queue = w->publishes;
+    uint64_t sequence = track ? queue.sequence.fetch_add(1, std::memory_order_relaxed) + 1 : 0;
+    PublishNode *node = new PublishNode{nullptr, sequence, std::move(messages)};
+    PublishNode *head = queue.head.load(std::memory_order_relaxed);
+    do
+    {
+        node->next = head;
+    } while (!queue.head.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+    /* a non empty queue already has a drain coming */
+    if (!head)
+    {
+        w->stats.wakeups.fetch_add(1, std::memory_order_relaxed);
+        us_wakeup_loop((struct us_loop_t *)w->loop);
+    }
+    return sequence;
+}
+
+/* loops of a pool each get one node referencing the same payloads, results are tracked on the origin loop only */
+static uint64_t publish_enqueue(Worker *w, std::vector<PublishMessage> messages, bool track)
+{
+    if (w->pool)
+    {
+        for (Worker *other : w->pool->workers)
+        {
+            if (other == w)
+            {
+                continue;
+            }
+            std::vector<PublishMessage> copies = messages;
+            for (auto &copy : copies)
+            {
+                copy.ws = nullptr;
+            }
+            publish_push(other, std::move(copies), false);
+        }
+    }
+    return publish_push(w, std::move(messages), track);
+}
+
+/* every message record starts with: u64 ws, u32 length, u8 opcode, 3 bytes padding. Records are padded to 8 bytes */
+static const uint32_t MESSAGE_RECORD_HEADER = 16;
+/* a batch growing past this is handed over right away instead of at the end of the iteration */
+static const size_t MESSAGE_BATCH_LIMIT = 1024 * 1024;
+
+static void message_batch_flush(Worker *w, MessageBatch *batch)
+{
+    if (!batch->count)
+    {
+        return;
+    }
+    // deno may close sockets from the handler, which flushes again, so the records are taken out first
+    std::string records;
+    records.swap(batch->records);
+    unsigned int count = batch->count;
+    batch->count = 0;
+    {
+        CallbackScope scope(w);
+        batch->handler(records.data(), records.size(), count);
+    }
+    // keeps the capacity for the next iteration
+    if (batch->records.empty())
+    {
+        records.clear();
+        batch->records.swap(records);
+    }
+}
+
+static void message_batch_push(Worker *w, MessageBatch *batch, void *ws, std::string_view message, uws_opcode_t opcode)
+{
+    size_t offset = batch->records.size();
+    batch->records.resize(offset + ((MESSAGE_RECORD_HEADER + message.length() + 7) & ~(size_t)7));
+    char *record = batch->records.data() + offset;
+    uint64_t pointer = (uint64_t)(uintptr_t)ws;
+    uint32_t length = message.length();
+    memcpy(record, &pointer, 8);
+    memcpy(record + 8, &length, 4);
+    record[12] = (char)opcode;
+    memcpy(record + MESSAGE_RECORD_HEADER, message.data(), message.length());
+    batch->count++;
+    if (batch->records.size() >= MESSAGE_BATCH_LIMIT)
+    {
+        message_batch_flush(w, batch);
+    }
+}
+
+/* post handler of the loop, publishes everything queued since the last iteration */
+template <bool SSL>
+static void publish_drain(Worker *w)
+{
+    PublishQueue &queue = w->publishes;
+    PublishNode *node = queue.head.exchange(nullptr, std::memory_order_acquire);
+    if (!node)
+    {
+        return;
+    }
+    /* the stack holds the newest node first */
+    PublishNode *ordered = nullptr;
+    while (node)
+    {
+        PublishNode *next = node->next;
+        node->next = ordered;
+        ordered = node;
+        node = next;
+    }
+    uWS::TemplatedApp<SSL> *uwsApp = (uWS::TemplatedApp<SSL> *)w->app;
+    std::vector<std::pair<uint64_t, std::vector<uint8_t>>> finished;
+    for (node = ordered; node;)
+    {
+        std::vector<uint8_t> results;
+        for (auto &message : node->messages)
+        {
+            bool result;
+            /* the socket may have closed since the publish was queued */
+            if (message.ws && w->websockets.count(message.ws))
+            {
+                auto *ws = (uWS::WebSocket<SSL, true, void *> *)message.ws;
+                result = ws->publish(*message.topic, *message.message, (uWS::OpCode)(unsigned char)message.opcode, message.compress);
+            }
+            else
+            {
+                result = uwsApp->publish(*message.topic, *message.message, (uWS::OpCode)(unsigned char)message.opcode, message.compress);
+            }
+            if (node->sequence)
+            {
+                results.push_back(result);
+            }
+        }
+        if (node->sequence)
+        {
+            finished.emplace_back(node->sequence, std::move(results));
+        }
+        PublishNode *next = node->next;
+        delete node;
+        node = next;
+    }
+    if (finished.size())
+    {
+        std::lock_guard lk(queue.m);
+        for (auto &result : finished)
+        {
+            queue.results.emplace(result.first, std::move(result.second));
+        }
+        queue.cv.notify_all();
+    }
+}
+
+/* messages are packed as u32 topic length, topic, u32 message length, message, u8 opcode, u8 compress */
+static std::vector<PublishMessage> unpack_publish_batch(std::string_view packed)
+{
+    std::vector<PublishMessage> messages;
+    auto field = [&packed](std::string_view &value) {
+        uint32_t length;
+        if (packed.length() < 4)
+        {
+            return false;
+        }
+        memcpy(&length, packed.data(), 4);
+        packed.remove_prefix(4);
+        value = packed.substr(0, length);
+        packed.remove_prefix(value.length());
+        return true;
+    };
+    std::string_view topic, message;
+    while (field(topic) && field(message) && packed.length() >= 2)
+    {
+        messages.push_back(PublishMessage{nullptr, shared_bytes(topic), shared_bytes(message), (uws_opcode_t)packed[0], packed[1] != 0});
+        packed.remove_prefix(2);
+    }
+    return messages;
+}
+
+/* period of the timer measuring loop lag and sampling idle time */
+static const uint64_t LAG_INTERVAL_MS = 100;
+
+/* period of the timer closing connections once their response was sent while draining */
+static const uint64_t DRAIN_INTERVAL_MS = 10;
+
+/* listen fds sent or received by one uws_send_fds / uws_receive_fds */
+static const size_t MAX_HANDOFF_FDS = 64;
+
+template <bool SSL>
+static void track_connections(Worker *w)
+{
+    ((uWS::TemplatedApp<SSL> *)w->app)->filter([w](uWS::HttpResponse<SSL> *res, int count) {
+        if (count > 0)
+        {
+            w->connections.insert(res);
+        }
+        else
+        {
+            w->connections.erase(res);
+        }
+    });
+}
+
+static void track_listen_socket(Worker *w, struct us_listen_socket_t *listen_socket)
+{
+    if (listen_socket)
+    {
+        w->listen_sockets.push_back(listen_socket);
+    }
+}
+
+/* accepts from an inherited listen fd, the accepted sockets are served like the ones of the app's own listen sockets */
+template <bool SSL>
+static void adopt_listen_fd(Worker *w, int fd)
+{
+    uv_poll_t *poll = new uv_poll_t;
+    uv_poll_init_socket(w->uv_loop, poll, fd);
+    poll->data = w;
+    uv_poll_start(poll, UV_READABLE, [](uv_poll_t *poll, int status, int) {
+        if (status < 0)
+        {
+            return;
+        }
+        Worker *w = (Worker *)poll->data;
+        uv_os_fd_t fd;
+        uv_fileno((uv_handle_t *)poll, &fd);
+        int accepted;
+        // other loops or the predecessor may accept from the same fd, EAGAIN ends the burst
+        while ((accepted = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+        {
+            ((uWS::TemplatedApp<SSL> *)w->app)->adoptSocket(accepted);
+        }
+    });
+    w->adopted.push_back(poll);
+}
+
+struct Drain {
+    uv_timer_t timer;
+    Worker *w;
+    uint64_t deadline;
+};
+
+/* closes the connections waiting for their next request, or all of them and every websocket when forced.
+   Returns true once none is left */
+template <bool SSL>
+static bool close_connections(Worker *w, bool force)
+{
+    // closing removes the connection from w->connections through the filter handler
+    std::vector<void *> connections(w->connections.begin(), w->connections.end());
+    for (void *connection : connections)
+    {
+        auto *res = (uWS::HttpResponse<SSL> *)connection;
+        if (force || res->hasResponded())
+        {
+            res->close();
+        }
+    }
+    if (force)
+    {
+        std::vector<void *> websockets(w->websockets.begin(), w->websockets.end());
+        for (void *ws : websockets)
+        {
+            ((uWS::WebSocket<SSL, true, void *> *)ws)->close();
+        }
+    }
+    return w->connections.empty() && w->websockets.empty();
+}
+
+static void finish_drain(Drain *drain, bool drained)
+{
+    Worker *w = drain->w;
+    w->drained = drained;
+    w->stopped = true;
+    uv_timer_stop(&drain->timer);
+    uv_close((uv_handle_t *)&drain->timer, [](uv_handle_t *handle) {
+        delete (Drain *)handle->data;
+    });
+    uv_stop(w->uv_loop);
+}
+
+template <bool SSL>
+static void drain_step(uv_timer_t *timer)
+{
+    Drain *drain = (Drain *)timer->data;
+    if (close_connections<SSL>(drain->w, false))
+    {
+        finish_drain(drain, true);
+    }
+    else if (uv_now(timer->loop) >= drain->deadline)
+    {
+        close_connections<SSL>(drain->w, true);
+        finish_drain(drain, false);
+    }
+}
+
+/* stops accepting, closes websockets with 1001 and idle connections as their responses complete, then stops the loop */
+template <bool SSL>
+static void start_drain(Worker *w, unsigned int timeout_ms)
+{
+    w->closing = true;
+    for (struct us_listen_socket_t *listen_socket : w->listen_sockets)
+    {
+        us_listen_socket_close(SSL, listen_socket);
+    }
+    w->listen_sockets.clear();
+    for (uv_poll_t *poll : w->adopted)
+    {
+        uv_os_fd_t fd;
+        uv_fileno((uv_handle_t *)poll, &fd);
+        uv_close((uv_handle_t *)poll, [](uv_handle_t *handle) {
+            delete (uv_poll_t *)handle;
+        });
+        close(fd);
+    }
+    w->adopted.clear();
+    // end runs the close handler, which removes the websocket from w->websockets
+    std::vector<void *> websockets(w->websockets.begin(), w->websockets.end());
+    for (void *ws : websockets)
+    {
+        ((uWS::WebSocket<SSL, true, void *> *)ws)->end(1001, "Server is shutting down");
+    }
+    Drain *drain = new Drain;
+    drain->w = w;
+    drain->deadline = uv_now(w->uv_loop) + timeout_ms;
+    drain->timer.data = drain;
+    uv_timer_init(w->uv_loop, &drain->timer);
+    uv_timer_start(&drain->timer, drain_step<SSL>, 0, DRAIN_INTERVAL_MS);
+}
+
+/* fills address with a path, or an abstract name when it starts with a zero byte. Returns 0 when it does not fit */
+static socklen_t unix_address(struct sockaddr_un &address, const char *path, size_t path_length)
+{
+    if (!path_length || path_length >= sizeof(address.sun_path))
+    {
+        return 0;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path, path_length);
+    return offsetof(struct sockaddr_un, sun_path) + path_length;
+}
+
+/* a message compressed once by uws_ws_prepare_message and sent to any number of websockets */
+struct PreparedMessage {
+    std::atomic<unsigned int> references{1};
+    uWS::OpCode opcode;
+    bool compress = false;
+    std::string payload;
+    /* the payload deflated without context takeover, empty when the message is not compressed */
+    std::string deflated;
+};
+
+/* permessage-deflate without context takeover, valid as is on sockets whose server side has no context takeover
+   either. Fails for messages deflate does not make smaller */
+static bool deflate_message(std::string_view message, std::string &deflated)
+{
+    z_stream stream{};
+    if (deflateInit2(&stream, DEFLATE_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return false;
+    }
+    deflated.resize(deflateBound(&stream, message.length()) + 6);
+    stream.next_in = (Bytef *)message.data();
+    stream.avail_in = message.length();
+    stream.next_out = (Bytef *)deflated.data();
+    stream.avail_out = deflated.length();
+    bool ok = deflate(&stream, Z_SYNC_FLUSH) == Z_OK && !stream.avail_in;
+    deflated.resize(stream.total_out);
+    deflateEnd(&stream);
+    // the 00 00 ff ff the sync flush ends with is left out and added back by the receiver
+    if (!ok || deflated.length() < 4)
+    {
+        return false;
+    }
+    deflated.resize(deflated.length() - 4);
+    return deflated.length() < message.length();
+}
+
+/* upgrades through the binding, so the open handler uWS calls from here knows how deflate was negotiated.
+   uWS keeps the outcome private, the negotiation is repeated the way HttpResponse::upgrade does it */
+template <bool SSL>
+static void upgrade(Worker *w, uWS::HttpResponse<SSL> *res, void *data, std::string_view key, std::string_view protocol, std::string_view extensions, struct us_socket_context_t *context)
+{
+    auto route = w->websocket_compression.find(context);
+    if (route != w->websocket_compression.end() && route->second != DISABLED && extensions.length())
+    {
+        int compression = route->second;
+        int inflation_window = 0;
+        if ((compression & _DECOMPRESSOR_MASK) != SHARED_DECOMPRESSOR)
+        {
+            inflation_window = (compression & _DECOMPRESSOR_MASK) >> 8;
+        }
+        auto [negotiated, compression_window, negotiated_inflation_window, response] =
+            uWS::negotiateCompression(true, (compression & _COMPRESSOR_MASK) >> 4, inflation_window, extensions);
+        // a compression window of 0 is the shared compressor, no server context takeover
+        w->upgrade_shared_deflate = negotiated && !compression_window;
+    }
+    res->template upgrade<void *>(std::move(data), key, protocol, extensions, context);
+    w->upgrade_shared_deflate = false;
+}
+
+/* res and ws calls compiled once per kind of socket, exported below as uws_tcp_* and uws_tls_* without the ssl
+   parameter. Named after the exports, namespaced apart from the helpers they call */
+namespace specialized
+{
+template <bool SSL>
+static void ws_close(uws_worker_t *worker, uws_websocket_t *ws)
+{
+    ((uWS::WebSocket<SSL, true, void *> *)ws)->close();
+}
+
+template <bool SSL>
+static uws_sendstatus_t ws_send(uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode)
+{
+    uWS::WebSocket<SSL, true, void *> *uws = (uWS::WebSocket<SSL, true, void *> *)ws;
+    return (uws_sendstatus_t)uws->send(std::string_view(message, length), (uWS::OpCode)(unsigned char)opcode);
+}
+
+template <bool SSL>
+static uws_sendstatus_t ws_send_with_options(uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode, bool compress, bool fin)
+{
+    uWS::WebSocket<SSL, true, void *> *uws = (uWS::WebSocket<SSL, true, void *> *)ws;
+    return (uws_sendstatus_t)uws->send(std::string_view(message, length), (uWS::OpCode)(unsigned char)opcode, compress, fin);
+}
+
+template <bool SSL>
+static uws_sendstatus_t ws_send_prepared(uws_worker_t *worker, uws_websocket_t *ws, uws_prepared_message_t *prepared)
 {
-    struct Worker {
-        uws_app_t *app;
-        struct uWS::Loop *loop;
-        std::shared_ptr<std::thread> thread;
-        std::condition_variable is_running;
+    uWS::WebSocket<SSL, true, void *> *uws = (uWS::WebSocket<SSL, true, void *> *)ws;
+    PreparedMessage *message = (PreparedMessage *)prepared;
+    if (!message->deflated.empty() && ((Worker *)worker)->shared_deflate.count(ws))
+    {
+        return (uws_sendstatus_t)uws->send(message->deflated, message->opcode, uWS::WebSocket<SSL, true, void *>::CompressFlags::ALREADY_COMPRESSED);
+    }
+    // sockets with a sliding window compress themselves, the others get the plain message
+    return (uws_sendstatus_t)uws->send(message->payload, message->opcode, message->compress);
+}
+
+template <bool SSL>
+static void ws_send_batch(uws_worker_t *worker, uws_websocket_t *const *sockets, size_t count, const char *message, size_t length, uws_opcode_t opcode, bool compress, uint8_t *results)
+{
+    // deflated once for the sockets using the shared compressor, see ws_send_prepared
+    if (compress)
+    {
+        uws_prepared_message_t *prepared = uws_ws_prepare_message(message, length, opcode, true);
+        for (size_t i = 0; i < count; i++)
+        {
+            results[i] = ws_send_prepared<SSL>(worker, sockets[i], prepared);
+        }
+        uws_ws_prepared_message_release(prepared);
+        return;
+    }
+    std::string_view view(message, length);
+    for (size_t i = 0; i < count; i++)
+    {
+        results[i] = (uint8_t)((uWS::WebSocket<SSL, true, void *> *)sockets[i])->send(view, (uWS::OpCode)(unsigned char)opcode);
+    }
+}
+
+template <bool SSL>
+static void ws_end(uws_worker_t *worker, uws_websocket_t *ws, int code, const char *message, size_t length)
+{
+    ((uWS::WebSocket<SSL, true, void *> *)ws)->end(code, std::string_view(message, length));
+}
+
+template <bool SSL>
+static void ws_cork(uws_worker_t *worker, uws_websocket_t *ws, void (*handler)(void *optional_data), void *optional_data)
+{
+    ((uWS::WebSocket<SSL, true, void *> *)ws)->cork([handler, optional_data]()
+                                                    { handler(optional_data); });
+}
+
+template <bool SSL>
+static bool ws_subscribe(uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length)
+{
+    return ((uWS::WebSocket<SSL, true, void *> *)ws)->subscribe(std::string_view(topic, length));
+}
+
+template <bool SSL>
+static bool ws_unsubscribe(uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length)
+{
+    return ((uWS::WebSocket<SSL, true, void *> *)ws)->unsubscribe(std::string_view(topic, length));
+}
+
+template <bool SSL>
+static bool ws_is_subscribed(uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length)
+{
+    return ((uWS::WebSocket<SSL, true, void *> *)ws)->isSubscribed(std::string_view(topic, length));
+}
+
+template <bool SSL>
+static void ws_iterate_topics(uws_worker_t *worker, uws_websocket_t *ws, void (*callback)(const char *topic, size_t length, void *optional_data), void *optional_data)
+{
+    ((uWS::WebSocket<SSL, true, void *> *)ws)->iterateTopics([callback, optional_data](auto topic)
+                                                             { callback(topic.data(), topic.length(), optional_data); });
+}
+
+template <bool SSL>
+static unsigned int ws_get_buffered_amount(uws_worker_t *worker, uws_websocket_t *ws)
+{
+    return ((uWS::WebSocket<SSL, true, void *> *)ws)->getBufferedAmount();
+}
+
+template <bool SSL>
+static size_t ws_get_remote_address(uws_worker_t *worker, uws_websocket_t *ws, const char **dest)
+{
+    std::string_view value = ((uWS::WebSocket<SSL, true, void *> *)ws)->getRemoteAddress();
+    *dest = value.data();
+    return value.length();
+}
+
+template <bool SSL>
+static size_t ws_get_remote_address_as_text(uws_worker_t *worker, uws_websocket_t *ws, const char **dest)
+{
+    std::string_view value = ((uWS::WebSocket<SSL, true, void *> *)ws)->getRemoteAddressAsText();
+    *dest = value.data();
+    return value.length();
+}
+
+template <bool SSL>
+static void ring_res_end(uws_worker_t *worker, uws_res_t *res, uint64_t sequence, const char *status, size_t status_length, const char *headers, size_t headers_length, const char *data, size_t length, bool close_connection)
+{
+    // copied, deno may reuse its buffers before the loop thread runs the task
+    ::ring_res_end<SSL>((Worker *)worker, res, sequence, std::string(status, status_length), std::string(headers, headers_length), std::string(data, length), close_connection);
+}
+
+template <bool SSL>
+static void res_end(uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, bool close_connection)
+{
+    metrics_end((Worker *)worker, res, length);
+    cache_forget((Worker *)worker, res);
+    ((uWS::HttpResponse<SSL> *)res)->end(std::string_view(data, length), close_connection);
+}
+
+template <bool SSL>
+static void res_end_prepared(uws_worker_t *worker, uws_res_t *res, unsigned int headers_id, unsigned int body_id, const char *body, size_t body_length, bool close_connection)
+{
+    metrics_prepared((Worker *)worker, res, headers_id, body_id, body_length);
+    cache_forget((Worker *)worker, res);
+    ::res_end_prepared((uWS::HttpResponse<SSL> *)res, headers_id, body_id, std::string_view(body, body_length), close_connection);
+}
+
+template <bool SSL>
+static bool res_end_owned(uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, bool close_connection, void (*release)(const char *data))
+{
+    metrics_end((Worker *)worker, res, length);
+    cache_forget((Worker *)worker, res);
+    return ::res_end_owned((uWS::HttpResponse<SSL> *)res, data, length, close_connection, release);
+}
+
+template <bool SSL>
+static void res_end_cached(uws_worker_t *worker, uws_res_t *res, unsigned int ttl, const char *status, size_t status_length, const char *headers, size_t headers_length, const char *body, size_t body_length, bool close_connection)
+{
+    metrics_end((Worker *)worker, res, body_length);
+    ::res_end_cached((Worker *)worker, (uWS::HttpResponse<SSL> *)res, ttl, std::string_view(status, status_length),
+                     std::string_view(headers, headers_length), std::string_view(body, body_length), close_connection);
+}
+
+template <bool SSL>
+static void res_end_compressed(uws_worker_t *worker, uws_res_t *res, const char *accept_encoding, size_t accept_encoding_length, unsigned int encodings, size_t min_length, const char *data, size_t length, bool close_connection)
+{
+    ::res_end_compressed((Worker *)worker, (uWS::HttpResponse<SSL> *)res, std::string_view(accept_encoding, accept_encoding_length),
+                         encodings, min_length, std::string_view(data, length), close_connection);
+}
+
+template <bool SSL>
+static void res_stream_fd(uws_worker_t *worker, uws_res_t *res, int fd, uint64_t offset, uint64_t length, bool close_fd, void (*handler)(uws_res_t *res, bool completed, void *optional_data), void (*aborted)(uws_res_t *res, void *optional_data), void *optional_data)
+{
+    metrics_end((Worker *)worker, res, length);
+    cache_forget((Worker *)worker, res);
+    ::res_stream_fd((Worker *)worker, (uWS::HttpResponse<SSL> *)res, fd, offset, length, close_fd, handler, aborted, optional_data);
+}
+
+template <bool SSL>
+static size_t res_get_remote_address(uws_worker_t *worker, uws_res_t *res, const char **dest)
+{
+    std::string_view value = ((uWS::HttpResponse<SSL> *)res)->getRemoteAddress();
+    *dest = value.data();
+    return value.length();
+}
+
+template <bool SSL>
+static size_t res_get_remote_address_as_text(uws_worker_t *worker, uws_res_t *res, const char **dest)
+{
+    std::string_view value = ((uWS::HttpResponse<SSL> *)res)->getRemoteAddressAsText();
+    *dest = value.data();
+    return value.length();
+}
+
+template <bool SSL>
+static size_t res_get_proxied_remote_address(uws_worker_t *worker, uws_res_t *res, const char **dest)
+{
+    std::string_view value = ((uWS::HttpResponse<SSL> *)res)->getProxiedRemoteAddress();
+    *dest = value.data();
+    return value.length();
+}
+
+template <bool SSL>
+static size_t res_get_proxied_remote_address_as_text(uws_worker_t *worker, uws_res_t *res, const char **dest)
+{
+    std::string_view value = ((uWS::HttpResponse<SSL> *)res)->getProxiedRemoteAddressAsText();
+    *dest = value.data();
+    return value.length();
+}
+
+template <bool SSL>
+static uws_try_end_result_t res_try_end(uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, uintmax_t total_size, bool close_connection)
+{
+    std::pair<bool, bool> result = ((uWS::HttpResponse<SSL> *)res)->tryEnd(std::string_view(data, length), total_size, close_connection);
+    if (result.second)
+    {
+        metrics_end((Worker *)worker, res, total_size);
+        cache_forget((Worker *)worker, res);
+    }
+    return uws_try_end_result_t{
+        .ok = result.first,
+        .has_responded = result.second,
     };
+}
 
-    uws_worker_t *uws_create_app(int ssl, struct us_socket_context_options_t options) {
+template <bool SSL>
+static void res_cork(uws_worker_t *worker, uws_res_t *res, void (*callback)(uws_res_t *res, void *optional_data), void *optional_data)
+{
+    ((uWS::HttpResponse<SSL> *)res)->cork([=]()
+                                          { callback(res, optional_data); });
+}
+
+template <bool SSL>
+static void res_pause(uws_worker_t *worker, uws_res_t *res)
+{
+    ((uWS::HttpResponse<SSL> *)res)->pause();
+}
+
+template <bool SSL>
+static void res_resume(uws_worker_t *worker, uws_res_t *res)
+{
+    ((uWS::HttpResponse<SSL> *)res)->resume();
+}
+
+template <bool SSL>
+static void res_write_continue(uws_worker_t *worker, uws_res_t *res)
+{
+    ((uWS::HttpResponse<SSL> *)res)->writeContinue();
+}
+
+template <bool SSL>
+static void res_write_status(uws_worker_t *worker, uws_res_t *res, const char *status, size_t length)
+{
+    metrics_status((Worker *)worker, res, std::string_view(status, length));
+    ((uWS::HttpResponse<SSL> *)res)->writeStatus(std::string_view(status, length));
+}
+
+template <bool SSL>
+static void res_write_header(uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, const char *value, size_t value_length)
+{
+    ((uWS::HttpResponse<SSL> *)res)->writeHeader(std::string_view(key, key_length), std::string_view(value, value_length));
+}
+
+template <bool SSL>
+static void res_write_header_int(uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, uint64_t value)
+{
+    ((uWS::HttpResponse<SSL> *)res)->writeHeader(std::string_view(key, key_length), value);
+}
+
+template <bool SSL>
+static void res_end_without_body(uws_worker_t *worker, uws_res_t *res, bool close_connection)
+{
+    metrics_end((Worker *)worker, res, 0);
+    cache_forget((Worker *)worker, res);
+    ((uWS::HttpResponse<SSL> *)res)->endWithoutBody(std::nullopt, close_connection);
+}
+
+template <bool SSL>
+static bool res_write(uws_worker_t *worker, uws_res_t *res, const char *data, size_t length)
+{
+    metrics_write((Worker *)worker, res, length);
+    return ((uWS::HttpResponse<SSL> *)res)->write(std::string_view(data, length));
+}
+
+template <bool SSL>
+static uintmax_t res_get_write_offset(uws_worker_t *worker, uws_res_t *res)
+{
+    return ((uWS::HttpResponse<SSL> *)res)->getWriteOffset();
+}
+
+template <bool SSL>
+static void res_override_write_offset(uws_worker_t *worker, uws_res_t *res, uintmax_t offset)
+{
+    ((uWS::HttpResponse<SSL> *)res)->overrideWriteOffset(offset);
+}
+
+template <bool SSL>
+static bool res_has_responded(uws_worker_t *worker, uws_res_t *res)
+{
+    return ((uWS::HttpResponse<SSL> *)res)->hasResponded();
+}
+
+template <bool SSL>
+static void res_collect_body(uws_worker_t *worker, uws_res_t *res, size_t max_length, size_t expected_length, void (*handler)(uws_res_t *res, const char *body, size_t length, bool ok, void *optional_data), void (*aborted)(uws_res_t *res, void *optional_data), void *optional_data)
+{
+    ::res_collect_body((Worker *)worker, (uWS::HttpResponse<SSL> *)res, max_length, expected_length, handler, aborted, optional_data);
+}
+
+template <bool SSL>
+static void res_on_writable(uws_worker_t *worker, uws_res_t *res, bool (*handler)(uws_res_t *res, uintmax_t, void *optional_data), void *optional_data)
+{
+    Worker* w = (Worker*) worker;
+    worker_defer(w, [w, res, handler, optional_data]() {
+        ((uWS::HttpResponse<SSL> *)res)->onWritable([w, handler, res, optional_data](uintmax_t a)
+                                                    { CallbackScope scope(w); return handler(res, a, optional_data); });
+    });
+}
+
+template <bool SSL>
+static void res_on_aborted(uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res, void *optional_data), void *optional_data)
+{
+    Worker* w = (Worker*) worker;
+    worker_defer(w, [w, res, handler, optional_data]() {
+        ((uWS::HttpResponse<SSL> *)res)->onAborted([w, handler, res, optional_data]
+                                                   { cache_forget(w, res); CallbackScope scope(w); handler(res, optional_data); });
+    });
+}
+
+template <bool SSL>
+static void res_on_data(uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res, const char *chunk, size_t chunk_length, bool is_end, void *optional_data), void *optional_data)
+{
+    Worker* w = (Worker*) worker;
+    worker_defer(w, [w, res, handler, optional_data]() {
+        ((uWS::HttpResponse<SSL> *)res)->onData([w, handler, res, optional_data](auto chunk, bool is_end)
+                                                { CallbackScope scope(w); handler(res, chunk.data(), chunk.length(), is_end, optional_data); });
+    });
+}
+
+template <bool SSL>
+static void res_upgrade(uws_worker_t *worker, uws_res_t *res, void *data, const char *sec_web_socket_key, size_t sec_web_socket_key_length, const char *sec_web_socket_protocol, size_t sec_web_socket_protocol_length, const char *sec_web_socket_extensions, size_t sec_web_socket_extensions_length, uws_socket_context_t *ws)
+{
+    ::upgrade<SSL>((Worker *)worker, (uWS::HttpResponse<SSL> *)res, data,
+                   std::string_view(sec_web_socket_key, sec_web_socket_key_length),
+                   std::string_view(sec_web_socket_protocol, sec_web_socket_protocol_length),
+                   std::string_view(sec_web_socket_extensions, sec_web_socket_extensions_length),
+                   (struct us_socket_context_t *)ws);
+}
+}
+
+/* defines uws_tcp_<name> and uws_tls_<name> over specialized::<name>, and uws_<name> taking ssl for C callers */
+#define UWS_SSL_EXPORT(result, name, params, args)                                       \
+    result uws_tcp_##name params { return specialized::name<false> args; }              \
+    result uws_tls_##name params { return specialized::name<true> args; }               \
+    result uws_##name(int ssl, UWS_UNPAREN params)                                       \
+    {                                                                                    \
+        return ssl ? specialized::name<true> args : specialized::name<false> args;       \
+    }
+
+extern "C"
+{
+    /* starts a thread running its own uWS loop and app, default_loop is used for the standalone app.
+       Returns right away, wait_worker blocks until the loop accepts tasks */
+    static Worker *create_worker(int ssl, struct us_socket_context_options_t options, bool default_loop)
+    {
         Worker *worker = new Worker();
-        std::mutex m;
-        std::condition_variable cv;
-        worker->thread = std::make_shared<std::thread>([worker, &cv, ssl, &options](){
-            uv_loop_t *uv_loop = uv_default_loop();
+        worker->thread = std::make_shared<std::thread>([worker, ssl, options, default_loop](){
+            uv_loop_t *uv_loop;
+            if (default_loop)
+            {
+                uv_loop = uv_default_loop();
+            }
+            else
+            {
+                // every loop of a pool needs its own uv loop, uWS::Loop is thread local
+                uv_loop = new uv_loop_t;
+                uv_loop_init(uv_loop);
+            }
+            worker->uv_loop = uv_loop;
+            // idle time for uws_loop_stats, has to be configured before the loop runs
+            uv_loop_configure(uv_loop, UV_METRICS_IDLE_TIME);
             uv_async_t async;
             // we keep one task in the queue so that uv loop starts processing precb, wakecb, post cb, on which uws is running
             uv_async_init(uv_loop, &async, [](uv_async_t *handle){});
@@ -39,318 +2890,541 @@ extern "C"
                 sco.ssl_ciphers = options.ssl_ciphers;
                 
                 worker->app = (uws_app_t *) new uWS::SSLApp(sco);
+                track_connections<true>(worker);
             }
             else {
                 worker->app = (uws_app_t *) new uWS::App();
+                track_connections<false>(worker);
             }
-            cv.notify_one();
-            while (true) {
+            worker->loop->addPostHandler(worker, [worker, ssl](uWS::Loop *) {
+                worker->stats.iterations.fetch_add(1, std::memory_order_relaxed);
+                // before publishing, so what the message handlers publish goes out in this iteration
+                for (size_t i = 0; i < worker->message_batches.size(); i++)
+                {
+                    message_batch_flush(worker, worker->message_batches[i]);
+                }
+                if (ssl)
+                {
+                    publish_drain<true>(worker);
+                }
+                else
+                {
+                    publish_drain<false>(worker);
+                }
+            });
+            uv_timer_t lag_timer;
+            uv_timer_init(uv_loop, &lag_timer);
+            uv_unref((uv_handle_t *)&lag_timer);
+            lag_timer.data = worker;
+            worker->stats.started = worker->stats.last_tick = uv_hrtime();
+            uv_timer_start(&lag_timer, [](uv_timer_t *timer) {
+                Worker *w = (Worker *)timer->data;
+                uint64_t now = uv_hrtime();
+                uint64_t expected = w->stats.last_tick + LAG_INTERVAL_MS * 1000000;
+                uint64_t lag = now > expected ? now - expected : 0;
+                w->stats.last_tick = now;
+                w->stats.lag.store(lag, std::memory_order_relaxed);
+                atomic_max(w->stats.lag_max, lag);
+                w->stats.idle_time.store(uv_metrics_idle_time(timer->loop), std::memory_order_relaxed);
+            }, LAG_INTERVAL_MS, LAG_INTERVAL_MS);
+            worker->started.set_value();
+            // uv_run also returns when nothing is left to poll, only uws_app_close stops the loop
+            while (!worker->stopped) {
                 uv_run(uv_loop, UV_RUN_DEFAULT);
-                // should we gracefuly shutdown?
             }
-            worker->is_running.notify_one();
+            worker->closed.set_value(worker->drained);
         });
         worker->thread->detach();
-        // waiting while w->loop initialized, so deno can add tasks to it
-        std::unique_lock lk(m);
-        cv.wait(lk);
+        return worker;
+    }
+
+    /* waits while w->loop is initialized, so deno can add tasks to it */
+    static void wait_worker(Worker *worker)
+    {
+        worker->started.get_future().wait();
+    }
+
+    void uws_loop_stats(uws_worker_t *worker, uws_loop_stats_t *dest, bool reset_max)
+    {
+        LoopStats &stats = ((Worker *)worker)->stats;
+        dest->iterations = stats.iterations.load(std::memory_order_relaxed);
+        dest->wakeups = stats.wakeups.load(std::memory_order_relaxed);
+        dest->deferred = stats.deferred.load(std::memory_order_relaxed);
+        dest->callbacks = stats.callbacks.load(std::memory_order_relaxed);
+        dest->callback_time = stats.callback_time.load(std::memory_order_relaxed);
+        dest->idle_time = stats.idle_time.load(std::memory_order_relaxed);
+        dest->uptime = uv_hrtime() - stats.started;
+        dest->lag = stats.lag.load(std::memory_order_relaxed);
+        if (reset_max)
+        {
+            dest->deferred_max = stats.deferred_max.exchange(0, std::memory_order_relaxed);
+            dest->callback_max = stats.callback_max.exchange(0, std::memory_order_relaxed);
+            dest->lag_max = stats.lag_max.exchange(0, std::memory_order_relaxed);
+        }
+        else
+        {
+            dest->deferred_max = stats.deferred_max.load(std::memory_order_relaxed);
+            dest->callback_max = stats.callback_max.load(std::memory_order_relaxed);
+            dest->lag_max = stats.lag_max.load(std::memory_order_relaxed);
+        }
+    }
+
+    uws_worker_t *uws_create_app(int ssl, struct us_socket_context_options_t options) {
+        Worker *worker = create_worker(ssl, options, true);
+        wait_worker(worker);
         return (uws_worker_t*) worker;
     }
 
+    uws_pool_t *uws_create_app_pool(int ssl, unsigned int size, struct us_socket_context_options_t options)
+    {
+        Pool *pool = new Pool();
+        pool->workers.reserve(size);
+        for (unsigned int i = 0; i < size; i++)
+        {
+            // every loop listens on the same port, uSockets sets SO_REUSEPORT unless LIBUS_LISTEN_EXCLUSIVE_PORT is given
+            Worker *worker = create_worker(ssl, options, false);
+            worker->pool = pool;
+            pool->workers.push_back(worker);
+        }
+        // the loops start in parallel, boot time is the slowest one instead of the sum
+        for (Worker *worker : pool->workers)
+        {
+            wait_worker(worker);
+        }
+        return (uws_pool_t *) pool;
+    }
+
+    unsigned int uws_pool_size(uws_pool_t *pool)
+    {
+        Pool *p = (Pool *) pool;
+        return p->workers.size();
+    }
+
+    uws_worker_t *uws_pool_get_worker(uws_pool_t *pool, unsigned int index)
+    {
+        Pool *p = (Pool *) pool;
+        if (index >= p->workers.size())
+        {
+            return nullptr;
+        }
+        return (uws_worker_t *) p->workers[index];
+    }
+
     void uws_wait_app(uws_worker_t *worker)
     {
         Worker* w = (Worker*) worker;
-        std::mutex m;
-        std::unique_lock lk(m);
-        w->is_running.wait(lk);
+        w->stopped_future.wait();
     }
 
-    void uws_app_get(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+    bool uws_app_close(int ssl, uws_worker_t *worker, unsigned int timeout_ms)
     {
-        Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, pattern, handler]() {
+        Worker *w = (Worker *) worker;
+        if (w->close_requested.exchange(true))
+        {
+            return false;
+        }
+        worker_defer(w, [ssl, w, timeout_ms]() {
             if (ssl)
             {
-                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->get(pattern, nullptr);
-                    return;
-                }
-                uwsApp->get(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
+                start_drain<true>(w, timeout_ms);
             }
             else
             {
-                uWS::App *uwsApp = (uWS::App *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->get(pattern, nullptr);
-                    return;
-                }
-                uwsApp->get(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
+                start_drain<false>(w, timeout_ms);
             }
         });
+        return w->stopped_future.get();
     }
-    void uws_app_post(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+
+    size_t uws_app_listen_fds(uws_worker_t *worker, int *dest, size_t max)
     {
-        Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, pattern, handler]() {
-            if (ssl)
+        Worker *w = (Worker *) worker;
+        std::promise<size_t> count;
+        std::future<size_t> result = count.get_future();
+        worker_defer(w, [w, dest, max, &count]() {
+            size_t n = 0;
+            for (struct us_listen_socket_t *listen_socket : w->listen_sockets)
             {
-                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                if (handler == nullptr)
+                if (n < max)
                 {
-                    uwsApp->post(pattern, nullptr);
-                    return;
+                    dest[n++] = us_poll_fd((struct us_poll_t *)listen_socket);
                 }
-                uwsApp->post(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
             }
-            else
+            for (uv_poll_t *poll : w->adopted)
             {
-                uWS::App *uwsApp = (uWS::App *)w->app;
-                if (handler == nullptr)
+                uv_os_fd_t fd;
+                if (n < max && uv_fileno((uv_handle_t *)poll, &fd) == 0)
                 {
-                    uwsApp->post(pattern, nullptr);
-                    return;
+                    dest[n++] = fd;
                 }
-                uwsApp->post(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
             }
+            count.set_value(n);
         });
+        return result.get();
     }
-    void uws_app_options(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+
+    void uws_app_adopt_listen_fd(int ssl, uws_worker_t *worker, int fd)
     {
-        Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, pattern, handler]() {
-            if (ssl)
+        Worker *w = (Worker *) worker;
+        // the caller keeps its fd, every loop of a pool polls its own duplicate
+        int own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (own < 0)
+        {
+            return;
+        }
+        worker_defer(w, [ssl, w, own]() {
+            if (w->closing)
             {
-                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->options(pattern, nullptr);
-                    return;
-                }
-                uwsApp->options(pattern, [handler](auto *res, auto *req)
-                                { handler((uws_res_t *)res, (uws_req_t *)req); });
+                close(own);
+            }
+            else if (ssl)
+            {
+                adopt_listen_fd<true>(w, own);
             }
             else
             {
-                uWS::App *uwsApp = (uWS::App *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->options(pattern, nullptr);
-                    return;
-                }
-                uwsApp->options(pattern, [handler](auto *res, auto *req)
-                                { handler((uws_res_t *)res, (uws_req_t *)req); });
+                adopt_listen_fd<false>(w, own);
             }
         });
     }
-    void uws_app_delete(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+
+    int uws_send_fds(const char *path, size_t path_length, const int *fds, size_t count)
     {
-        Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, pattern, handler]() {
-            if (ssl)
+        struct sockaddr_un address;
+        socklen_t address_length = unix_address(address, path, path_length);
+        if (!address_length || count > MAX_HANDOFF_FDS)
+        {
+            return -1;
+        }
+        int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (s < 0)
+        {
+            return -1;
+        }
+        if (connect(s, (struct sockaddr *)&address, address_length) < 0)
+        {
+            close(s);
+            return -1;
+        }
+        uint32_t sent_count = count;
+        struct iovec iov = {&sent_count, sizeof(sent_count)};
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_FDS)] = {};
+        struct msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        if (count)
+        {
+            message.msg_control = control;
+            message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+            struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+            memcpy(CMSG_DATA(header), fds, sizeof(int) * count);
+        }
+        // the successor acknowledges once it holds the fds, so closing ours afterwards never refuses a connection
+        char ack = 0;
+        bool delivered = sendmsg(s, &message, MSG_NOSIGNAL) == sizeof(sent_count) && read(s, &ack, 1) == 1;
+        close(s);
+        return delivered ? (int)count : -1;
+    }
+
+    int uws_receive_fds(const char *path, size_t path_length, int *dest, size_t max)
+    {
+        struct sockaddr_un address;
+        socklen_t address_length = unix_address(address, path, path_length);
+        if (!address_length)
+        {
+            return -1;
+        }
+        int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0)
+        {
+            return -1;
+        }
+        if (path[0])
+        {
+            // a stale socket file of an earlier handoff
+            unlink(address.sun_path);
+        }
+        int s = -1;
+        if (bind(listener, (struct sockaddr *)&address, address_length) == 0 && listen(listener, 1) == 0)
+        {
+            s = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        }
+        close(listener);
+        if (path[0])
+        {
+            unlink(address.sun_path);
+        }
+        if (s < 0)
+        {
+            return -1;
+        }
+        uint32_t sent_count = 0;
+        struct iovec iov = {&sent_count, sizeof(sent_count)};
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_FDS)] = {};
+        struct msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(s, &message, MSG_CMSG_CLOEXEC) != sizeof(sent_count))
+        {
+            close(s);
+            return -1;
+        }
+        size_t n = 0;
+        for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+        {
+            if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
             {
-                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->del(pattern, nullptr);
-                    return;
-                }
-                uwsApp->del(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
+                continue;
             }
-            else
+            size_t received = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int *fds = (int *)CMSG_DATA(header);
+            for (size_t i = 0; i < received; i++)
             {
-                uWS::App *uwsApp = (uWS::App *)w->app;
-                if (handler == nullptr)
+                if (n < max)
+                {
+                    dest[n++] = fds[i];
+                }
+                else
                 {
-                    uwsApp->del(pattern, nullptr);
-                    return;
+                    close(fds[i]);
                 }
-                uwsApp->del(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
             }
-        });
+        }
+        char ack = 1;
+        bool acknowledged = write(s, &ack, 1) == 1;
+        close(s);
+        if (!acknowledged)
+        {
+            // the predecessor keeps serving with its own fds
+            for (size_t i = 0; i < n; i++)
+            {
+                close(dest[i]);
+            }
+            return -1;
+        }
+        return (int)n;
     }
-    void uws_app_patch(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+
+    bool uws_app_register_routes(int ssl, uws_worker_t *worker, const char *table, size_t length)
     {
-        Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, pattern, handler]() {
+        Worker *w = (Worker *) worker;
+        auto routes = std::make_shared<std::vector<RouteEntry>>();
+        if (!parse_route_table(std::string_view(table, length), *routes))
+        {
+            return false;
+        }
+        // one task and one wakeup for the whole table
+        worker_defer(w, [ssl, w, routes]() {
             if (ssl)
             {
-                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->patch(pattern, nullptr);
-                    return;
-                }
-                uwsApp->patch(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
+                app_routes<true>(w, *routes);
             }
             else
             {
-                uWS::App *uwsApp = (uWS::App *)w->app;
-                if (handler == nullptr)
+                app_routes<false>(w, *routes);
+            }
+        });
+        return true;
+    }
+
+    void uws_app_get(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+    {
+        app_method(ssl, (Worker*) worker, METHOD_GET, pattern, handler);
+    }
+    void uws_app_post(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+    {
+        app_method(ssl, (Worker*) worker, METHOD_POST, pattern, handler);
+    }
+    void uws_app_options(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+    {
+        app_method(ssl, (Worker*) worker, METHOD_OPTIONS, pattern, handler);
+    }
+    void uws_app_delete(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+    {
+        app_method(ssl, (Worker*) worker, METHOD_DELETE, pattern, handler);
+    }
+    void uws_app_patch(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+    {
+        app_method(ssl, (Worker*) worker, METHOD_PATCH, pattern, handler);
+    }
+    void uws_app_put(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+    {
+        app_method(ssl, (Worker*) worker, METHOD_PUT, pattern, handler);
+    }
+    void uws_app_head(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+    {
+        app_method(ssl, (Worker*) worker, METHOD_HEAD, pattern, handler);
+    }
+    void uws_app_connect(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+    {
+        app_method(ssl, (Worker*) worker, METHOD_CONNECT, pattern, handler);
+    }
+    void uws_app_trace(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+    {
+        app_method(ssl, (Worker*) worker, METHOD_TRACE, pattern, handler);
+    }
+    void uws_app_any(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+    {
+        app_method(ssl, (Worker*) worker, METHOD_ANY, pattern, handler);
+    }
+
+    void uws_app_cached_method(int ssl, uws_worker_t *worker, uws_method_t method, const char *pattern, const char *vary, size_t vary_length, uws_method_handler handler)
+    {
+        app_cached_method(ssl, (Worker *)worker, method, pattern, std::string_view(vary, vary_length), handler);
+    }
+
+    void uws_app_response_cache_limit(uws_worker_t *worker, size_t limit)
+    {
+        Worker *w = (Worker *)worker;
+        worker_defer(w, [w, limit]() {
+            w->cache_limit = limit;
+            if (w->cache)
+            {
+                std::lock_guard<std::mutex> lock(w->cache->m);
+                w->cache->limit = limit;
+                while (w->cache->bytes > limit)
                 {
-                    uwsApp->patch(pattern, nullptr);
-                    return;
+                    w->cache->erase(std::prev(w->cache->lru.end()));
                 }
-                uwsApp->patch(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
             }
         });
     }
-    void uws_app_put(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+
+    void uws_app_metrics(uws_worker_t *worker)
     {
-        Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, pattern, handler]() {
+        Worker *w = (Worker *)worker;
+        worker_defer(w, [w]() {
+            w->metrics = true;
+        });
+    }
+
+    void uws_app_metrics_endpoint(int ssl, uws_worker_t *worker, const char *pattern)
+    {
+        Worker *w = (Worker *)worker;
+        worker_defer(w, [ssl, w, pattern = std::string(pattern)]() {
+            auto handler = [](auto *res, auto *req) {
+                std::string body = metrics_prometheus();
+                res->writeHeader("Content-Type", "text/plain; version=0.0.4");
+                res->end(body);
+            };
             if (ssl)
             {
-                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->put(pattern, nullptr);
-                    return;
-                }
-                uwsApp->put(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
+                ((uWS::SSLApp *)w->app)->get(pattern, handler);
             }
             else
             {
-                uWS::App *uwsApp = (uWS::App *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->put(pattern, nullptr);
-                    return;
-                }
-                uwsApp->put(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
+                ((uWS::App *)w->app)->get(pattern, handler);
             }
         });
     }
-    void uws_app_head(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+
+    size_t uws_get_metrics(char *dest, size_t capacity)
+    {
+        std::string json = metrics_json();
+        if (json.length() <= capacity)
+        {
+            memcpy(dest, json.data(), json.length());
+        }
+        return json.length();
+    }
+
+    void uws_app_static_response(int ssl, uws_worker_t *worker, uws_method_t method, const char *pattern, const char *status, size_t status_length, const char *headers, size_t headers_length, const char *body, size_t body_length)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, pattern, handler]() {
+        auto response = std::make_shared<StaticResponse>();
+        response->head = make_header_block(std::string_view(status, status_length), std::string_view(headers, headers_length));
+        response->body.assign(body, body_length);
+        worker_defer(w, [ssl, w, method, pattern = std::string(pattern), response]() {
             if (ssl)
             {
-                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->head(pattern, nullptr);
-                    return;
-                }
-                uwsApp->head(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
+                app_static_response<true>(w, method, pattern, response);
             }
             else
             {
-                uWS::App *uwsApp = (uWS::App *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->head(pattern, nullptr);
-                    return;
-                }
-                uwsApp->head(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
+                app_static_response<false>(w, method, pattern, response);
             }
         });
     }
-    void uws_app_connect(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+
+    void uws_app_serve_static(int ssl, uws_worker_t *worker, const char *prefix, const char *root, const char *index, const char *cache_control, size_t cache_limit, bool precompressed)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, pattern, handler]() {
+        std::string pattern(prefix);
+        while (pattern.length() && pattern.back() == '/')
+        {
+            pattern.pop_back();
+        }
+        auto server = std::make_shared<FileServer>();
+        server->root = root;
+        while (server->root.length() > 1 && server->root.back() == '/')
+        {
+            server->root.pop_back();
+        }
+        server->prefix_length = pattern.length();
+        server->index = index;
+        server->cache_control = cache_control;
+        server->cache_limit = cache_limit;
+        server->precompressed = precompressed;
+        worker_defer(w, [ssl, w, pattern, server]() {
             if (ssl)
             {
-                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->connect(pattern, nullptr);
-                    return;
-                }
-                uwsApp->connect(pattern, [handler](auto *res, auto *req)
-                                { handler((uws_res_t *)res, (uws_req_t *)req); });
+                app_serve_static<true>(w, pattern, server);
             }
             else
             {
-                uWS::App *uwsApp = (uWS::App *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->connect(pattern, nullptr);
-                    return;
-                }
-                uwsApp->connect(pattern, [handler](auto *res, auto *req)
-                                { handler((uws_res_t *)res, (uws_req_t *)req); });
+                app_serve_static<false>(w, pattern, server);
             }
         });
     }
 
-    void uws_app_trace(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+    void *uws_app_request_ring(uws_worker_t *worker, unsigned int capacity)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, pattern, handler]() {
-            if (ssl)
-            {
-                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->trace(pattern, nullptr);
-                    return;
-                }
-                uwsApp->trace(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
-            }
-            else
-            {
-                uWS::App *uwsApp = (uWS::App *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->trace(pattern, nullptr);
-                    return;
-                }
-                uwsApp->trace(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
-            }
+        if (!w->ring)
+        {
+            w->ring = create_request_ring(capacity);
+        }
+        return w->ring->shared;
+    }
+
+    void uws_request_ring_wait(uws_worker_t *worker)
+    {
+        RequestRing *ring = ((Worker*) worker)->ring;
+        std::unique_lock lk(ring->m);
+        ring->waiting.store(true, std::memory_order_seq_cst);
+        ring->cv.wait(lk, [ring]() {
+            return ring->shared->head.load(std::memory_order_seq_cst) != ring->shared->tail.load(std::memory_order_relaxed);
         });
+        ring->waiting.store(false, std::memory_order_relaxed);
     }
-    void uws_app_any(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler)
+
+    void uws_app_batched(int ssl, uws_worker_t *worker, uws_method_t method, const char *pattern, unsigned int route)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, pattern, handler]() {
+        worker_defer(w, [ssl, w, method, pattern = std::string(pattern), route]() {
             if (ssl)
             {
-                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->any(pattern, nullptr);
-                    return;
-                }
-                uwsApp->any(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
+                app_batched<true>(w, method, pattern, route);
             }
             else
             {
-                uWS::App *uwsApp = (uWS::App *)w->app;
-                if (handler == nullptr)
-                {
-                    uwsApp->any(pattern, nullptr);
-                    return;
-                }
-                uwsApp->any(pattern, [handler](auto *res, auto *req)
-                            { handler((uws_res_t *)res, (uws_req_t *)req); });
+                app_batched<false>(w, method, pattern, route);
             }
         });
     }
 
+    UWS_SSL_EXPORT(void, ring_res_end, (uws_worker_t *worker, uws_res_t *res, uint64_t sequence, const char *status, size_t status_length, const char *headers, size_t headers_length, const char *data, size_t length, bool close_connection),
+                   (worker, res, sequence, status, status_length, headers, headers_length, data, length, close_connection))
+
     void uws_app_listen(int ssl, uws_worker_t *worker, int port, uws_listen_handler handler)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, port, handler]() {
+        worker_defer(w, [ssl, w, port, handler]() {
             uws_app_listen_config_t config;
             config.port = port;
             config.host = nullptr;
@@ -359,15 +3433,15 @@ extern "C"
             if (ssl)
             {
                 uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                uwsApp->listen(port, [handler, config](struct us_listen_socket_t *listen_socket)
-                            { handler((struct us_listen_socket_t *)listen_socket, config); });
+                uwsApp->listen(port, [w, handler, config](struct us_listen_socket_t *listen_socket)
+                            { track_listen_socket(w, listen_socket); handler((struct us_listen_socket_t *)listen_socket, config); });
             }
             else
             {
                 uWS::App *uwsApp = (uWS::App *)w->app;
 
-                uwsApp->listen(port, [handler, config](struct us_listen_socket_t *listen_socket)
-                            { handler((struct us_listen_socket_t *)listen_socket, config); });
+                uwsApp->listen(port, [w, handler, config](struct us_listen_socket_t *listen_socket)
+                            { track_listen_socket(w, listen_socket); handler((struct us_listen_socket_t *)listen_socket, config); });
             }
         });
     }
@@ -375,18 +3449,18 @@ extern "C"
     void uws_app_listen_with_config(int ssl, uws_worker_t *worker, uws_app_listen_config_t config, uws_listen_handler handler)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, config, handler]() {
+        worker_defer(w, [ssl, w, config, handler]() {
             if (ssl)
             {
                 uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                uwsApp->listen(config.host, config.port, config.options, [handler, config](struct us_listen_socket_t *listen_socket)
-                            { handler((struct us_listen_socket_t *)listen_socket, config); });
+                uwsApp->listen(config.host, config.port, config.options, [w, handler, config](struct us_listen_socket_t *listen_socket)
+                            { track_listen_socket(w, listen_socket); handler((struct us_listen_socket_t *)listen_socket, config); });
             }
             else
             {
                 uWS::App *uwsApp = (uWS::App *)w->app;
-                uwsApp->listen(config.host, config.port, config.options, [handler, config](struct us_listen_socket_t *listen_socket)
-                            { handler((struct us_listen_socket_t *)listen_socket, config); });
+                uwsApp->listen(config.host, config.port, config.options, [w, handler, config](struct us_listen_socket_t *listen_socket)
+                            { track_listen_socket(w, listen_socket); handler((struct us_listen_socket_t *)listen_socket, config); });
             }
         });
     }
@@ -395,20 +3469,20 @@ extern "C"
     void uws_app_listen_domain(int ssl, uws_worker_t *worker, const char *domain, size_t domain_length, uws_listen_domain_handler handler)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, domain, domain_length, handler]() {
+        worker_defer(w, [ssl, w, domain, domain_length, handler]() {
             if (ssl)
             {
                 uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                uwsApp->listen([handler, domain, domain_length](struct us_listen_socket_t *listen_socket)
-                            { handler((struct us_listen_socket_t *)listen_socket, domain, domain_length, 0); },
+                uwsApp->listen([w, handler, domain, domain_length](struct us_listen_socket_t *listen_socket)
+                            { track_listen_socket(w, listen_socket); handler((struct us_listen_socket_t *)listen_socket, domain, domain_length, 0); },
                             std::string(domain, domain_length));
             }
             else
             {
                 uWS::App *uwsApp = (uWS::App *)w->app;
 
-                uwsApp->listen([handler, domain, domain_length](struct us_listen_socket_t *listen_socket)
-                            { handler((struct us_listen_socket_t *)listen_socket, domain, domain_length, 0); },
+                uwsApp->listen([w, handler, domain, domain_length](struct us_listen_socket_t *listen_socket)
+                            { track_listen_socket(w, listen_socket); handler((struct us_listen_socket_t *)listen_socket, domain, domain_length, 0); },
                             std::string(domain, domain_length));
             }
         });
@@ -418,13 +3492,13 @@ extern "C"
     void uws_app_listen_domain_with_options(int ssl, uws_worker_t *worker, const char *domain, size_t domain_length, int options, uws_listen_domain_handler handler)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, domain, domain_length, options, handler]() {
+        worker_defer(w, [ssl, w, domain, domain_length, options, handler]() {
             if (ssl)
             {
                 uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
                 uwsApp->listen(
-                    options, [handler, domain, domain_length, options](struct us_listen_socket_t *listen_socket)
-                    { handler((struct us_listen_socket_t *)listen_socket, domain, domain_length, options); },
+                    options, [w, handler, domain, domain_length, options](struct us_listen_socket_t *listen_socket)
+                    { track_listen_socket(w, listen_socket); handler((struct us_listen_socket_t *)listen_socket, domain, domain_length, options); },
                     std::string(domain, domain_length));
             }
             else
@@ -432,8 +3506,8 @@ extern "C"
                 uWS::App *uwsApp = (uWS::App *)w->app;
 
                 uwsApp->listen(
-                    options, [handler, domain, domain_length, options](struct us_listen_socket_t *listen_socket)
-                    { handler((struct us_listen_socket_t *)listen_socket, domain, domain_length, options); },
+                    options, [w, handler, domain, domain_length, options](struct us_listen_socket_t *listen_socket)
+                    { track_listen_socket(w, listen_socket); handler((struct us_listen_socket_t *)listen_socket, domain, domain_length, options); },
                     std::string(domain, domain_length));
             }
         });
@@ -441,7 +3515,7 @@ extern "C"
     void uws_app_domain(int ssl, uws_worker_t *worker, const char *server_name, size_t server_name_length)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, server_name, server_name_length]() {
+        worker_defer(w, [ssl, w, server_name, server_name_length]() {
             if (ssl)
             {
                 uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
@@ -466,33 +3540,87 @@ extern "C"
         uWS::App *uwsApp = (uWS::App *)w->app;
         return uwsApp->numSubscribers(std::string_view(topic, topic_length));
     }
-    bool uws_publish(int ssl, uws_worker_t *worker, const char *topic, size_t topic_length, const char *message, size_t message_length, uws_opcode_t opcode, bool compress)
+    /* sums the topic's subscribers over every loop of the pool the worker belongs to, blocks until all loops answered */
+    unsigned int uws_num_subscribers_all(int ssl, uws_worker_t *worker, const char *topic, size_t topic_length)
     {
+        Worker* w = (Worker*) worker;
+        std::vector<Worker *> workers = w->pool ? w->pool->workers : std::vector<Worker *>{w};
+        std::string name(topic, topic_length);
         std::mutex m;
         std::condition_variable cv;
-        bool result;
-        Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, topic, topic_length, message, message_length, opcode, compress, &result, &cv]() {
-            if (ssl)
-            {
-                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-                result = uwsApp->publish(std::string_view(topic, topic_length), std::string_view(message, message_length), (uWS::OpCode)(unsigned char)opcode, compress);
-            }
-            else {
-                uWS::App *uwsApp = (uWS::App *)w->app;
-                result = uwsApp->publish(std::string_view(topic, topic_length), std::string_view(message, message_length), (uWS::OpCode)(unsigned char)opcode, compress);
-            }
-            cv.notify_one();
-        });
+        size_t remaining = workers.size();
+        unsigned int total = 0;
+        for (Worker *other : workers)
+        {
+            worker_defer(other, [ssl, other, &name, &m, &cv, &remaining, &total]() {
+                unsigned int count;
+                if (ssl)
+                {
+                    count = ((uWS::SSLApp *)other->app)->numSubscribers(name);
+                }
+                else
+                {
+                    count = ((uWS::App *)other->app)->numSubscribers(name);
+                }
+                std::lock_guard lk(m);
+                total += count;
+                if (!--remaining)
+                {
+                    cv.notify_one();
+                }
+            });
+        }
         std::unique_lock lk(m);
-        cv.wait(lk);
-        return result;
+        cv.wait(lk, [&remaining]() { return !remaining; });
+        return total;
+    }
+
+    bool uws_publish(int ssl, uws_worker_t *worker, const char *topic, size_t topic_length, const char *message, size_t message_length, uws_opcode_t opcode, bool compress)
+    {
+        std::vector<PublishMessage> messages;
+        messages.push_back(PublishMessage{nullptr, shared_bytes(std::string_view(topic, topic_length)), shared_bytes(std::string_view(message, message_length)), opcode, compress});
+        publish_enqueue((Worker *)worker, std::move(messages), false);
+        return true;
+    }
+
+    uint64_t uws_publish_enqueue(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t topic_length, const char *message, size_t message_length, uws_opcode_t opcode, bool compress, bool track)
+    {
+        std::vector<PublishMessage> messages;
+        messages.push_back(PublishMessage{ws, shared_bytes(std::string_view(topic, topic_length)), shared_bytes(std::string_view(message, message_length)), opcode, compress});
+        return publish_enqueue((Worker *)worker, std::move(messages), track);
+    }
+
+    uint64_t uws_publish_batch(int ssl, uws_worker_t *worker, const char *messages, size_t messages_length, bool track)
+    {
+        return publish_enqueue((Worker *)worker, unpack_publish_batch(std::string_view(messages, messages_length)), track);
+    }
+
+    void uws_publish_wait(uws_worker_t *worker, uint64_t sequence)
+    {
+        PublishQueue &queue = ((Worker *)worker)->publishes;
+        std::unique_lock lk(queue.m);
+        queue.cv.wait(lk, [&queue, sequence]() { return queue.results.count(sequence) != 0; });
+    }
+
+    size_t uws_publish_results(uws_worker_t *worker, uint64_t sequence, uint8_t *results, size_t capacity)
+    {
+        PublishQueue &queue = ((Worker *)worker)->publishes;
+        std::lock_guard lk(queue.m);
+        auto found = queue.results.find(sequence);
+        if (found == queue.results.end())
+        {
+            return 0;
+        }
+        size_t length = std::min(capacity, found->second.size());
+        memcpy(results, found->second.data(), length);
+        queue.results.erase(found);
+        return length;
     }
 
     void uws_remove_server_name(int ssl, uws_worker_t *worker, const char *hostname_pattern, size_t hostname_pattern_length)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, hostname_pattern, hostname_pattern_length]() {
+        worker_defer(w, [ssl, w, hostname_pattern, hostname_pattern_length]() {
             if (ssl)
             {
                 uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
@@ -508,7 +3636,7 @@ extern "C"
     void uws_add_server_name(int ssl, uws_worker_t *worker, const char *hostname_pattern, size_t hostname_pattern_length)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, hostname_pattern, hostname_pattern_length]() {
+        worker_defer(w, [ssl, w, hostname_pattern, hostname_pattern_length]() {
             if (ssl)
             {
                 uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
@@ -524,7 +3652,7 @@ extern "C"
     void uws_add_server_name_with_options(int ssl, uws_worker_t *worker, const char *hostname_pattern, size_t hostname_pattern_length, struct us_socket_context_options_t options)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, hostname_pattern, hostname_pattern_length, options]() {
+        worker_defer(w, [ssl, w, hostname_pattern, hostname_pattern_length, options]() {
             uWS::SocketContextOptions sco;
             sco.ca_file_name = options.ca_file_name;
             sco.cert_file_name = options.cert_file_name;
@@ -549,7 +3677,7 @@ extern "C"
     void uws_missing_server_name(int ssl, uws_worker_t *worker, uws_missing_server_handler handler)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, handler]() {
+        worker_defer(w, [ssl, w, handler]() {
             if (ssl)
             {
                 uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
@@ -567,7 +3695,7 @@ extern "C"
     void uws_filter(int ssl, uws_worker_t *worker, uws_filter_handler handler)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, handler]() {
+        worker_defer(w, [ssl, w, handler]() {
             if (ssl)
             {
                 uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
@@ -587,7 +3715,15 @@ extern "C"
     void uws_ws(int ssl, uws_worker_t *worker, const char *pattern, uws_socket_behavior_t behavior)
     {
         Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, w, pattern, behavior]() {
+        worker_defer(w, [ssl, w, pattern = std::string(pattern), behavior]() {
+            unsigned int parameters = count_parameters(pattern);
+            WebSocketMetrics *measured = w->metrics ? metrics_registry.websocket(pattern) : nullptr;
+            MessageBatch *batch = nullptr;
+            if (behavior.message_batch)
+            {
+                batch = new MessageBatch{behavior.message_batch};
+                w->message_batches.push_back(batch);
+            }
             if (ssl)
             {
                 auto generic_handler = uWS::SSLApp::WebSocketBehavior<void *>{
@@ -602,664 +3738,383 @@ extern "C"
                 };
 
                 if (behavior.upgrade)
-                    generic_handler.upgrade = [behavior](auto *res, auto *req, auto *context)
-                    {
-                        behavior.upgrade((uws_res_t *)res, (uws_req_t *)req, (uws_socket_context_t *)context);
-                    };
-                if (behavior.open)
-                    generic_handler.open = [behavior](auto *ws)
-                    {
-                        behavior.open((uws_websocket_t *)ws);
-                    };
-                if (behavior.message)
-                    generic_handler.message = [behavior](auto *ws, auto message, auto opcode)
-                    {
-                        behavior.message((uws_websocket_t *)ws, message.data(), message.length(), (uws_opcode_t)opcode);
-                    };
-                if (behavior.drain)
-                    generic_handler.drain = [behavior](auto *ws)
-                    {
-                        behavior.drain((uws_websocket_t *)ws);
-                    };
-                if (behavior.ping)
-                    generic_handler.ping = [behavior](auto *ws, auto message)
-                    {
-                        behavior.ping((uws_websocket_t *)ws, message.data(), message.length());
-                    };
-                if (behavior.pong)
-                    generic_handler.pong = [behavior](auto *ws, auto message)
-                    {
-                        behavior.pong((uws_websocket_t *)ws, message.data(), message.length());
-                    };
-                if (behavior.close)
-                    generic_handler.close = [behavior](auto *ws, int code, auto message)
+                    generic_handler.upgrade = [behavior, w, parameters](auto *res, auto *req, auto *context)
                     {
-                        behavior.close((uws_websocket_t *)ws, code, message.data(), message.length());
-                    };
-                if (behavior.subscription)
-                    generic_handler.subscription = [behavior](auto *ws, auto topic, int subscribers, int old_subscribers){
-                        behavior.subscription((uws_websocket_t *)ws, topic.data(), topic.length(), subscribers, old_subscribers);
-
+                        w->websocket_compression[context] = behavior.compression;
+                        size_t size = request_snapshot_size(req, parameters);
+                        if (w->snapshot.size() < size)
+                        {
+                            w->snapshot.resize(size);
+                        }
+                        write_request_snapshot(req, parameters, size, w->snapshot.data());
+                        CallbackScope scope(w);
+                        behavior.upgrade((uws_res_t *)res, (uws_req_t *)req, (uws_socket_context_t *)context, w->snapshot.data(), size);
                     };
-                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
-
-                uwsApp->ws<void *>(pattern, std::move(generic_handler));
-            }
-            else
-            {
-                auto generic_handler = uWS::App::WebSocketBehavior<void *>{
-                    .compression = (uWS::CompressOptions)(uint64_t)behavior.compression,
-                    .maxPayloadLength = behavior.maxPayloadLength,
-                    .idleTimeout = behavior.idleTimeout,
-                    .maxBackpressure = behavior.maxBackpressure,
-                    .closeOnBackpressureLimit = behavior.closeOnBackpressureLimit,
-                    .resetIdleTimeoutOnSend = behavior.resetIdleTimeoutOnSend,
-                    .sendPingsAutomatically = behavior.sendPingsAutomatically,
-                    .maxLifetime = behavior.maxLifetime,
-                };
-                if (behavior.upgrade)
-                    generic_handler.upgrade = [behavior](auto *res, auto *req, auto *context)
+                else
+                    generic_handler.upgrade = [behavior, w](auto *res, auto *req, auto *context)
                     {
-                        behavior.upgrade((uws_res_t *)res, (uws_req_t *)req, (uws_socket_context_t *)context);
+                        w->websocket_compression[context] = behavior.compression;
+                        upgrade(w, res, nullptr, req->getHeader("sec-websocket-key"), req->getHeader("sec-websocket-protocol"), req->getHeader("sec-websocket-extensions"), context);
                     };
-                if (behavior.open)
-                    generic_handler.open = [behavior](auto *ws)
+                generic_handler.open = [behavior, w, measured](auto *ws)
+                {
+                    w->websockets.insert(ws);
+                    if (w->upgrade_shared_deflate)
+                        w->shared_deflate.insert(ws);
+                    if (measured)
+                        measured->opened.fetch_add(1, std::memory_order_relaxed);
+                    if (behavior.open)
                     {
+                        CallbackScope scope(w);
                         behavior.open((uws_websocket_t *)ws);
-                    };
-                if (behavior.message)
-                    generic_handler.message = [behavior](auto *ws, auto message, auto opcode)
+                    }
+                };
+                if (behavior.message || measured || batch)
+                    generic_handler.message = [behavior, w, measured, batch](auto *ws, auto message, auto opcode)
                     {
-                        behavior.message((uws_websocket_t *)ws, message.data(), message.length(), (uws_opcode_t)opcode);
+                        if (measured)
+                        {
+                            measured->messages.fetch_add(1, std::memory_order_relaxed);
+                            measured->bytes_in.fetch_add(message.length(), std::memory_order_relaxed);
+                        }
+                        if (batch)
+                        {
+                            message_batch_push(w, batch, ws, message, (uws_opcode_t)opcode);
+                        }
+                        else if (behavior.message)
+                        {
+                            CallbackScope scope(w);
+                            behavior.message((uws_websocket_t *)ws, message.data(), message.length(), (uws_opcode_t)opcode);
+                        }
                     };
                 if (behavior.drain)
-                    generic_handler.drain = [behavior](auto *ws)
+                    generic_handler.drain = [behavior, w](auto *ws)
                     {
+                        CallbackScope scope(w);
                         behavior.drain((uws_websocket_t *)ws);
                     };
                 if (behavior.ping)
-                    generic_handler.ping = [behavior](auto *ws, auto message)
+                    generic_handler.ping = [behavior, w](auto *ws, auto message)
                     {
+                        CallbackScope scope(w);
                         behavior.ping((uws_websocket_t *)ws, message.data(), message.length());
                     };
                 if (behavior.pong)
-                    generic_handler.pong = [behavior](auto *ws, auto message)
+                    generic_handler.pong = [behavior, w](auto *ws, auto message)
                     {
+                        CallbackScope scope(w);
                         behavior.pong((uws_websocket_t *)ws, message.data(), message.length());
                     };
-                if (behavior.close)
-                    generic_handler.close = [behavior](auto *ws, int code, auto message)
+                generic_handler.close = [behavior, w, measured, batch](auto *ws, int code, auto message)
+                {
+                    // the messages of a socket reach deno before its close
+                    if (batch)
                     {
+                        message_batch_flush(w, batch);
+                    }
+                    w->websockets.erase(ws);
+                    w->shared_deflate.erase(ws);
+                    if (measured)
+                        measured->closed.fetch_add(1, std::memory_order_relaxed);
+                    if (behavior.close)
+                    {
+                        CallbackScope scope(w);
                         behavior.close((uws_websocket_t *)ws, code, message.data(), message.length());
-                    };
+                    }
+                };
                 if (behavior.subscription)
-                    generic_handler.subscription = [behavior](auto *ws, auto topic, int subscribers, int old_subscribers){
+                    generic_handler.subscription = [behavior, w](auto *ws, auto topic, int subscribers, int old_subscribers){
+                        CallbackScope scope(w);
                         behavior.subscription((uws_websocket_t *)ws, topic.data(), topic.length(), subscribers, old_subscribers);
 
                     };
-                uWS::App *uwsApp = (uWS::App *)w->app;
-                uwsApp->ws<void *>(pattern, std::move(generic_handler));
-            }
-        });
-    }
-
-    void uws_ws_close(int ssl, uws_worker_t *worker, uws_websocket_t *ws)
-    {
-        if (ssl)
-        {
-            uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-            uws->close();
-        }
-        else
-        {
-            uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-            uws->close();
-        }
-    }
-
-    uws_sendstatus_t uws_ws_send(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode)
-    {
-        if (ssl)
-        {
-            uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-            return (uws_sendstatus_t)uws->send(std::string_view(message, length), (uWS::OpCode)(unsigned char)opcode);
-        }
-        else {
-            uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-            return (uws_sendstatus_t)uws->send(std::string_view(message, length), (uWS::OpCode)(unsigned char)opcode);
-        }
-    }
-
-    uws_sendstatus_t uws_ws_send_with_options(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode, bool compress, bool fin)
-    {
-        if (ssl)
-        {
-            uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-            return (uws_sendstatus_t)uws->send(std::string_view(message, length), (uWS::OpCode)(unsigned char)opcode, compress, fin);
-        }
-        else
-        {
-            uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-            return (uws_sendstatus_t)uws->send(std::string_view(message, length), (uWS::OpCode)(unsigned char)opcode, compress, fin);
-        }
-    }
-
-    void uws_ws_end(int ssl, uws_worker_t *worker, uws_websocket_t *ws, int code, const char *message, size_t length)
-    {
-        if (ssl)
-        {
-            uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-            uws->end(code, std::string_view(message, length));
-        }
-        else
-        {
-            uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-            uws->end(code, std::string_view(message, length));
-        }
-    }
-
-    void uws_ws_cork(int ssl, uws_worker_t *worker, uws_websocket_t *ws, void (*handler)())
-    {
-        if (ssl)
-        {
-            uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-            uws->cork([handler]()
-                    { handler(); });
-        }
-        else
-        {
-            uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-
-            uws->cork([handler]()
-                    { handler(); });
-        }
-    }
-    bool uws_ws_subscribe(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length)
-    {
-        if (ssl)
-        {
-            uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-            return uws->subscribe(std::string_view(topic, length));
-        }
-        else
-        {
-            uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-            return uws->subscribe(std::string_view(topic, length));
-        }
-    }
-    bool uws_ws_unsubscribe(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length)
-    {
-        if (ssl)
-        {
-            uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-            return uws->unsubscribe(std::string_view(topic, length));
-        }
-        else
-        {
-            uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-            return uws->unsubscribe(std::string_view(topic, length));
-        }
-    }
-
-    bool uws_ws_is_subscribed(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length)
-    {
-        if (ssl)
-        {
-            uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-            return uws->isSubscribed(std::string_view(topic, length));
-        }
-        else
-        {
-            uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-            return uws->isSubscribed(std::string_view(topic, length));
-        }
-    }
-    void uws_ws_iterate_topics(int ssl, uws_worker_t *worker, uws_websocket_t *ws, void (*callback)(const char *topic, size_t length))
-    {
-        if (ssl)
-        {
-            uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-            uws->iterateTopics([callback](auto topic)
-                            { callback(topic.data(), topic.length()); });
-        }
-        else
-        {
-            uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-            uws->iterateTopics([callback](auto topic)
-                            { callback(topic.data(), topic.length()); });
-        }
-    }
-
-    bool uws_ws_publish(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t topic_length, const char *message, size_t message_length)
-    {
-        std::mutex m;
-        std::condition_variable cv;
-        bool result;
-        Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, ws, topic, topic_length, message, message_length, &cv, &result]() {
-            if (ssl)
-            {
-                uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-                result = uws->publish(std::string_view(topic, topic_length), std::string_view(message, message_length));
-            }
-            else
-            {
-                uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-                result = uws->publish(std::string_view(topic, topic_length), std::string_view(message, message_length));
-            }
-            cv.notify_one();
-        });
-        std::unique_lock lk(m);
-        cv.wait(lk);
-        return result;
-    }
+                uWS::SSLApp *uwsApp = (uWS::SSLApp *)w->app;
 
-    bool uws_ws_publish_with_options(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t topic_length, const char *message, size_t message_length, uws_opcode_t opcode, bool compress)
-    {
-        std::mutex m;
-        std::condition_variable cv;
-        bool result;
-        Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, ws, topic, topic_length, message, message_length, opcode, compress, &cv, &result]() {
-            if (ssl)
-            {
-                uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-                result = uws->publish(std::string_view(topic, topic_length), std::string_view(message, message_length), (uWS::OpCode)(unsigned char)opcode, compress);
+                uwsApp->ws<void *>(pattern, std::move(generic_handler));
             }
             else
             {
-                uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-                result = uws->publish(std::string_view(topic, topic_length), std::string_view(message, message_length), (uWS::OpCode)(unsigned char)opcode, compress);
+                auto generic_handler = uWS::App::WebSocketBehavior<void *>{
+                    .compression = (uWS::CompressOptions)(uint64_t)behavior.compression,
+                    .maxPayloadLength = behavior.maxPayloadLength,
+                    .idleTimeout = behavior.idleTimeout,
+                    .maxBackpressure = behavior.maxBackpressure,
+                    .closeOnBackpressureLimit = behavior.closeOnBackpressureLimit,
+                    .resetIdleTimeoutOnSend = behavior.resetIdleTimeoutOnSend,
+                    .sendPingsAutomatically = behavior.sendPingsAutomatically,
+                    .maxLifetime = behavior.maxLifetime,
+                };
+                if (behavior.upgrade)
+                    generic_handler.upgrade = [behavior, w, parameters](auto *res, auto *req, auto *context)
+                    {
+                        w->websocket_compression[context] = behavior.compression;
+                        size_t size = request_snapshot_size(req, parameters);
+                        if (w->snapshot.size() < size)
+                        {
+                            w->snapshot.resize(size);
+                        }
+                        write_request_snapshot(req, parameters, size, w->snapshot.data());
+                        CallbackScope scope(w);
+                        behavior.upgrade((uws_res_t *)res, (uws_req_t *)req, (uws_socket_context_t *)context, w->snapshot.data(), size);
+                    };
+                else
+                    generic_handler.upgrade = [behavior, w](auto *res, auto *req, auto *context)
+                    {
+                        w->websocket_compression[context] = behavior.compression;
+                        upgrade(w, res, nullptr, req->getHeader("sec-websocket-key"), req->getHeader("sec-websocket-protocol"), req->getHeader("sec-websocket-extensions"), context);
+                    };
+                generic_handler.open = [behavior, w, measured](auto *ws)
+                {
+                    w->websockets.insert(ws);
+                    if (w->upgrade_shared_deflate)
+                        w->shared_deflate.insert(ws);
+                    if (measured)
+                        measured->opened.fetch_add(1, std::memory_order_relaxed);
+                    if (behavior.open)
+                    {
+                        CallbackScope scope(w);
+                        behavior.open((uws_websocket_t *)ws);
+                    }
+                };
+                if (behavior.message || measured || batch)
+                    generic_handler.message = [behavior, w, measured, batch](auto *ws, auto message, auto opcode)
+                    {
+                        if (measured)
+                        {
+                            measured->messages.fetch_add(1, std::memory_order_relaxed);
+                            measured->bytes_in.fetch_add(message.length(), std::memory_order_relaxed);
+                        }
+                        if (batch)
+                        {
+                            message_batch_push(w, batch, ws, message, (uws_opcode_t)opcode);
+                        }
+                        else if (behavior.message)
+                        {
+                            CallbackScope scope(w);
+                            behavior.message((uws_websocket_t *)ws, message.data(), message.length(), (uws_opcode_t)opcode);
+                        }
+                    };
+                if (behavior.drain)
+                    generic_handler.drain = [behavior, w](auto *ws)
+                    {
+                        CallbackScope scope(w);
+                        behavior.drain((uws_websocket_t *)ws);
+                    };
+                if (behavior.ping)
+                    generic_handler.ping = [behavior, w](auto *ws, auto message)
+                    {
+                        CallbackScope scope(w);
+                        behavior.ping((uws_websocket_t *)ws, message.data(), message.length());
+                    };
+                if (behavior.pong)
+                    generic_handler.pong = [behavior, w](auto *ws, auto message)
+                    {
+                        CallbackScope scope(w);
+                        behavior.pong((uws_websocket_t *)ws, message.data(), message.length());
+                    };
+                generic_handler.close = [behavior, w, measured, batch](auto *ws, int code, auto message)
+                {
+                    // the messages of a socket reach deno before its close
+                    if (batch)
+                    {
+                        message_batch_flush(w, batch);
+                    }
+                    w->websockets.erase(ws);
+                    w->shared_deflate.erase(ws);
+                    if (measured)
+                        measured->closed.fetch_add(1, std::memory_order_relaxed);
+                    if (behavior.close)
+                    {
+                        CallbackScope scope(w);
+                        behavior.close((uws_websocket_t *)ws, code, message.data(), message.length());
+                    }
+                };
+                if (behavior.subscription)
+                    generic_handler.subscription = [behavior, w](auto *ws, auto topic, int subscribers, int old_subscribers){
+                        CallbackScope scope(w);
+                        behavior.subscription((uws_websocket_t *)ws, topic.data(), topic.length(), subscribers, old_subscribers);
+
+                    };
+                uWS::App *uwsApp = (uWS::App *)w->app;
+                uwsApp->ws<void *>(pattern, std::move(generic_handler));
             }
-            cv.notify_one();
         });
-        std::unique_lock lk(m);
-        cv.wait(lk);
-        return result;
     }
 
-    unsigned int uws_ws_get_buffered_amount(int ssl, uws_worker_t *worker, uws_websocket_t *ws)
-    {
-        if (ssl)
-        {
-            uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-            return uws->getBufferedAmount();
-        }
-        else
-        {
-            uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-            return uws->getBufferedAmount();
-        }
-    }
+    UWS_SSL_EXPORT(void, ws_close, (uws_worker_t *worker, uws_websocket_t *ws),
+                   (worker, ws))
 
+    UWS_SSL_EXPORT(uws_sendstatus_t, ws_send, (uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode),
+                   (worker, ws, message, length, opcode))
 
-    size_t uws_ws_get_remote_address(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char **dest)
-    {
-        if (ssl)
-        {
-            uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-            std::string_view value = uws->getRemoteAddress();
-            *dest = value.data();
-            return value.length();
-        }
-        else
-        {
-            uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-            std::string_view value = uws->getRemoteAddress();
-            *dest = value.data();
-            return value.length();
-        }
-    }
+    UWS_SSL_EXPORT(uws_sendstatus_t, ws_send_with_options, (uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode, bool compress, bool fin),
+                   (worker, ws, message, length, opcode, compress, fin))
 
-    size_t uws_ws_get_remote_address_as_text(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char **dest)
+    uws_prepared_message_t *uws_ws_prepare_message(const char *message, size_t length, uws_opcode_t opcode, bool compress)
     {
-        if (ssl)
+        PreparedMessage *prepared = new PreparedMessage;
+        prepared->opcode = (uWS::OpCode)(unsigned char)opcode;
+        prepared->payload.assign(message, length);
+        // a message deflate does not shrink is sent uncompressed to every socket
+        if (compress && (opcode == TEXT || opcode == BINARY) && deflate_message(prepared->payload, prepared->deflated))
         {
-            uWS::WebSocket<true, true, void *> *uws = (uWS::WebSocket<true, true, void *> *)ws;
-            std::string_view value = uws->getRemoteAddressAsText();
-            *dest = value.data();
-            return value.length();
+            prepared->compress = true;
         }
         else
         {
-            uWS::WebSocket<false, true, void *> *uws = (uWS::WebSocket<false, true, void *> *)ws;
-            std::string_view value = uws->getRemoteAddressAsText();
-            *dest = value.data();
-            return value.length();
+            prepared->deflated.clear();
         }
+        return (uws_prepared_message_t *)prepared;
     }
 
-    void uws_res_end(int ssl, uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, bool close_connection)
+    void uws_ws_prepared_message_retain(uws_prepared_message_t *prepared)
     {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            uwsRes->end(std::string_view(data, length), close_connection);
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            uwsRes->end(std::string_view(data, length), close_connection);
-        }
+        ((PreparedMessage *)prepared)->references.fetch_add(1, std::memory_order_relaxed);
     }
 
-    size_t uws_res_get_remote_address(int ssl, uws_worker_t *worker, uws_res_t *res, const char **dest)
+    void uws_ws_prepared_message_release(uws_prepared_message_t *prepared)
     {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            std::string_view value = uwsRes->getRemoteAddress();
-            *dest = value.data();
-            return value.length();
-        }
-        else
+        PreparedMessage *message = (PreparedMessage *)prepared;
+        if (message->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
         {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            std::string_view value = uwsRes->getRemoteAddress();
-            *dest = value.data();
-            return value.length();
+            delete message;
         }
     }
 
-    size_t uws_res_get_remote_address_as_text(int ssl, uws_worker_t *worker, uws_res_t *res, const char **dest)
-    {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            std::string_view value = uwsRes->getRemoteAddressAsText();
-            *dest = value.data();
-            return value.length();
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            std::string_view value = uwsRes->getRemoteAddressAsText();
-            *dest = value.data();
-            return value.length();
-        }
-    }
+    UWS_SSL_EXPORT(uws_sendstatus_t, ws_send_prepared, (uws_worker_t *worker, uws_websocket_t *ws, uws_prepared_message_t *message),
+                   (worker, ws, message))
 
-    size_t uws_res_get_proxied_remote_address(int ssl, uws_worker_t *worker, uws_res_t *res, const char **dest)
-    {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            std::string_view value = uwsRes->getProxiedRemoteAddress();
-            *dest = value.data();
-            return value.length();
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            std::string_view value = uwsRes->getProxiedRemoteAddress();
-            *dest = value.data();
-            return value.length();
-        }
-    }
+    UWS_SSL_EXPORT(void, ws_send_batch, (uws_worker_t *worker, uws_websocket_t *const *sockets, size_t count, const char *message, size_t length, uws_opcode_t opcode, bool compress, uint8_t *results),
+                   (worker, sockets, count, message, length, opcode, compress, results))
 
-    size_t uws_res_get_proxied_remote_address_as_text(int ssl, uws_worker_t *worker, uws_res_t *res, const char **dest)
-    {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            std::string_view value = uwsRes->getProxiedRemoteAddressAsText();
-            *dest = value.data();
-            return value.length();
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            std::string_view value = uwsRes->getProxiedRemoteAddressAsText();
-            *dest = value.data();
-            return value.length();
-        }
-    }
+    UWS_SSL_EXPORT(void, ws_end, (uws_worker_t *worker, uws_websocket_t *ws, int code, const char *message, size_t length),
+                   (worker, ws, code, message, length))
 
-    uws_try_end_result_t uws_res_try_end(int ssl, uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, uintmax_t total_size, bool close_connection)
-    {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            std::pair<bool, bool> result = uwsRes->tryEnd(std::string_view(data, length), total_size, close_connection);
-            return uws_try_end_result_t{
-                .ok = result.first,
-                .has_responded = result.second,
-            };
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            std::pair<bool, bool> result = uwsRes->tryEnd(std::string_view(data, length), total_size);
-            return uws_try_end_result_t{
-                .ok = result.first,
-                .has_responded = result.second,
-            };
-        }
-    }
+    UWS_SSL_EXPORT(void, ws_cork, (uws_worker_t *worker, uws_websocket_t *ws, void (*handler)(void *optional_data), void *optional_data),
+                   (worker, ws, handler, optional_data))
+    UWS_SSL_EXPORT(bool, ws_subscribe, (uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length),
+                   (worker, ws, topic, length))
+    UWS_SSL_EXPORT(bool, ws_unsubscribe, (uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length),
+                   (worker, ws, topic, length))
 
-    void uws_res_cork(int ssl, uws_worker_t *worker, uws_res_t *res, void (*callback)(uws_res_t *res))
-    {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            uwsRes->cork([=]()
-                        { callback(res); });
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            uwsRes->cork([=]()
-                        { callback(res); });
-        }
-    }
+    UWS_SSL_EXPORT(bool, ws_is_subscribed, (uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length),
+                   (worker, ws, topic, length))
+    UWS_SSL_EXPORT(void, ws_iterate_topics, (uws_worker_t *worker, uws_websocket_t *ws, void (*callback)(const char *topic, size_t length, void *optional_data), void *optional_data),
+                   (worker, ws, callback, optional_data))
 
-    void uws_res_pause(int ssl, uws_worker_t *worker, uws_res_t *res)
+    bool uws_ws_publish(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t topic_length, const char *message, size_t message_length)
     {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            uwsRes->pause();
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            uwsRes->pause();
-        }
+        std::vector<PublishMessage> messages;
+        messages.push_back(PublishMessage{ws, shared_bytes(std::string_view(topic, topic_length)), shared_bytes(std::string_view(message, message_length)), TEXT, false});
+        publish_enqueue((Worker *)worker, std::move(messages), false);
+        return true;
     }
 
-    void uws_res_resume(int ssl, uws_worker_t *worker, uws_res_t *res)
+    bool uws_ws_publish_with_options(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t topic_length, const char *message, size_t message_length, uws_opcode_t opcode, bool compress)
     {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            uwsRes->pause();
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            uwsRes->pause();
-        }
+        std::vector<PublishMessage> messages;
+        messages.push_back(PublishMessage{ws, shared_bytes(std::string_view(topic, topic_length)), shared_bytes(std::string_view(message, message_length)), opcode, compress});
+        publish_enqueue((Worker *)worker, std::move(messages), false);
+        return true;
     }
 
-    void uws_res_write_continue(int ssl, uws_worker_t *worker, uws_res_t *res)
-    {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            uwsRes->writeContinue();
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            uwsRes->writeContinue();
-        }
-    }
+    UWS_SSL_EXPORT(unsigned int, ws_get_buffered_amount, (uws_worker_t *worker, uws_websocket_t *ws),
+                   (worker, ws))
 
-    void uws_res_write_status(int ssl, uws_worker_t *worker, uws_res_t *res, const char *status, size_t length)
-    {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            uwsRes->writeStatus(std::string_view(status, length));
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            uwsRes->writeStatus(std::string_view(status, length));
-        }
-    }
+    UWS_SSL_EXPORT(size_t, ws_get_remote_address, (uws_worker_t *worker, uws_websocket_t *ws, const char **dest),
+                   (worker, ws, dest))
 
-    void uws_res_write_header(int ssl, uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, const char *value, size_t value_length)
-    {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            uwsRes->writeHeader(std::string_view(key, key_length), std::string_view(value, value_length));
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            uwsRes->writeHeader(std::string_view(key, key_length), std::string_view(value, value_length));
-        }
-    }
-    void uws_res_write_header_int(int ssl, uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, uint64_t value)
-    {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            uwsRes->writeHeader(std::string_view(key, key_length), value);
-        }
-        else
-        {
+    UWS_SSL_EXPORT(size_t, ws_get_remote_address_as_text, (uws_worker_t *worker, uws_websocket_t *ws, const char **dest),
+                   (worker, ws, dest))
 
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            uwsRes->writeHeader(std::string_view(key, key_length), value);
-        }
-    }
+    UWS_SSL_EXPORT(void, res_end, (uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, bool close_connection),
+                   (worker, res, data, length, close_connection))
 
-    void uws_res_end_without_body(int ssl, uws_worker_t *worker, uws_res_t *res, bool close_connection)
+    unsigned int uws_prepare_headers(const char *status, size_t status_length, const char *headers, size_t headers_length)
     {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            uwsRes->endWithoutBody(std::nullopt, close_connection);
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            uwsRes->endWithoutBody(std::nullopt, close_connection);
-        }
+        HeaderBlock *block = new HeaderBlock();
+        fill_header_block(*block, std::string_view(status, status_length), std::string_view(headers, headers_length));
+        return prepared_headers.add(block);
     }
 
-    bool uws_res_write(int ssl, uws_worker_t *worker, uws_res_t *res, const char *data, size_t length)
-    {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            return uwsRes->write(std::string_view(data, length));
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            return uwsRes->write(std::string_view(data, length));
-        }
-    }
-    uintmax_t uws_res_get_write_offset(int ssl, uws_worker_t *worker, uws_res_t *res)
-    {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            return uwsRes->getWriteOffset();
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            return uwsRes->getWriteOffset();
-        }
-    }
-    void uws_res_override_write_offset(int ssl, uws_worker_t *worker, uws_res_t *res, uintmax_t offset)
-    {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            uwsRes->overrideWriteOffset(offset);
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            uwsRes->overrideWriteOffset(offset);
-        }
-    }
-    bool uws_res_has_responded(int ssl, uws_worker_t *worker, uws_res_t *res)
+    unsigned int uws_prepare_body(const char *body, size_t body_length)
     {
-        if (ssl)
-        {
-            uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-            return uwsRes->hasResponded();
-        }
-        else
-        {
-            uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-            return uwsRes->hasResponded();
-        }
+        return prepared_bodies.add(new std::string(body, body_length));
     }
 
-    void uws_res_on_writable(int ssl, uws_worker_t *worker, uws_res_t *res, bool (*handler)(uws_res_t *res, uintmax_t))
-    {
-        Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, res, handler]() {
-            if (ssl)
-            {
-                uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-                uwsRes->onWritable([handler, res](uintmax_t a)
-                                { return handler(res, a); });
-            }
-            else
-            {
-                uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-                uwsRes->onWritable([handler, res](uintmax_t a)
-                                { return handler(res, a); });
-            }
-        });
-    }
+    UWS_SSL_EXPORT(void, res_end_prepared, (uws_worker_t *worker, uws_res_t *res, unsigned int headers_id, unsigned int body_id, const char *body, size_t body_length, bool close_connection),
+                   (worker, res, headers_id, body_id, body, body_length, close_connection))
 
-    void uws_res_on_aborted(int ssl, uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res))
-    {
-        Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, res, handler]() {
-            if (ssl)
-            {
-                uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-                uwsRes->onAborted([handler, res]
-                                { handler(res); });
-            }
-            else
-            {
-                uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-                uwsRes->onAborted([handler, res]
-                                { handler(res); });
-            }
-        });
-    }
+    UWS_SSL_EXPORT(bool, res_end_owned, (uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, bool close_connection, void (*release)(const char *data)),
+                   (worker, res, data, length, close_connection, release))
 
-    void uws_res_on_data(int ssl, uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res, const char *chunk, size_t chunk_length, bool is_end))
-    {
-        Worker* w = (Worker*) worker;
-        w->loop->defer([ssl, res, handler]() {
-            if (ssl)
-            {
-                uWS::HttpResponse<true> *uwsRes = (uWS::HttpResponse<true> *)res;
-                uwsRes->onData([handler, res](auto chunk, bool is_end)
-                            { handler(res, chunk.data(), chunk.length(), is_end); });
-            }
-            else
-            {
-                uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-                uwsRes->onData([handler, res](auto chunk, bool is_end)
-                            { handler(res, chunk.data(), chunk.length(), is_end); });
-            }
-        });
-    }
+    UWS_SSL_EXPORT(void, res_end_cached, (uws_worker_t *worker, uws_res_t *res, unsigned int ttl, const char *status, size_t status_length, const char *headers, size_t headers_length, const char *body, size_t body_length, bool close_connection),
+                   (worker, res, ttl, status, status_length, headers, headers_length, body, body_length, close_connection))
+
+    UWS_SSL_EXPORT(void, res_end_compressed, (uws_worker_t *worker, uws_res_t *res, const char *accept_encoding, size_t accept_encoding_length, unsigned int encodings, size_t min_length, const char *data, size_t length, bool close_connection),
+                   (worker, res, accept_encoding, accept_encoding_length, encodings, min_length, data, length, close_connection))
+
+    UWS_SSL_EXPORT(void, res_stream_fd, (uws_worker_t *worker, uws_res_t *res, int fd, uint64_t offset, uint64_t length, bool close_fd, void (*handler)(uws_res_t *res, bool completed, void *optional_data), void (*aborted)(uws_res_t *res, void *optional_data), void *optional_data),
+                   (worker, res, fd, offset, length, close_fd, handler, aborted, optional_data))
+
+    UWS_SSL_EXPORT(size_t, res_get_remote_address, (uws_worker_t *worker, uws_res_t *res, const char **dest),
+                   (worker, res, dest))
+
+    UWS_SSL_EXPORT(size_t, res_get_remote_address_as_text, (uws_worker_t *worker, uws_res_t *res, const char **dest),
+                   (worker, res, dest))
+
+    UWS_SSL_EXPORT(size_t, res_get_proxied_remote_address, (uws_worker_t *worker, uws_res_t *res, const char **dest),
+                   (worker, res, dest))
+
+    UWS_SSL_EXPORT(size_t, res_get_proxied_remote_address_as_text, (uws_worker_t *worker, uws_res_t *res, const char **dest),
+                   (worker, res, dest))
+
+    UWS_SSL_EXPORT(uws_try_end_result_t, res_try_end, (uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, uintmax_t total_size, bool close_connection),
+                   (worker, res, data, length, total_size, close_connection))
+
+    UWS_SSL_EXPORT(void, res_cork, (uws_worker_t *worker, uws_res_t *res, void (*callback)(uws_res_t *res, void *optional_data), void *optional_data),
+                   (worker, res, callback, optional_data))
+
+    UWS_SSL_EXPORT(void, res_pause, (uws_worker_t *worker, uws_res_t *res),
+                   (worker, res))
+
+    UWS_SSL_EXPORT(void, res_resume, (uws_worker_t *worker, uws_res_t *res),
+                   (worker, res))
+
+    UWS_SSL_EXPORT(void, res_write_continue, (uws_worker_t *worker, uws_res_t *res),
+                   (worker, res))
+
+    UWS_SSL_EXPORT(void, res_write_status, (uws_worker_t *worker, uws_res_t *res, const char *status, size_t length),
+                   (worker, res, status, length))
+
+    UWS_SSL_EXPORT(void, res_write_header, (uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, const char *value, size_t value_length),
+                   (worker, res, key, key_length, value, value_length))
+    UWS_SSL_EXPORT(void, res_write_header_int, (uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, uint64_t value),
+                   (worker, res, key, key_length, value))
+
+    UWS_SSL_EXPORT(void, res_end_without_body, (uws_worker_t *worker, uws_res_t *res, bool close_connection),
+                   (worker, res, close_connection))
+
+    UWS_SSL_EXPORT(bool, res_write, (uws_worker_t *worker, uws_res_t *res, const char *data, size_t length),
+                   (worker, res, data, length))
+    UWS_SSL_EXPORT(uintmax_t, res_get_write_offset, (uws_worker_t *worker, uws_res_t *res),
+                   (worker, res))
+    UWS_SSL_EXPORT(void, res_override_write_offset, (uws_worker_t *worker, uws_res_t *res, uintmax_t offset),
+                   (worker, res, offset))
+    UWS_SSL_EXPORT(bool, res_has_responded, (uws_worker_t *worker, uws_res_t *res),
+                   (worker, res))
+
+    UWS_SSL_EXPORT(void, res_collect_body, (uws_worker_t *worker, uws_res_t *res, size_t max_length, size_t expected_length, void (*handler)(uws_res_t *res, const char *body, size_t length, bool ok, void *optional_data), void (*aborted)(uws_res_t *res, void *optional_data), void *optional_data),
+                   (worker, res, max_length, expected_length, handler, aborted, optional_data))
+
+    UWS_SSL_EXPORT(void, res_on_writable, (uws_worker_t *worker, uws_res_t *res, bool (*handler)(uws_res_t *res, uintmax_t, void *optional_data), void *optional_data),
+                   (worker, res, handler, optional_data))
+
+    UWS_SSL_EXPORT(void, res_on_aborted, (uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res, void *optional_data), void *optional_data),
+                   (worker, res, handler, optional_data))
+
+    UWS_SSL_EXPORT(void, res_on_data, (uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res, const char *chunk, size_t chunk_length, bool is_end, void *optional_data), void *optional_data),
+                   (worker, res, handler, optional_data))
 
     bool uws_req_is_ancient(uws_worker_t *worker, uws_req_t *res)
     {
@@ -1344,13 +4199,6 @@ extern "C"
         return value.length();
     }
 
-    void uws_res_upgrade(int ssl, uws_worker_t *worker, uws_res_t *res, void *data, const char *sec_web_socket_key, size_t sec_web_socket_key_length, const char *sec_web_socket_protocol, size_t sec_web_socket_protocol_length, const char *sec_web_socket_extensions, size_t sec_web_socket_extensions_length, uws_socket_context_t *ws)
-    {
-        uWS::HttpResponse<false> *uwsRes = (uWS::HttpResponse<false> *)res;
-        uwsRes->template upgrade<void *>(data ? std::move(data) : NULL,
-                                        std::string_view(sec_web_socket_key, sec_web_socket_key_length),
-                                        std::string_view(sec_web_socket_protocol, sec_web_socket_protocol_length),
-                                        std::string_view(sec_web_socket_extensions, sec_web_socket_extensions_length),
-                                        (struct us_socket_context_t *)ws);
-    }
+    UWS_SSL_EXPORT(void, res_upgrade, (uws_worker_t *worker, uws_res_t *res, void *data, const char *sec_web_socket_key, size_t sec_web_socket_key_length, const char *sec_web_socket_protocol, size_t sec_web_socket_protocol_length, const char *sec_web_socket_extensions, size_t sec_web_socket_extensions_length, uws_socket_context_t *ws),
+                   (worker, res, data, sec_web_socket_key, sec_web_socket_key_length, sec_web_socket_protocol, sec_web_socket_protocol_length, sec_web_socket_extensions, sec_web_socket_extensions_length, ws))
 }
\ No newline at end of file
@@ -25,6 +25,14 @@ extern "C"
 #  define DLL_EXPORT
 #endif
 
+/* the res and ws calls are compiled once per kind of socket: uws_tcp_<name> and uws_tls_<name> take no ssl and do
+   not branch on it, uws_<name>(int ssl, ...) picks one of them */
+#define UWS_UNPAREN(...) __VA_ARGS__
+#define UWS_SSL_SPECIALIZED(result, name, params) \
+    DLL_EXPORT result uws_tcp_##name params;      \
+    DLL_EXPORT result uws_tls_##name params;      \
+    DLL_EXPORT result uws_##name(int ssl, UWS_UNPAREN params)
+
     DLL_EXPORT typedef enum
     {
         /* These are not actual compression options */
@@ -75,6 +83,28 @@ extern "C"
         DROPPED
     } uws_sendstatus_t;
 
+    DLL_EXPORT typedef enum
+    {
+        METHOD_GET,
+        METHOD_POST,
+        METHOD_OPTIONS,
+        METHOD_DELETE,
+        METHOD_PATCH,
+        METHOD_PUT,
+        METHOD_HEAD,
+        METHOD_CONNECT,
+        METHOD_TRACE,
+        METHOD_ANY
+    } uws_method_t;
+
+    /* flags of uws_res_end_compressed, BROTLI needs UWS_WITH_BROTLI */
+    DLL_EXPORT typedef enum
+    {
+        CONTENT_ENCODING_GZIP = 1,
+        CONTENT_ENCODING_DEFLATE = 2,
+        CONTENT_ENCODING_BROTLI = 4
+    } uws_content_encoding_t;
+
     DLL_EXPORT typedef struct
     {
 
@@ -88,25 +118,46 @@ extern "C"
         bool has_responded;
     } uws_try_end_result_t;
 
+    /* see uws_loop_stats, times are nanoseconds */
+    DLL_EXPORT typedef struct {
+        uint64_t iterations;
+        uint64_t wakeups;
+        uint64_t deferred;
+        uint64_t deferred_max;
+        uint64_t callbacks;
+        uint64_t callback_time;
+        uint64_t callback_max;
+        uint64_t idle_time;
+        uint64_t uptime;
+        uint64_t lag;
+        uint64_t lag_max;
+    } uws_loop_stats_t;
+
     DLL_EXPORT struct uws_worker_s;
+    DLL_EXPORT struct uws_pool_s;
     DLL_EXPORT struct uws_app_s;
     DLL_EXPORT struct uws_req_s;
     DLL_EXPORT struct uws_res_s;
     DLL_EXPORT struct uws_websocket_s;
+    DLL_EXPORT struct uws_prepared_message_s;
     DLL_EXPORT struct uws_header_iterator_s;
     DLL_EXPORT typedef struct uws_worker_s uws_worker_t;
+    DLL_EXPORT typedef struct uws_pool_s uws_pool_t;
     DLL_EXPORT typedef struct uws_app_s uws_app_t;
     DLL_EXPORT typedef struct uws_req_s uws_req_t;
     DLL_EXPORT typedef struct uws_res_s uws_res_t;
     DLL_EXPORT typedef struct uws_socket_context_s uws_socket_context_t;
     DLL_EXPORT typedef struct uws_websocket_s uws_websocket_t;
+    DLL_EXPORT typedef struct uws_prepared_message_s uws_prepared_message_t;
 
     DLL_EXPORT typedef void (*uws_websocket_handler)(uws_websocket_t *ws);
     DLL_EXPORT typedef void (*uws_websocket_message_handler)(uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode);
     DLL_EXPORT typedef void (*uws_websocket_ping_pong_handler)(uws_websocket_t *ws, const char *message, size_t length);
     DLL_EXPORT typedef void (*uws_websocket_close_handler)(uws_websocket_t *ws, int code, const char *message, size_t length);
-    DLL_EXPORT typedef void (*uws_websocket_upgrade_handler)(uws_res_t *response, uws_req_t *request, uws_socket_context_t *context);
+    DLL_EXPORT typedef void (*uws_websocket_upgrade_handler)(uws_res_t *response, uws_req_t *request, uws_socket_context_t *context, const char *snapshot, size_t snapshot_length);
     DLL_EXPORT typedef void (*uws_websocket_subscription_handler)(uws_websocket_t *ws, const char *topic_name, size_t topic_name_length, int new_number_of_subscriber, int old_number_of_subscriber);
+    /* records are u64 ws, u32 length, u8 opcode, 3 bytes padding and the payload, each padded to 8 bytes */
+    DLL_EXPORT typedef void (*uws_websocket_message_batch_handler)(const char *records, size_t length, unsigned int count);
 
     DLL_EXPORT typedef struct
     {
@@ -132,17 +183,44 @@ extern "C"
         uws_websocket_ping_pong_handler pong;
         uws_websocket_close_handler close;
         uws_websocket_subscription_handler subscription;
+        /* when set, messages are not passed to message one by one but collected per loop and handed over once per
+           loop iteration. A socket's messages are handed over before its close */
+        uws_websocket_message_batch_handler message_batch;
     } uws_socket_behavior_t;
 
     DLL_EXPORT typedef void (*uws_listen_handler)(struct us_listen_socket_t *listen_socket, uws_app_listen_config_t config);
     DLL_EXPORT typedef void (*uws_listen_domain_handler)(struct us_listen_socket_t *listen_socket, const char* domain, size_t domain_length, int options);
-    DLL_EXPORT typedef void (*uws_method_handler)(uws_res_t *response, uws_req_t *request);
+    /* snapshot is a flat copy of the request (method, url, query, parameters, headers), valid during the call */
+    DLL_EXPORT typedef void (*uws_method_handler)(uws_res_t *response, uws_req_t *request, const char *snapshot, size_t snapshot_length);
     DLL_EXPORT typedef void (*uws_filter_handler)(uws_res_t *response, int);
     DLL_EXPORT typedef void (*uws_missing_server_handler)(const char *hostname, size_t hostname_length);
     DLL_EXPORT typedef void (*uws_get_headers_server_handler)(const char *header_name, size_t header_name_size, const char *header_value, size_t header_value_size);
     //Basic HTTP
     DLL_EXPORT uws_worker_t *uws_create_app(int ssl, struct us_socket_context_options_t options);
+    /* health of the loop thread, readable from any thread while it runs. Callback times cover the calls into deno,
+       idle time and lag are sampled every 100ms. With reset_max the maxima start over */
+    DLL_EXPORT void uws_loop_stats(uws_worker_t *worker, uws_loop_stats_t *dest, bool reset_max);
     DLL_EXPORT void uws_wait_app(uws_worker_t *worker);
+    /* stops accepting, lets in-flight responses finish, ends websockets with 1001 and closes connections once idle,
+       then stops the loop. What is left after timeout_ms is closed forcefully. Blocks until the loop returned and
+       returns true if nothing had to be forced. The worker serves no calls afterwards */
+    DLL_EXPORT bool uws_app_close(int ssl, uws_worker_t *worker, unsigned int timeout_ms);
+    /* fds of the listen sockets of the loop, including adopted ones, for handing them to a successor */
+    DLL_EXPORT size_t uws_app_listen_fds(uws_worker_t *worker, int *dest, size_t max);
+    /* accepts connections from an inherited listen fd, the fd is duplicated and stays owned by the caller */
+    DLL_EXPORT void uws_app_adopt_listen_fd(int ssl, uws_worker_t *worker, int fd);
+    /* sends up to 64 fds over the unix socket at path (abstract when it starts with a zero byte) and waits until the
+       receiver holds them. Returns the number sent or -1 */
+    DLL_EXPORT int uws_send_fds(const char *path, size_t path_length, const int *fds, size_t count);
+    /* listens on the unix socket at path, blocks until one uws_send_fds connected and returns the fds received or -1 */
+    DLL_EXPORT int uws_receive_fds(const char *path, size_t path_length, int *dest, size_t max);
+    DLL_EXPORT uws_pool_t *uws_create_app_pool(int ssl, unsigned int size, struct us_socket_context_options_t options);
+    DLL_EXPORT unsigned int uws_pool_size(uws_pool_t *pool);
+    DLL_EXPORT uws_worker_t *uws_pool_get_worker(uws_pool_t *pool, unsigned int index);
+    /* registers a table of routes with a single loop task. Little endian: u32 count, then count entries of
+       u32 method, u32 pattern length, u32 vary length (0xffffffff when not cached), u32 zero, u64 uws_method_handler,
+       then the pattern and vary header names of every entry in order. Returns false for a truncated table */
+    DLL_EXPORT bool uws_app_register_routes(int ssl, uws_worker_t *worker, const char *table, size_t length);
     DLL_EXPORT void uws_app_get(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler);
     DLL_EXPORT void uws_app_post(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler);
     DLL_EXPORT void uws_app_options(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler);
@@ -153,6 +231,28 @@ extern "C"
     DLL_EXPORT void uws_app_connect(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler);
     DLL_EXPORT void uws_app_trace(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler);
     DLL_EXPORT void uws_app_any(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler);
+    /* like uws_app_get and friends, responses ended with uws_res_end_cached are answered from a per loop cache keyed
+       by method, url and the comma separated vary headers until they expire. Other methods than GET and HEAD are not cached */
+    DLL_EXPORT void uws_app_cached_method(int ssl, uws_worker_t *worker, uws_method_t method, const char *pattern, const char *vary, size_t vary_length, uws_method_handler handler);
+    /* bytes kept by the response cache of the loop, 16 MiB by default. Least recently used responses are evicted first */
+    DLL_EXPORT void uws_app_response_cache_limit(uws_worker_t *worker, size_t limit);
+    /* routes and websocket behaviors registered afterwards record request counts, status classes, bytes and latency */
+    DLL_EXPORT void uws_app_metrics(uws_worker_t *worker);
+    /* GET pattern answered natively with the metrics of every app in prometheus text format */
+    DLL_EXPORT void uws_app_metrics_endpoint(int ssl, uws_worker_t *worker, const char *pattern);
+    /* json snapshot of the metrics of every app, written only when it fits. Returns its length */
+    DLL_EXPORT size_t uws_get_metrics(char *dest, size_t capacity);
+    /* headers are packed as u32 key length, key, u32 value length, value */
+    DLL_EXPORT void uws_app_static_response(int ssl, uws_worker_t *worker, uws_method_t method, const char *pattern, const char *status, size_t status_length, const char *headers, size_t headers_length, const char *body, size_t body_length);
+    /* GET and HEAD under prefix answered from memory mapped files below root */
+    DLL_EXPORT void uws_app_serve_static(int ssl, uws_worker_t *worker, const char *prefix, const char *root, const char *index, const char *cache_control, size_t cache_limit, bool precompressed);
+
+    //Batched dispatch through a shared memory ring
+    DLL_EXPORT void *uws_app_request_ring(uws_worker_t *worker, unsigned int capacity);
+    DLL_EXPORT void uws_request_ring_wait(uws_worker_t *worker);
+    DLL_EXPORT void uws_app_batched(int ssl, uws_worker_t *worker, uws_method_t method, const char *pattern, unsigned int route);
+    /* sequence is the one of the request record, answers to aborted requests are dropped */
+    UWS_SSL_SPECIALIZED(void, ring_res_end, (uws_worker_t *worker, uws_res_t *res, uint64_t sequence, const char *status, size_t status_length, const char *headers, size_t headers_length, const char *data, size_t length, bool close_connection));
 
     DLL_EXPORT void uws_app_listen(int ssl, uws_worker_t *worker, int port, uws_listen_handler handler);
     DLL_EXPORT void uws_app_listen_with_config(int ssl, uws_worker_t *worker, uws_app_listen_config_t config, uws_listen_handler handler);
@@ -161,7 +261,17 @@ extern "C"
     DLL_EXPORT void uws_app_domain(int ssl, uws_worker_t *worker, const char* server_name, size_t server_name_length);
 
     DLL_EXPORT unsigned int uws_num_subscribers(int ssl, uws_worker_t *worker, const char *topic, size_t topic_length);
+    /* aggregated over every loop of the worker's pool, must not be called from the loop threads */
+    DLL_EXPORT unsigned int uws_num_subscribers_all(int ssl, uws_worker_t *worker, const char *topic, size_t topic_length);
+    /* publishes are queued and sent by the loop after its current iteration, the bool results only mean queued.
+       Publishing on a loop of a pool reaches the subscribers of every loop */
     DLL_EXPORT bool uws_publish(int ssl, uws_worker_t *worker, const char *topic, size_t topic_length, const char *message, size_t message_length, uws_opcode_t opcode, bool compress);
+    /* ws may be null, returns the sequence to wait for when track is set */
+    DLL_EXPORT uint64_t uws_publish_enqueue(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t topic_length, const char *message, size_t message_length, uws_opcode_t opcode, bool compress, bool track);
+    /* messages are packed as u32 topic length, topic, u32 message length, message, u8 opcode, u8 compress */
+    DLL_EXPORT uint64_t uws_publish_batch(int ssl, uws_worker_t *worker, const char *messages, size_t messages_length, bool track);
+    DLL_EXPORT void uws_publish_wait(uws_worker_t *worker, uint64_t sequence);
+    DLL_EXPORT size_t uws_publish_results(uws_worker_t *worker, uint64_t sequence, uint8_t *results, size_t capacity);
     DLL_EXPORT void uws_remove_server_name(int ssl, uws_worker_t *worker, const char *hostname_pattern, size_t hostname_pattern_length);
     DLL_EXPORT void uws_add_server_name(int ssl, uws_worker_t *worker, const char *hostname_pattern, size_t hostname_pattern_length);
     DLL_EXPORT void uws_add_server_name_with_options(int ssl, uws_worker_t *worker, const char *hostname_pattern, size_t hostname_pattern_length, struct us_socket_context_options_t options);
@@ -170,50 +280,82 @@ extern "C"
 
     //WebSocket
     DLL_EXPORT void uws_ws(int ssl, uws_worker_t *worker, const char *pattern, uws_socket_behavior_t behavior);
-    DLL_EXPORT void uws_ws_close(int ssl, uws_worker_t *worker, uws_websocket_t *ws);
-    DLL_EXPORT uws_sendstatus_t uws_ws_send(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode);
-    DLL_EXPORT uws_sendstatus_t uws_ws_send_with_options(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode, bool compress, bool fin);
+    UWS_SSL_SPECIALIZED(void, ws_close, (uws_worker_t *worker, uws_websocket_t *ws));
+    UWS_SSL_SPECIALIZED(uws_sendstatus_t, ws_send, (uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode));
+    UWS_SSL_SPECIALIZED(uws_sendstatus_t, ws_send_with_options, (uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode, bool compress, bool fin));
+    /* copies and, when compress is set, deflates message once. The handle starts with one reference and is
+       freed by the last uws_ws_prepared_message_release, it may be sent to sockets of any loop */
+    DLL_EXPORT uws_prepared_message_t *uws_ws_prepare_message(const char *message, size_t length, uws_opcode_t opcode, bool compress);
+    DLL_EXPORT void uws_ws_prepared_message_retain(uws_prepared_message_t *message);
+    DLL_EXPORT void uws_ws_prepared_message_release(uws_prepared_message_t *message);
+    /* sends the deflated payload as it is to sockets which negotiated deflate without server context takeover (the
+       shared compressor), others compress it themselves or get it uncompressed, like uws_ws_send_with_options */
+    UWS_SSL_SPECIALIZED(uws_sendstatus_t, ws_send_prepared, (uws_worker_t *worker, uws_websocket_t *ws, uws_prepared_message_t *message));
+    /* sends one message to count sockets of this loop and writes the uws_sendstatus_t of each to results[i] */
+    UWS_SSL_SPECIALIZED(void, ws_send_batch, (uws_worker_t *worker, uws_websocket_t *const *sockets, size_t count, const char *message, size_t length, uws_opcode_t opcode, bool compress, uint8_t *results));
     DLL_EXPORT uws_sendstatus_t uws_ws_send_fragment(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, bool compress);
     DLL_EXPORT uws_sendstatus_t uws_ws_send_first_fragment(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, bool compress);
     DLL_EXPORT uws_sendstatus_t uws_ws_send_first_fragment_with_opcode(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode, bool compress);
     DLL_EXPORT uws_sendstatus_t uws_ws_send_last_fragment(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, bool compress);
-    DLL_EXPORT void uws_ws_end(int ssl, uws_worker_t *worker, uws_websocket_t *ws, int code, const char *message, size_t length);
-    DLL_EXPORT void uws_ws_cork(int ssl, uws_worker_t *worker, uws_websocket_t *ws, void (*handler)());
+    UWS_SSL_SPECIALIZED(void, ws_end, (uws_worker_t *worker, uws_websocket_t *ws, int code, const char *message, size_t length));
+    UWS_SSL_SPECIALIZED(void, ws_cork, (uws_worker_t *worker, uws_websocket_t *ws, void (*handler)(void *optional_data), void *optional_data));
 
-    DLL_EXPORT bool uws_ws_subscribe(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length);
-    DLL_EXPORT bool uws_ws_unsubscribe(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length);
-    DLL_EXPORT bool uws_ws_is_subscribed(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length);
-    DLL_EXPORT void uws_ws_iterate_topics(int ssl, uws_worker_t *worker, uws_websocket_t *ws, void (*callback)(const char *topic, size_t length));
+    UWS_SSL_SPECIALIZED(bool, ws_subscribe, (uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length));
+    UWS_SSL_SPECIALIZED(bool, ws_unsubscribe, (uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length));
+    UWS_SSL_SPECIALIZED(bool, ws_is_subscribed, (uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length));
+    UWS_SSL_SPECIALIZED(void, ws_iterate_topics, (uws_worker_t *worker, uws_websocket_t *ws, void (*callback)(const char *topic, size_t length, void *optional_data), void *optional_data));
     DLL_EXPORT bool uws_ws_publish(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t topic_length, const char *message, size_t message_length);
     DLL_EXPORT bool uws_ws_publish_with_options(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t topic_length, const char *message, size_t message_length, uws_opcode_t opcode, bool compress);
-    DLL_EXPORT unsigned int uws_ws_get_buffered_amount(int ssl, uws_worker_t *worker, uws_websocket_t *ws);
-    DLL_EXPORT size_t uws_ws_get_remote_address(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char **dest);
-    DLL_EXPORT size_t uws_ws_get_remote_address_as_text(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char **dest);
+    UWS_SSL_SPECIALIZED(unsigned int, ws_get_buffered_amount, (uws_worker_t *worker, uws_websocket_t *ws));
+    UWS_SSL_SPECIALIZED(size_t, ws_get_remote_address, (uws_worker_t *worker, uws_websocket_t *ws, const char **dest));
+    UWS_SSL_SPECIALIZED(size_t, ws_get_remote_address_as_text, (uws_worker_t *worker, uws_websocket_t *ws, const char **dest));
 
     //Response
-    DLL_EXPORT void uws_res_end(int ssl, uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, bool close_connection);
-    DLL_EXPORT uws_try_end_result_t uws_res_try_end(int ssl, uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, uintmax_t total_size, bool close_connection);
-    DLL_EXPORT void uws_res_cork(int ssl, uws_worker_t *worker, uws_res_t *res, void(*callback)(uws_res_t *res));
-    DLL_EXPORT void uws_res_pause(int ssl, uws_worker_t *worker, uws_res_t *res);
-    DLL_EXPORT void uws_res_resume(int ssl, uws_worker_t *worker, uws_res_t *res);
-    DLL_EXPORT void uws_res_write_continue(int ssl, uws_worker_t *worker, uws_res_t *res);
-    DLL_EXPORT void uws_res_write_status(int ssl, uws_worker_t *worker, uws_res_t *res, const char *status, size_t length);
-    DLL_EXPORT void uws_res_write_header(int ssl, uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, const char *value, size_t value_length);
-
-    DLL_EXPORT void uws_res_write_header_int(int ssl, uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, uint64_t value);
-    DLL_EXPORT void uws_res_end_without_body(int ssl, uws_worker_t *worker, uws_res_t *res, bool close_connection);
-    DLL_EXPORT bool uws_res_write(int ssl, uws_worker_t *worker, uws_res_t *res, const char *data, size_t length);
-    DLL_EXPORT uintmax_t uws_res_get_write_offset(int ssl, uws_worker_t *worker, uws_res_t *res);
-    DLL_EXPORT void uws_res_override_write_offset(int ssl, uws_worker_t *worker, uws_res_t *res, uintmax_t offset);
-    DLL_EXPORT bool uws_res_has_responded(int ssl, uws_worker_t *worker, uws_res_t *res);
-    DLL_EXPORT void uws_res_on_writable(int ssl, uws_worker_t *worker, uws_res_t *res, bool (*handler)(uws_res_t *res, uintmax_t));
-    DLL_EXPORT void uws_res_on_aborted(int ssl, uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res));
-    DLL_EXPORT void uws_res_on_data(int ssl, uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res, const char *chunk, size_t chunk_length, bool is_end));
-    DLL_EXPORT void uws_res_upgrade(int ssl, uws_worker_t *worker, uws_res_t *res, void *data, const char *sec_web_socket_key, size_t sec_web_socket_key_length, const char *sec_web_socket_protocol, size_t sec_web_socket_protocol_length, const char *sec_web_socket_extensions, size_t sec_web_socket_extensions_length, uws_socket_context_t *ws);
-    DLL_EXPORT size_t uws_res_get_remote_address(int ssl, uws_worker_t *worker, uws_res_t *res, const char **dest);
-    DLL_EXPORT size_t uws_res_get_remote_address_as_text(int ssl, uws_worker_t *worker, uws_res_t *res, const char **dest);
-    DLL_EXPORT size_t uws_res_get_proxied_remote_address(int ssl, uws_worker_t *worker, uws_res_t *res, const char **dest);
-    DLL_EXPORT size_t uws_res_get_proxied_remote_address_as_text(int ssl, uws_worker_t *worker, uws_res_t *res, const char **dest);
+    UWS_SSL_SPECIALIZED(void, res_end, (uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, bool close_connection));
+    /* prepared blocks are kept for the lifetime of the process, ids start at 1 and 0 means the registry is full.
+       Headers are packed as u32 key length, key, u32 value length, value */
+    DLL_EXPORT unsigned int uws_prepare_headers(const char *status, size_t status_length, const char *headers, size_t headers_length);
+    DLL_EXPORT unsigned int uws_prepare_body(const char *body, size_t body_length);
+    /* body is used when body_id is 0 */
+    UWS_SSL_SPECIALIZED(void, res_end_prepared, (uws_worker_t *worker, uws_res_t *res, unsigned int headers_id, unsigned int body_id, const char *body, size_t body_length, bool close_connection));
+    /* ends without copying data, returns true when it was written right away. Otherwise data must stay valid until
+       release is called from the loop, once the response finished or was aborted */
+    UWS_SSL_SPECIALIZED(bool, res_end_owned, (uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, bool close_connection, void (*release)(const char *data)));
+    /* ends with length bytes read from fd at offset (sequentially when fd is a pipe, which is made non blocking and
+       polled), backpressure is handled on the loop. aborted takes the place of the onAborted handler, handler is called
+       once the response finished or was aborted, completed is false when it was aborted or a read failed */
+    UWS_SSL_SPECIALIZED(void, res_stream_fd, (uws_worker_t *worker, uws_res_t *res, int fd, uint64_t offset, uint64_t length, bool close_fd, void (*handler)(uws_res_t *res, bool completed, void *optional_data), void (*aborted)(uws_res_t *res, void *optional_data), void *optional_data));
+    /* ends the response of a cached route and caches it for ttl milliseconds, not at all when ttl is 0.
+       status and headers are the ones written before, packed like for uws_app_static_response */
+    UWS_SSL_SPECIALIZED(void, res_end_cached, (uws_worker_t *worker, uws_res_t *res, unsigned int ttl, const char *status, size_t status_length, const char *headers, size_t headers_length, const char *body, size_t body_length, bool close_connection));
+    /* ends with the body compressed using the best of encodings accepted by accept_encoding, bodies shorter than
+       min_length are sent as they are. Vary: Accept-Encoding is always added */
+    UWS_SSL_SPECIALIZED(void, res_end_compressed, (uws_worker_t *worker, uws_res_t *res, const char *accept_encoding, size_t accept_encoding_length, unsigned int encodings, size_t min_length, const char *data, size_t length, bool close_connection));
+    UWS_SSL_SPECIALIZED(uws_try_end_result_t, res_try_end, (uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, uintmax_t total_size, bool close_connection));
+    UWS_SSL_SPECIALIZED(void, res_cork, (uws_worker_t *worker, uws_res_t *res, void(*callback)(uws_res_t *res, void *optional_data), void *optional_data));
+    UWS_SSL_SPECIALIZED(void, res_pause, (uws_worker_t *worker, uws_res_t *res));
+    UWS_SSL_SPECIALIZED(void, res_resume, (uws_worker_t *worker, uws_res_t *res));
+    UWS_SSL_SPECIALIZED(void, res_write_continue, (uws_worker_t *worker, uws_res_t *res));
+    UWS_SSL_SPECIALIZED(void, res_write_status, (uws_worker_t *worker, uws_res_t *res, const char *status, size_t length));
+    UWS_SSL_SPECIALIZED(void, res_write_header, (uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, const char *value, size_t value_length));
+
+    UWS_SSL_SPECIALIZED(void, res_write_header_int, (uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, uint64_t value));
+    UWS_SSL_SPECIALIZED(void, res_end_without_body, (uws_worker_t *worker, uws_res_t *res, bool close_connection));
+    UWS_SSL_SPECIALIZED(bool, res_write, (uws_worker_t *worker, uws_res_t *res, const char *data, size_t length));
+    UWS_SSL_SPECIALIZED(uintmax_t, res_get_write_offset, (uws_worker_t *worker, uws_res_t *res));
+    UWS_SSL_SPECIALIZED(void, res_override_write_offset, (uws_worker_t *worker, uws_res_t *res, uintmax_t offset));
+    UWS_SSL_SPECIALIZED(bool, res_has_responded, (uws_worker_t *worker, uws_res_t *res));
+    UWS_SSL_SPECIALIZED(void, res_on_writable, (uws_worker_t *worker, uws_res_t *res, bool (*handler)(uws_res_t *res, uintmax_t, void *optional_data), void *optional_data));
+    UWS_SSL_SPECIALIZED(void, res_on_aborted, (uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res, void *optional_data), void *optional_data));
+    UWS_SSL_SPECIALIZED(void, res_on_data, (uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res, const char *chunk, size_t chunk_length, bool is_end, void *optional_data), void *optional_data));
+    /* must be called from the request handler, expected_length reserves the buffer. The handler is called once with the whole
+       body, or with ok false after a 413 was answered. aborted is installed as the abort handler */
+    UWS_SSL_SPECIALIZED(void, res_collect_body, (uws_worker_t *worker, uws_res_t *res, size_t max_length, size_t expected_length, void (*handler)(uws_res_t *res, const char *body, size_t length, bool ok, void *optional_data), void (*aborted)(uws_res_t *res, void *optional_data), void *optional_data));
+    UWS_SSL_SPECIALIZED(void, res_upgrade, (uws_worker_t *worker, uws_res_t *res, void *data, const char *sec_web_socket_key, size_t sec_web_socket_key_length, const char *sec_web_socket_protocol, size_t sec_web_socket_protocol_length, const char *sec_web_socket_extensions, size_t sec_web_socket_extensions_length, uws_socket_context_t *ws));
+    UWS_SSL_SPECIALIZED(size_t, res_get_remote_address, (uws_worker_t *worker, uws_res_t *res, const char **dest));
+    UWS_SSL_SPECIALIZED(size_t, res_get_remote_address_as_text, (uws_worker_t *worker, uws_res_t *res, const char **dest));
+    UWS_SSL_SPECIALIZED(size_t, res_get_proxied_remote_address, (uws_worker_t *worker, uws_res_t *res, const char **dest));
+    UWS_SSL_SPECIALIZED(size_t, res_get_proxied_remote_address_as_text, (uws_worker_t *worker, uws_res_t *res, const char **dest));
     DLL_EXPORT void *uws_res_get_native_handle(int ssl, uws_worker_t *worker, uws_res_t *res);
 
     //Request
@@ -0,0 +1,17 @@
+import { App, HttpMethod } from '../mod.ts';
+
+const port = 9001;
+
+// requests are drained from a shared memory ring in batches instead of one native callback per request
+App().batched(HttpMethod.GET, '/user/:id', (res, req) => {
+    const id = req.getParameter(0);
+    setTimeout(() => {
+        res.writeHeader('content-type', 'application/json').end(JSON.stringify({ id }));
+    }, 10);
+}).listen(port, (token) => {
+    if (token) {
+        console.log('Listening to port ' + port);
+    } else {
+        console.log('Failed to listen to port ' + port);
+    }
+});
@@ -0,0 +1,12 @@
+import { AppPool } from '../mod.ts';
+
+const port = 9001;
+
+// one native loop and one Deno Worker per core, routes are declared in pool_routes.ts
+AppPool(navigator.hardwareConcurrency, new URL('./pool_routes.ts', import.meta.url)).listen(port, (token) => {
+    if (token) {
+        console.log('Listening to port ' + port);
+    } else {
+        console.log('Failed to listen to port ' + port);
+    }
+});
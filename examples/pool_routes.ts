@@ -0,0 +1,7 @@
+import type { TemplatedApp } from '../mod.ts';
+
+export default function (app: TemplatedApp, index: number) {
+    app.any('*', (res) => {
+        res.end('Hello world from deno uws loop ' + index + '!');
+    });
+}
@@ -0,0 +1,35 @@
+import { App, receiveListenSockets } from '../mod.ts';
+
+const port = 9001;
+const handoffPath = '/tmp/denouws-restart.sock';
+
+// Zero downtime restart: start the new version with --successor while the old one runs. It waits for the listen
+// socket of the old one, which hands it over on SIGHUP and drains, so no connection is refused in between.
+const app = App().get('/*', (res) => {
+    res.end('Hello from ' + Deno.pid);
+});
+
+if (Deno.args.includes('--successor')) {
+    const fds = await receiveListenSockets(handoffPath);
+    app.adoptListenSockets(fds);
+    console.log('Took over ' + fds.length + ' listen sockets');
+} else {
+    app.listen(port, (token) => {
+        if (token) {
+            console.log('Listening to port ' + port);
+        } else {
+            console.log('Failed to listen to port ' + port);
+        }
+    });
+}
+
+Deno.addSignalListener('SIGHUP', async () => {
+    await app.handoff(handoffPath);
+    console.log('Drained gracefully: ' + await app.drain(10000));
+    Deno.exit(0);
+});
+
+Deno.addSignalListener('SIGTERM', async () => {
+    console.log('Drained gracefully: ' + await app.drain(10000));
+    Deno.exit(0);
+});
@@ -0,0 +1,16 @@
+import { App, HttpMethod } from '../mod.ts';
+
+const port = 9001;
+
+// answered by the native loop, no round trip into deno
+App()
+    .staticRoute(HttpMethod.GET, '/health', '200 OK', { 'content-type': 'text/plain' }, 'ok')
+    .serveStatic('/assets', './public', { cacheControl: 'public, max-age=3600' })
+    .staticRoute(HttpMethod.GET, '/robots.txt', '200 OK', { 'content-type': 'text/plain' }, 'User-agent: *\nDisallow:\n')
+    .listen(port, (token) => {
+        if (token) {
+            console.log('Listening to port ' + port);
+        } else {
+            console.log('Failed to listen to port ' + port);
+        }
+    });
@@ -1 +1 @@
-export * from "./src/app.ts";
\ No newline at end of file
+export * from './src/app.ts';
@@ -1,18 +1,68 @@
 // deno-lint-ignore-file no-explicit-any
-import ffi from './ffi.ts';
+import ffi, { specializations, type Specialized } from './ffi.ts';
 
 import { Struct } from "https://deno.land/x/struct@1.0.0/mod.ts";
 
 const encoder = new TextEncoder();
 const decoder = new TextDecoder("utf-8");
 
+/** Binary data is viewed in place, not copied. */
 function encode(data: RecognizedString): Uint8Array {
   if (typeof data === "string") {
     return encoder.encode(data);
   }
+  if (ArrayBuffer.isView(data)) {
+    return new Uint8Array(data.buffer, data.byteOffset, data.byteLength);
+  }
   return new Uint8Array(data);
 }
 
+// strings passed to calls which copy them before returning are encoded here, the arena is reset by a microtask
+const SCRATCH_SIZE = 64 * 1024;
+let scratch = new Uint8Array(SCRATCH_SIZE);
+let scratchOffset = 0;
+let scratchResetQueued = false;
+
+function resetScratch() {
+  scratchOffset = 0;
+  scratchResetQueued = false;
+}
+
+/** Like encode, but the returned bytes are only valid until the current task yields. */
+function encodeTransient(data: RecognizedString): Uint8Array {
+  if (typeof data !== "string") {
+    return encode(data);
+  }
+  const maxLength = data.length * 3;
+  if (maxLength > SCRATCH_SIZE / 4) {
+    return encoder.encode(data);
+  }
+  if (scratchOffset + maxLength > scratch.length) {
+    // views handed out since the last reset may still be in use
+    scratch = new Uint8Array(SCRATCH_SIZE);
+    scratchOffset = 0;
+  }
+  const { written } = encoder.encodeInto(data, scratch.subarray(scratchOffset));
+  const view = scratch.subarray(scratchOffset, scratchOffset + written!);
+  scratchOffset += written!;
+  if (!scratchResetQueued) {
+    scratchResetQueued = true;
+    queueMicrotask(resetScratch);
+  }
+  return view;
+}
+
+// buffers read by nonblocking calls, the pointer alone does not keep them from being collected
+const readByPendingCalls = new Set<ArrayBufferView>();
+
+/** Keeps buffers referenced until the nonblocking call reading them settled. */
+function keepAlive<T>(call: Promise<T>, ...buffers: ArrayBufferView[]): Promise<T> {
+  for (const buffer of buffers) readByPendingCalls.add(buffer);
+  return call.finally(() => {
+    for (const buffer of buffers) readByPendingCalls.delete(buffer);
+  });
+}
+
 function getBuffer(pointer: Deno.PointerValue, length: Deno.PointerValue): ArrayBuffer {
   const view = new Deno.UnsafePointerView(pointer);
   const buf = view.getArrayBuffer(length as number);
@@ -69,25 +119,35 @@ interface AppOptions {
 const {
   uws_create_app,
   uws_wait_app,
+  uws_app_close,
+  uws_app_listen_fds,
+  uws_app_adopt_listen_fd,
+  uws_send_fds,
+  uws_receive_fds,
+  uws_create_app_pool,
+  uws_pool_size,
+  uws_pool_get_worker,
 
   uws_app_listen,
   uws_app_listen_with_config,
   uws_listen_handler,
 
-  uws_app_get,
-  uws_app_post,
-  uws_app_options,
-  uws_app_delete,
-  uws_app_patch,
-  uws_app_put,
-  uws_app_head,
-  uws_app_connect,
-  uws_app_trace,
-  uws_app_any,
+  uws_app_register_routes,
   uws_method_handler,
 
+  uws_app_static_response,
+  uws_app_serve_static,
+  uws_app_request_ring,
+  uws_request_ring_wait,
+  uws_app_batched,
+
   uws_publish,
+  uws_publish_enqueue,
+  uws_publish_batch,
+  uws_publish_wait,
+  uws_publish_results,
   uws_num_subscribers,
+  uws_num_subscribers_all,
   uws_add_server_name,
   uws_remove_server_name,
   uws_add_server_name_with_options,
@@ -95,42 +155,24 @@ const {
   uws_missing_server_name,
   uws_missing_server_handler,
 
-  uws_res_pause,
-  uws_res_resume,
-  uws_res_write_status,
-  uws_res_write_header,
-  uws_res_write,
-  uws_res_end,
-  uws_res_end_without_body,
-  uws_res_try_end,
-  uws_res_get_write_offset,
-
-  uws_res_on_writable,
+  uws_prepare_headers,
+  uws_prepare_body,
+
   uws_res_on_writable_handler,
-  uws_res_on_aborted,
   uws_res_on_aborted_handler,
-  uws_res_on_data,
+  uws_res_release_handler,
+  uws_app_response_cache_limit,
+  uws_app_metrics,
+  uws_app_metrics_endpoint,
+  uws_get_metrics,
+  uws_loop_stats,
+  uws_res_streamed_handler,
   uws_res_on_data_handler,
+  uws_res_collect_body_handler,
 
-  uws_res_get_remote_address,
-  uws_res_get_remote_address_as_text,
-  uws_res_get_proxied_remote_address,
-  uws_res_get_proxied_remote_address_as_text,
   
-  uws_res_cork,
   uws_res_cork_callback,
 
-  uws_res_upgrade,
-
-  uws_req_get_header,
-  uws_req_get_parameter,
-  uws_req_get_url,
-  uws_req_get_method,
-  uws_req_get_case_sensitive_method,
-
-  uws_req_get_query,
-  uws_req_for_each_header,
-  uws_get_headers_server_handler,
   uws_req_set_field,
 
   uws_websocket_upgrade_handler,
@@ -139,23 +181,14 @@ const {
   uws_websocket_ping_pong_handler,
   uws_websocket_close_handler,
   uws_websocket_subscription_handler,
+  uws_websocket_message_batch_handler,
 
   uws_ws,
-  uws_ws_send,
-  uws_ws_send_with_options,
-  uws_ws_get_buffered_amount,
-  uws_ws_end,
-  uws_ws_close,
-  uws_ws_subscribe,
-  uws_ws_unsubscribe,
-  uws_ws_is_subscribed,
-  uws_ws_iterate_topics,
   uws_ws_iterate_topics_handler,
   uws_ws_publish_with_options,
-  uws_ws_cork,
+  uws_ws_prepare_message,
+  uws_ws_prepared_message_release,
   uws_ws_cork_callback,
-  uws_ws_get_remote_address,
-  uws_ws_get_remote_address_as_text,
 } = ffi;
 
 
@@ -189,6 +222,158 @@ function unpack_uws_try_end_result(buffer: Uint8Array): [boolean, boolean] {
   return [!!buffer[0], !!buffer[1]];
 }
 
+const HANDLE_INDEX_BITS = 20;
+const HANDLE_INDEX_MASK = (1 << HANDLE_INDEX_BITS) - 1;
+
+/** Maps small integer handles, passed to the binding as optional_data, back to JS values for static callbacks.
+ * A handle packs the slot index with the slot generation, so a stale handle arriving after its slot was reused resolves to undefined.
+ * optional_data is a pointer parameter, handles cross it as the pointer whose address is the handle, see handlePointer.
+ */
+class HandleTable<T> {
+  #values: (T | undefined)[] = [];
+  #generations: number[] = [];
+  #free: number[] = [];
+
+  add(value: T): number {
+    let index = this.#free.pop();
+    if (index === undefined) {
+      index = this.#values.length;
+      this.#values.push(undefined);
+      this.#generations.push(1);
+    }
+    this.#values[index] = value;
+    return this.#generations[index] * (HANDLE_INDEX_MASK + 1) + index;
+  }
+
+  get(pointer: Deno.PointerValue): T | undefined {
+    const value = Number(Deno.UnsafePointer.value(pointer));
+    const index = value & HANDLE_INDEX_MASK;
+    return this.#generations[index] === Math.floor(value / (HANDLE_INDEX_MASK + 1)) ? this.#values[index] : undefined;
+  }
+
+  remove(handle: number): void {
+    const index = handle & HANDLE_INDEX_MASK;
+    if (this.#generations[index] !== Math.floor(handle / (HANDLE_INDEX_MASK + 1))) return;
+    this.#values[index] = undefined;
+    this.#generations[index] = this.#generations[index] % 0x7fffffff + 1;
+    this.#free.push(index);
+  }
+}
+
+/** Returns the optional_data pointer carrying handle, handles are never 0 as generations start at 1. */
+function handlePointer(handle: number): Deno.PointerValue {
+  return Deno.UnsafePointer.create(BigInt(handle));
+}
+
+// callbacks of synchronous calls such as cork and getTopics, registered for the duration of the call
+const callbacks = new HandleTable<(...args: any[]) => any>();
+
+function withCallback<R>(cb: (...args: any[]) => any, call: (handle: Deno.PointerValue) => R): R {
+  const handle = callbacks.add(cb);
+  try {
+    return call(handlePointer(handle));
+  } finally {
+    callbacks.remove(handle);
+  }
+}
+
+const wsCorkTrampoline = uws_ws_cork_callback((handle) => callbacks.get(handle)?.());
+const wsTopicsTrampoline = uws_ws_iterate_topics_handler((topic, length, handle) => callbacks.get(handle)?.(topic, length));
+const resCorkTrampoline = uws_res_cork_callback((_res, handle) => callbacks.get(handle)?.());
+
+/** Resolves tracked publishes of one loop, keeping a single nonblocking wait in flight.
+ * Sequences enqueued from this thread are drained in order, so the latest one finishing implies all earlier did.
+ */
+class PublishResults {
+  #workerHandler: Deno.PointerValue;
+  #pending = new Map<number, { count: number, resolve: (results: boolean[]) => void }>();
+  #latest = 0;
+  #waiting = false;
+
+  constructor(workerHandler: Deno.PointerValue) {
+    this.#workerHandler = workerHandler;
+  }
+
+  track(sequence: number | bigint, count: number): Promise<boolean[]> {
+    return new Promise((resolve) => {
+      this.#latest = Number(sequence);
+      this.#pending.set(this.#latest, { count, resolve });
+      if (!this.#waiting) this.#wait();
+    });
+  }
+
+  async #wait() {
+    this.#waiting = true;
+    while (this.#pending.size) {
+      const latest = this.#latest;
+      await uws_publish_wait(this.#workerHandler, latest);
+      for (const [sequence, { count, resolve }] of this.#pending) {
+        if (sequence > latest) break;
+        const results = new Uint8Array(count);
+        uws_publish_results(this.#workerHandler, sequence, Deno.UnsafePointer.of(results), count);
+        this.#pending.delete(sequence);
+        resolve(Array.from(results, Boolean));
+      }
+    }
+    this.#waiting = false;
+  }
+}
+
+const publishResults = new Map<Deno.PointerValue, PublishResults>();
+
+function trackPublish(workerHandler: Deno.PointerValue, sequence: number | bigint, count: number): Promise<boolean[]> {
+  let results = publishResults.get(workerHandler);
+  if (!results) {
+    results = new PublishResults(workerHandler);
+    publishResults.set(workerHandler, results);
+  }
+  return results.track(sequence, count);
+}
+
+function publishAsync(ssl: number, workerHandler: Deno.PointerValue, wsHandler: Deno.PointerValue, topic: string, message: RecognizedString, isBinary?: boolean, compress?: boolean): Promise<boolean> {
+  const topicBuffer = encodeTransient(topic);
+  const messageBuffer = encodeTransient(message);
+  const sequence = uws_publish_enqueue(
+    ssl, workerHandler, wsHandler,
+    Deno.UnsafePointer.of(topicBuffer), topicBuffer.length,
+    Deno.UnsafePointer.of(messageBuffer), messageBuffer.length,
+    isBinary ? OpCode.BINARY : OpCode.TEXT, +!!compress, 1);
+  return trackPublish(workerHandler, sequence, 1).then((results) => results[0]);
+}
+
+/** A message of TemplatedApp.publishBatch. */
+export interface PublishMessage {
+  topic: string;
+  message: RecognizedString;
+  isBinary?: boolean;
+  compress?: boolean;
+}
+
+/** Packs messages as u32 topic length, topic, u32 message length, message, u8 opcode, u8 compress. */
+function packPublishBatch(messages: PublishMessage[]): Uint8Array {
+  const parts = messages.map(({ topic, message }) => [encoder.encode(topic), encode(message)]);
+  let length = 0;
+  for (const [topic, message] of parts) {
+    length += 10 + topic.length + message.length;
+  }
+  const packed = new Uint8Array(length);
+  const view = new DataView(packed.buffer);
+  let offset = 0;
+  for (let i = 0; i < parts.length; i++) {
+    const [topic, message] = parts[i];
+    view.setUint32(offset, topic.length, true);
+    packed.set(topic, offset + 4);
+    offset += 4 + topic.length;
+    view.setUint32(offset, message.length, true);
+    packed.set(message, offset + 4);
+    offset += 4 + message.length;
+    packed[offset] = messages[i].isBinary ? OpCode.BINARY : OpCode.TEXT;
+    packed[offset + 1] = +!!messages[i].compress;
+    offset += 2;
+  }
+  return packed;
+}
+
 /** Recognized string types, things C++ can read and understand as strings.
  * "String" does not have to mean "text", it can also be "binary".
  *
@@ -208,12 +393,12 @@ export enum SendStatus {
 }
 
 class _WebSocket<UserData> {
-  #ssl: number;
+  #native: Specialized;
   #workerHandler: Deno.PointerValue;
   #wsHandler: Deno.PointerValue;
 
-  constructor(ssl: number, workerHandler: Deno.PointerValue, wsHandler: Deno.PointerValue) {
-    this.#ssl = ssl;
+  constructor(native: Specialized, workerHandler: Deno.PointerValue, wsHandler: Deno.PointerValue) {
+    this.#native = native;
     this.#workerHandler = workerHandler;
     this.#wsHandler = wsHandler;
   }
@@ -223,17 +408,29 @@ class _WebSocket<UserData> {
    * Make sure you properly understand the concept of backpressure. Check the backpressure example file.
    */
   send(message: RecognizedString, isBinary?: boolean, compress?: boolean): SendStatus {
-    const data = encode(message);
-    return uws_ws_send_with_options(
-      this.#ssl, this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(data), data.length,
+    const data = encodeTransient(message);
+    return this.#native.ws_send_with_options(
+      this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(data), data.length,
       isBinary ? OpCode.BINARY : OpCode.TEXT, +!!compress, 1);
   }
 
+  /** Sends a message made by prepareMessage. Returns the same as send. Sockets using the shared compressor get the
+   * payload deflated by prepareMessage instead of compressing it again, dedicated compressors still compress per socket.
+   */
+  sendPrepared(message: PreparedMessage): SendStatus {
+    return this.#native.ws_send_prepared(this.#workerHandler, this.#wsHandler, message._handle());
+  }
+
+  /** Internal, the native socket passed to ws_send_batch. */
+  _handle(): Deno.PointerValue {
+    return this.#wsHandler;
+  }
+
   /** Returns the bytes buffered in backpressure. This is similar to the bufferedAmount property in the browser counterpart.
    * Check backpressure example.
    */
   getBufferedAmount(): number {
-    return uws_ws_get_buffered_amount(this.#ssl, this.#workerHandler, this.#wsHandler);
+    return this.#native.ws_get_buffered_amount(this.#workerHandler, this.#wsHandler);
   }
 
   /** Gracefully closes this WebSocket. Immediately calls the close handler.
@@ -241,10 +438,10 @@ class _WebSocket<UserData> {
    */
   end(code?: number, shortMessage?: RecognizedString): void {
     if (shortMessage) {
-      const data = encode(shortMessage);
-      uws_ws_end(this.#ssl, this.#workerHandler, this.#wsHandler, code ?? 0, Deno.UnsafePointer.of(data), data.length);
+      const data = encodeTransient(shortMessage);
+      this.#native.ws_end(this.#workerHandler, this.#wsHandler, code ?? 0, Deno.UnsafePointer.of(data), data.length);
     } else {
-      uws_ws_end(this.#ssl, this.#workerHandler, this.#wsHandler, code ?? 0, null, 0);
+      this.#native.ws_end(this.#workerHandler, this.#wsHandler, code ?? 0, null, 0);
     }
   }
 
@@ -252,61 +449,66 @@ class _WebSocket<UserData> {
    * No WebSocket close message is sent.
    */
   close(): void {
-    uws_ws_close(this.#ssl, this.#workerHandler, this.#wsHandler);
+    this.#native.ws_close(this.#workerHandler, this.#wsHandler);
   }
 
   /** Sends a ping control message. Returns sendStatus similar to WebSocket.send (regarding backpressure). This helper function correlates to WebSocket::send(message, uWS::OpCode::PING, ...) in C++. */
   ping(message?: RecognizedString): number {
     if (message) {
-      const data = encode(message);
-      return uws_ws_send(this.#ssl, this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(data), data.length, OpCode.PING);
+      const data = encodeTransient(message);
+      return this.#native.ws_send(this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(data), data.length, OpCode.PING);
     }
-    return uws_ws_send(this.#ssl, this.#workerHandler, this.#wsHandler, null, 0, OpCode.PING);
+    return this.#native.ws_send(this.#workerHandler, this.#wsHandler, null, 0, OpCode.PING);
   }
 
   /** Subscribe to a topic. */
   subscribe(topic: string): boolean {
-    const data = encode(topic);
-    return !!uws_ws_subscribe(this.#ssl, this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(data), data.length);
+    const data = encodeTransient(topic);
+    return !!this.#native.ws_subscribe(this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(data), data.length);
   }
 
   /** Unsubscribe from a topic. Returns true on success, if the WebSocket was subscribed. */
   unsubscribe(topic: string): boolean {
-    const data = encode(topic);
-    return !!uws_ws_unsubscribe(this.#ssl, this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(data), data.length);
+    const data = encodeTransient(topic);
+    return !!this.#native.ws_unsubscribe(this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(data), data.length);
   }
 
   /** Returns whether this websocket is subscribed to topic. */
   isSubscribed(topic: string): boolean {
-    const data = encode(topic);
-    return !!uws_ws_is_subscribed(this.#ssl, this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(data), data.length);
+    const data = encodeTransient(topic);
+    return !!this.#native.ws_is_subscribed(this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(data), data.length);
   }
 
   /** Returns a list of topics this websocket is subscribed to. */
   getTopics(): string[] {
     const result: string[] = [];
-    const handler = uws_ws_iterate_topics_handler((topicPtr, length) => {
+    withCallback((topicPtr: Deno.PointerValue, length: Deno.PointerValue) => {
       result.push(getStringFromPointer(topicPtr, length));
-    });
-    uws_ws_iterate_topics(this.#ssl, this.#workerHandler, this.#wsHandler, handler.pointer);
+    }, (handle) => this.#native.ws_iterate_topics(this.#workerHandler, this.#wsHandler, wsTopicsTrampoline.pointer, handle));
     return result;
   }
 
   /** Publish a message under topic. Backpressure is managed according to maxBackpressure, closeOnBackpressureLimit settings.
    * Order is guaranteed since v20.
+   * The message is queued and sent by the loop after its current iteration, returns true once queued. See publishAsync.
   */
   publish(topic: string, message: RecognizedString, isBinary?: boolean, compress?: boolean): boolean {
-    const topicBuffer = encode(topic);
-    const messageBuffer = encode(message);
+    const topicBuffer = encodeTransient(topic);
+    const messageBuffer = encodeTransient(message);
     return !!uws_ws_publish_with_options(
-      this.#ssl, this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(topicBuffer), topicBuffer.length,
+      this.#native.ssl, this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(topicBuffer), topicBuffer.length,
       Deno.UnsafePointer.of(messageBuffer), messageBuffer.length, isBinary ? OpCode.BINARY : OpCode.TEXT, +!!compress
     );
   }
+  /** Like publish, resolving with whether the message was published once the loop sent it. */
+  publishAsync(topic: string, message: RecognizedString, isBinary?: boolean, compress?: boolean): Promise<boolean> {
+    return publishAsync(this.#native.ssl, this.#workerHandler, this.#wsHandler, topic, message, isBinary, compress);
+  }
+
 
   /** See HttpResponse.cork. Takes a function in which the socket is corked (packing many sends into one single syscall/SSL block) */
   cork(cb: () => void): WebSocket<UserData> {
-    uws_ws_cork(this.#ssl, this.#workerHandler, this.#wsHandler, uws_ws_cork_callback(cb).pointer);
+    withCallback(cb, (handle) => this.#native.ws_cork(this.#workerHandler, this.#wsHandler, wsCorkTrampoline.pointer, handle));
     // @ts-ignore: this is actually Websocket<UserData>
     return this;
   }
@@ -320,22 +522,101 @@ class _WebSocket<UserData> {
    */
   getRemoteAddress(): ArrayBuffer {
     const dest = new Uint8Array(16);
-    const length = uws_ws_get_remote_address(this.#ssl, this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(dest));
+    const length = this.#native.ws_get_remote_address(this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(dest));
     return dest.slice(0, length as number);
   }
 
   /** Returns the remote IP address as text. See string. */
   getRemoteAddressAsText(): ArrayBuffer {
     const dest = new Uint8Array(45); // maximum ipv6 length as text
-    const length = uws_ws_get_remote_address_as_text(this.#ssl, this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(dest));
+    const length = this.#native.ws_get_remote_address_as_text(this.#workerHandler, this.#wsHandler, Deno.UnsafePointer.of(dest));
     return dest.slice(0, length as number);
   }
 }
 
+const preparedMessages = new FinalizationRegistry<Deno.PointerValue>((handle) => uws_ws_prepared_message_release(handle));
+
+/** A message compressed once, see prepareMessage. */
+export class PreparedMessage {
+  #handle: Deno.PointerValue;
+
+  constructor(handle: Deno.PointerValue) {
+    this.#handle = handle;
+    preparedMessages.register(this, handle, this);
+  }
+
+  /** Internal, the native handle passed to ws_send_prepared. */
+  _handle(): Deno.PointerValue {
+    if (!this.#handle) throw new Error("PreparedMessage used after release");
+    return this.#handle;
+  }
+
+  /** Frees the native message now instead of when this object is collected. */
+  release(): void {
+    if (!this.#handle) return;
+    preparedMessages.unregister(this);
+    uws_ws_prepared_message_release(this.#handle);
+    this.#handle = null;
+  }
+}
+
+/** Copies message and, with compress, deflates it once for sending to any number of sockets with
+ * WebSocket.sendPrepared, on any loop. Sending it to 50k sockets of SHARED_COMPRESSOR routes costs one compression
+ * instead of 50k.
+ */
+export function prepareMessage(message: RecognizedString, isBinary?: boolean, compress?: boolean): PreparedMessage {
+  const data = encodeTransient(message);
+  return new PreparedMessage(uws_ws_prepare_message(Deno.UnsafePointer.of(data), data.length, isBinary ? OpCode.BINARY : OpCode.TEXT, +!!compress));
+}
+
 type WebSocket<T> = _WebSocket<T> & T;
 const WebSocket = _WebSocket;
 
-/** An HttpResponse is valid until either onAborted callback or any of the .end/.tryEnd calls succeed. You may attach user data to this object. */
+// bodies of endOwned still being written, keyed by their address
+const ownedBodies = new Map<bigint, { body: Uint8Array, references: number }>();
+let releaseOwned: ReturnType<typeof uws_res_release_handler> | undefined;
+
+function getReleaseOwned(): Deno.PointerValue {
+  if (!releaseOwned) {
+    releaseOwned = uws_res_release_handler((pointer) => {
+      // a new pointer object per call, only the address matches the one endOwned stored
+      const address = BigInt(Deno.UnsafePointer.value(pointer));
+      const owned = ownedBodies.get(address);
+      if (owned && !--owned.references) {
+        ownedBodies.delete(address);
+      }
+    });
+  }
+  return releaseOwned.pointer;
+}
+
+/** Serializes a status line and headers once in native memory. The returned id is valid for the lifetime of the process,
+ * on every loop, and is written with HttpResponse.endPrepared.
+ */
+export function prepareHeaders(status: string, headers: Record<string, string> = {}): number {
+  const statusBuffer = encoder.encode(status);
+  const headersBuffer = packHeaders(Object.entries(headers).flat().map((part) => encoder.encode(part)));
+  const id = uws_prepare_headers(Deno.UnsafePointer.of(statusBuffer), statusBuffer.length, Deno.UnsafePointer.of(headersBuffer), headersBuffer.length);
+  if (!id) throw new Error("Too many prepared header blocks");
+  return id;
+}
+
+/** Copies an immutable body into native memory once. The returned id is valid for the lifetime of the process,
+ * on every loop, and is written with HttpResponse.endPrepared.
+ */
+export function prepareBody(body: RecognizedString): number {
+  const data = encode(body);
+  const id = uws_prepare_body(Deno.UnsafePointer.of(data), data.length);
+  if (!id) throw new Error("Too many prepared bodies");
+  return id;
+}
+
+const RESPONSE_POOL_SIZE = 1024;
+const REQUEST_POOL_SIZE = 64;
+
+/** An HttpResponse is valid until either onAborted callback or any of the .end/.tryEnd calls succeed. You may attach user data to this object.
+ * A response ended inside its handler, without handlers or user data attached, is reused for later requests.
+ */
 class HttpResponse {
   /** Writes the HTTP status message such as "200 OK".
    * This has to be called first in any response, otherwise
@@ -352,53 +633,249 @@ class HttpResponse {
    * the user manual under "corking".
   */
 
-  #ssl: number;
+  #native: Specialized;
   #workerHandler: Deno.PointerValue;
   #resHandler: Deno.PointerValue;
-
-  constructor(ssl: number, workerHandler: Deno.PointerValue, resHandler: Deno.PointerValue) {
-    this.#ssl = ssl;
+  // handle passed to the static trampolines while native handlers are registered
+  #handle = 0;
+  #abortedHandler?: () => void;
+  #writableHandler?: (offset: number) => boolean;
+  #dataHandler?: (chunk: ArrayBuffer, isLast: boolean) => void;
+  #body?: { resolve: (body: ArrayBuffer) => void, reject: (error: Error) => void, maxBytes: number };
+  #streamed?: (completed: boolean) => void;
+  // set by routes with compression, see RouteOptions
+  #acceptEncoding = "";
+  #encodings = 0;
+  #minCompressSize = 0;
+  // set by cached routes, status and headers are kept for the cached copy
+  #caching = false;
+  #cacheTtl = 0;
+  #cacheStatus?: Uint8Array;
+  #cacheHeaders: Uint8Array[] = [];
+  // request of the running handler, used for the content-length hint of collectBody
+  #request?: HttpRequest;
+
+  static #responses = new HandleTable<HttpResponse>();
+  static #pool: HttpResponse[] = [];
+  static #onAborted = uws_res_on_aborted_handler((_res, handle) => {
+    HttpResponse.#responses.get(handle)?.#aborted();
+  });
+  static #onWritable = uws_res_on_writable_handler((_res, offset, handle) => {
+    const handler = HttpResponse.#responses.get(handle)?.#writableHandler;
+    return +(!handler || !!handler(offset as number));
+  });
+  static #onBody = uws_res_collect_body_handler((_res, pointer, length, ok, handle) => {
+    const res = HttpResponse.#responses.get(handle);
+    const body = res?.#body;
+    if (!res || !body) return;
+    res.#body = undefined;
+    if (ok) {
+      // the native buffer is released when this returns
+      body.resolve(length ? getBuffer(pointer, length).slice(0) : new ArrayBuffer(0));
+    } else {
+      res.#finish();
+      body.reject(new Error(`Request body exceeds ${body.maxBytes} bytes, answered with 413`));
+    }
+  });
+  static #onStreamed = uws_res_streamed_handler((_res, completed, handle) => {
+    const res = HttpResponse.#responses.get(handle);
+    const streamed = res?.#streamed;
+    if (!res || !streamed) return;
+    res.#streamed = undefined;
+    res.#finish();
+    streamed(!!completed);
+  });
+  static #onData = uws_res_on_data_handler((_res, pointer, length, is_end, handle) => {
+    HttpResponse.#responses.get(handle)?.#dataHandler?.(getBuffer(pointer, length), !!is_end);
+  });
+
+  constructor(native: Specialized, workerHandler: Deno.PointerValue, resHandler: Deno.PointerValue) {
+    this.#native = native;
     this.#workerHandler = workerHandler
     this.#resHandler = resHandler;
   }
 
+  /** Internal, takes a recycled wrapper when one is available. */
+  static _acquire(native: Specialized, workerHandler: Deno.PointerValue, resHandler: Deno.PointerValue, request: HttpRequest): HttpResponse {
+    let res = HttpResponse.#pool.pop();
+    if (res) {
+      res.#native = native;
+      res.#workerHandler = workerHandler;
+      res.#resHandler = resHandler;
+    } else {
+      res = new HttpResponse(native, workerHandler, resHandler);
+    }
+    res.#request = request;
+    res.#encodings = 0;
+    res.#caching = false;
+    return res;
+  }
+
+  /** Internal, records status and headers for a route registered with RouteOptions.cache. */
+  _cache(): void {
+    this.#caching = true;
+    this.#cacheTtl = 0;
+    this.#cacheStatus = undefined;
+    this.#cacheHeaders = [];
+  }
+
+  /** Internal, makes end compress its body for a route registered with RouteOptions.compress. */
+  _compress(acceptEncoding: string, encodings: number, minSize: number): void {
+    this.#acceptEncoding = acceptEncoding;
+    this.#encodings = encodings;
+    this.#minCompressSize = minSize;
+  }
+
+  /** Internal, called once the route handler returned. A response which ended inside its handler, never registered a
+   * handler and carries no user data cannot be reached anymore and is reused for a later request.
+   */
+  _recycle(): void {
+    this.#request = undefined;
+    if (this.#resHandler || this.#handle < 0 || HttpResponse.#pool.length >= RESPONSE_POOL_SIZE) return;
+    if (Object.keys(this).length) return;
+    HttpResponse.#pool.push(this);
+  }
+
+  #register(): Deno.PointerValue {
+    if (this.#handle <= 0) {
+      this.#handle = HttpResponse.#responses.add(this);
+    }
+    return handlePointer(this.#handle);
+  }
+
+  #aborted(): void {
+    const handler = this.#abortedHandler;
+    const body = this.#body;
+    const streamed = this.#streamed;
+    this.#body = undefined;
+    this.#streamed = undefined;
+    this.#finish();
+    body?.reject(new Error("Request aborted"));
+    streamed?.(false);
+    handler?.();
+  }
+
+  // the native response is gone, stale handles resolve to nothing from now on
+  #finish(): void {
+    if (this.#handle > 0) {
+      HttpResponse.#responses.remove(this.#handle);
+      // never recycled once handlers were handed out, closures may still reference it
+      this.#handle = -1;
+    }
+    this.#abortedHandler = this.#writableHandler = this.#dataHandler = undefined;
+    this.#resHandler = null;
+  }
+
   /** Pause http body streaming (throttle) */
   pause(): void {
-    uws_res_pause(this.#ssl, this.#workerHandler, this.#resHandler);
+    this.#native.res_pause(this.#workerHandler, this.#resHandler);
   }
 
   /** Resume http body streaming (unthrottle) */
   resume(): void {
-    uws_res_resume(this.#ssl, this.#workerHandler, this.#resHandler);
+    this.#native.res_resume(this.#workerHandler, this.#resHandler);
   }
 
   writeStatus(status: RecognizedString): HttpResponse {
-    const statusBuffer = encode(status);
-    uws_res_write_status(this.#ssl, this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(statusBuffer), statusBuffer.length);
+    if (this.#caching) {
+      this.#cacheStatus = copyBytes(status);
+    }
+    const statusBuffer = encodeTransient(status);
+    this.#native.res_write_status(this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(statusBuffer), statusBuffer.length);
     return this;
   }
   /** Writes key and value to HTTP response.
    * See writeStatus and corking.
   */
   writeHeader(key: RecognizedString, value: RecognizedString): HttpResponse {
-    const keyBuffer = encode(key);
-    const valueBuffer = encode(value);
-    uws_res_write_header(this.#ssl, this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(keyBuffer), keyBuffer.length, Deno.UnsafePointer.of(valueBuffer), valueBuffer.length);
+    if (this.#caching) {
+      this.#cacheHeaders.push(copyBytes(key), copyBytes(value));
+    }
+    const keyBuffer = encodeTransient(key);
+    const valueBuffer = encodeTransient(value);
+    this.#native.res_write_header(this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(keyBuffer), keyBuffer.length, Deno.UnsafePointer.of(valueBuffer), valueBuffer.length);
     return this;
   }
   /** Enters or continues chunked encoding mode. Writes part of the response. End with zero length write. Returns true if no backpressure was added. */
   write(chunk: RecognizedString): boolean {
-    const data = encode(chunk);
-    return !!uws_res_write(this.#ssl, this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(data), data.length);
+    const data = encodeTransient(chunk);
+    return !!this.#native.res_write(this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(data), data.length);
   }
   /** Ends this response by copying the contents of body. */
   end(body?: RecognizedString, closeConnection?: boolean): HttpResponse {
-    if (body) {
-      const data = encode(body);
-      uws_res_end(this.#ssl, this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(data), data.length, +!!closeConnection);
+    if (this.#caching) {
+      const data = body ? encodeTransient(body) : new Uint8Array(0);
+      const status = this.#cacheStatus ?? new Uint8Array(0);
+      const headers = packHeaders(this.#cacheHeaders);
+      this.#native.res_end_cached(this.#workerHandler, this.#resHandler, this.#cacheTtl,
+        Deno.UnsafePointer.of(status), status.length, Deno.UnsafePointer.of(headers), headers.length,
+        Deno.UnsafePointer.of(data), data.length, +!!closeConnection);
+      this.#cacheHeaders = [];
+    } else if (body && this.#encodings) {
+      const data = encodeTransient(body);
+      const accept = encodeTransient(this.#acceptEncoding);
+      this.#native.res_end_compressed(this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(accept), accept.length,
+        this.#encodings, this.#minCompressSize, Deno.UnsafePointer.of(data), data.length, +!!closeConnection);
+    } else if (body) {
+      const data = encodeTransient(body);
+      this.#native.res_end(this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(data), data.length, +!!closeConnection);
+    } else {
+      this.#native.res_end_without_body(this.#workerHandler, this.#resHandler, +!!closeConnection);
+    }
+    this.#finish();
+    return this;
+  }
+  /** Ends this response without copying body. The bytes are written straight from body, which must not be modified
+   * until the response finished. The binding hands it back once written or aborted, only then it may be collected.
+   * Meant for large ArrayBuffers where end would duplicate the payload into the socket buffer.
+   */
+  endOwned(body: ArrayBuffer | ArrayBufferView, closeConnection?: boolean): HttpResponse {
+    const data = encode(body);
+    const pointer = Deno.UnsafePointer.of(data);
+    if (!this.#native.res_end_owned(this.#workerHandler, this.#resHandler, pointer, data.length, +!!closeConnection, getReleaseOwned())) {
+      const address = BigInt(Deno.UnsafePointer.value(pointer));
+      const owned = ownedBodies.get(address);
+      if (owned) {
+        owned.references++;
+      } else {
+        ownedBodies.set(address, { body: data, references: 1 });
+      }
+    }
+    this.#finish();
+    return this;
+  }
+  /** Lets end cache this response natively for ms milliseconds, later requests with the same method, URL and vary
+   * headers are answered without calling into JS until then. Only has an effect on routes registered with
+   * RouteOptions.cache and only for bodies given to end, which then are not compressed.
+   */
+  cacheFor(ms: number): HttpResponse {
+    this.#cacheTtl = Math.max(0, Math.floor(ms));
+    return this;
+  }
+  /** Ends this response with length bytes of fd starting at offset. Reads and backpressure are handled by the binding
+   * without calling into JS, the promise resolves with true once everything was written and with false when the
+   * request was aborted or a read failed. Pipes are read sequentially and offset is ignored for them, they are
+   * non-blocking until the promise settles.
+   * With closeFd the binding closes fd once done, otherwise it must stay open until the promise settles.
+   */
+  streamFd(fd: number, offset: number, length: number, closeFd?: boolean): Promise<boolean> {
+    return new Promise((resolve) => {
+      this.#streamed = resolve;
+      this.#native.res_stream_fd(this.#workerHandler, this.#resHandler, fd, offset, length, +!!closeFd,
+        HttpResponse.#onStreamed.pointer, HttpResponse.#onAborted.pointer, this.#register());
+    });
+  }
+  /** Ends this response with a prepared header block and a prepared body id or a body, in one call into the binding.
+   * See prepareHeaders and prepareBody.
+   */
+  endPrepared(headers: number, body?: number | RecognizedString, closeConnection?: boolean): HttpResponse {
+    if (typeof body === "number") {
+      this.#native.res_end_prepared(this.#workerHandler, this.#resHandler, headers, body, null, 0, +!!closeConnection);
     } else {
-      uws_res_end_without_body(this.#ssl, this.#workerHandler, this.#resHandler, +!!closeConnection);
+      const data = body ? encodeTransient(body) : new Uint8Array(0);
+      this.#native.res_end_prepared(this.#workerHandler, this.#resHandler, headers, 0, Deno.UnsafePointer.of(data), data.length, +!!closeConnection);
     }
+    this.#finish();
     return this;
   }
   /** Ends this response without a body. */
@@ -407,14 +884,18 @@ class HttpResponse {
     if (reportedContentLength != undefined) {
       this.writeHeader('content-length', ''+reportedContentLength);
     }
-    uws_res_end_without_body(this.#ssl, this.#workerHandler, this.#resHandler, +!!closeConnection);
+    this.#native.res_end_without_body(this.#workerHandler, this.#resHandler, +!!closeConnection);
+    this.#finish();
     return this;
   }
   /** Ends this response, or tries to, by streaming appropriately sized chunks of body. Use in conjunction with onWritable. Returns tuple [ok, hasResponded].*/
   tryEnd(fullBodyOrChunk: RecognizedString, totalSize: number): [boolean, boolean] {
-    const data = encode(fullBodyOrChunk);
-    const result = uws_res_try_end(this.#ssl, this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(data), data.length, totalSize, 0);
-    return unpack_uws_try_end_result(result);
+    const data = encodeTransient(fullBodyOrChunk);
+    const result = unpack_uws_try_end_result(this.#native.res_try_end(this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(data), data.length, totalSize, 0));
+    if (result[1]) {
+      this.#finish();
+    }
+    return result;
   }
 
   /** Immediately force closes the connection. Any onAborted callback will run. */
@@ -425,7 +906,7 @@ class HttpResponse {
 
   /** Returns the global byte write offset for this response. Use with onWritable. */
   getWriteOffset(): number {
-    return uws_res_get_write_offset(this.#ssl, this.#workerHandler, this.#resHandler) as number;
+    return this.#native.res_get_write_offset(this.#workerHandler, this.#resHandler) as number;
   }
 
   /** Registers a handler for writable events. Continue failed write attempts in here.
@@ -433,10 +914,8 @@ class HttpResponse {
    * Writing nothing is always success, so by default you must return true.
    */
   onWritable(handler: (offset: number) => boolean): HttpResponse {
-    const handler_ = uws_res_on_writable_handler((_res, offset) => {
-      return +!!handler(offset as number);
-    });
-    uws_res_on_writable(this.#ssl, this.#workerHandler, this.#resHandler, handler_.pointer);
+    this.#writableHandler = handler;
+    this.#native.res_on_writable(this.#workerHandler, this.#resHandler, HttpResponse.#onWritable.pointer, this.#register());
     return this;
   }
 
@@ -445,45 +924,57 @@ class HttpResponse {
    * without attaching (by calling onAborted) an abort handler is ill-use and will terminate.
    * When this event emits, the response has been aborted and may not be used. */
   onAborted(handler: () => void): HttpResponse {
-    const handler_ = uws_res_on_aborted_handler(handler);
-    uws_res_on_aborted(this.#ssl, this.#workerHandler, this.#resHandler, handler_.pointer);
+    this.#abortedHandler = handler;
+    this.#native.res_on_aborted(this.#workerHandler, this.#resHandler, HttpResponse.#onAborted.pointer, this.#register());
     return this;
   }
 
   /** Handler for reading data from POST and such requests. You MUST copy the data of chunk if isLast is not true. We Neuter ArrayBuffers on return, making it zero length.*/
   onData(handler: (chunk: ArrayBuffer, isLast: boolean) => void): HttpResponse {
-    const handler_ = uws_res_on_data_handler((_res, pointer, length, is_end) => {
-      handler(getBuffer(pointer, length), !!is_end);
-    });
-    uws_res_on_data(this.#ssl, this.#workerHandler, this.#resHandler, handler_.pointer);
+    this.#dataHandler = handler;
+    this.#native.res_on_data(this.#workerHandler, this.#resHandler, HttpResponse.#onData.pointer, this.#register());
     return this;
   }
 
+  /** Collects the whole request body natively and resolves with it, one call into JS instead of one per chunk.
+   * Bodies larger than maxBytes are answered with 413 natively and reject, as does an aborted request.
+   * Must be called inside the request handler, it takes the place of onData and installs the abort handler
+   * while still calling the one given to onAborted.
+   */
+  collectBody(maxBytes = 1024 * 1024): Promise<ArrayBuffer> {
+    const expected = Number(this.#request?.getHeader("content-length")) || 0;
+    return new Promise((resolve, reject) => {
+      this.#body = { resolve, reject, maxBytes };
+      this.#native.res_collect_body(this.#workerHandler, this.#resHandler, maxBytes, expected,
+        HttpResponse.#onBody.pointer, HttpResponse.#onAborted.pointer, this.#register());
+    });
+  }
+
   /** Returns the remote IP address in binary format (4 or 16 bytes). */
   getRemoteAddress(): ArrayBuffer {
     const dest = new Uint8Array(16);
-    const length = uws_res_get_remote_address(this.#ssl, this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(dest));
+    const length = this.#native.res_get_remote_address(this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(dest));
     return dest.slice(0, length as number);
   }
 
   /** Returns the remote IP address as text. */
   getRemoteAddressAsText(): ArrayBuffer {
     const dest = new Uint8Array(45); // maximum ipv6 length as text
-    const length = uws_res_get_remote_address_as_text(this.#ssl, this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(dest));
+    const length = this.#native.res_get_remote_address_as_text(this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(dest));
     return dest.slice(0, length as number);
   }
 
   /** Returns the remote IP address in binary format (4 or 16 bytes), as reported by the PROXY Protocol v2 compatible proxy. */
   getProxiedRemoteAddress(): ArrayBuffer {
     const dest = new Uint8Array(16);
-    const length = uws_res_get_proxied_remote_address(this.#ssl, this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(dest));
+    const length = this.#native.res_get_proxied_remote_address(this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(dest));
     return dest.slice(0, length as number);
   }
 
   /** Returns the remote IP address as text, as reported by the PROXY Protocol v2 compatible proxy. */
   getProxiedRemoteAddressAsText(): ArrayBuffer {
     const dest = new Uint8Array(45); // maximum ipv6 length as text
-    const length = uws_res_get_proxied_remote_address_as_text(this.#ssl, this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(dest));
+    const length = this.#native.res_get_proxied_remote_address_as_text(this.#workerHandler, this.#resHandler, Deno.UnsafePointer.of(dest));
     return dest.slice(0, length as number);
   }
 
@@ -501,7 +992,7 @@ class HttpResponse {
    * });
    */
   cork(cb: () => void): HttpResponse {
-    uws_res_cork(this.#ssl, this.#workerHandler, this.#resHandler, uws_res_cork_callback(cb).pointer);
+    withCallback(cb, (handle) => this.#native.res_cork(this.#workerHandler, this.#resHandler, resCorkTrampoline.pointer, handle));
     return this;
   }
 
@@ -511,98 +1002,480 @@ class HttpResponse {
     const secWebSocketKeyBuffer = encoder.encode(secWebSocketKey);
     const secWebSocketProtocolBuffer = encoder.encode(secWebSocketProtocol);
     const secWebSocketExtensionsBuffer = encoder.encode(secWebSocketExtensions);
-    uws_res_upgrade(this.#ssl, this.#workerHandler, this.#resHandler, null,
+    this.#native.res_upgrade(this.#workerHandler, this.#resHandler, null,
       Deno.UnsafePointer.of(secWebSocketKeyBuffer), secWebSocketKeyBuffer.length,
       Deno.UnsafePointer.of(secWebSocketProtocolBuffer), secWebSocketProtocolBuffer.length,
       Deno.UnsafePointer.of(secWebSocketExtensionsBuffer), secWebSocketExtensionsBuffer.length,
       context);
-    const ws = getWebSocket(this.#ssl, this.#workerHandler, context);
+    const ws = getWebSocket(this.#native, this.#workerHandler, context);
     Object.assign(ws, userData);
+    this.#finish();
   }
 
   /** Arbitrary user data may be attached to this object */
   [key: string]: any;
 }
 
-/** An HttpRequest is stack allocated and only accessible during the callback invocation. */
+function bytesEqual(a: Uint8Array, b: Uint8Array): boolean {
+  if (a.length !== b.length) return false;
+  for (let i = 0; i < a.length; i++) {
+    if (a[i] !== b[i]) return false;
+  }
+  return true;
+}
+
+// handlers keep asking for the same few header names
+const headerKeys: Map<string, Uint8Array> = new Map();
+function encodeHeaderKey(lowerCaseKey: string): Uint8Array {
+  let key = headerKeys.get(lowerCaseKey);
+  if (!key) {
+    key = encoder.encode(lowerCaseKey);
+    if (headerKeys.size < 256) headerKeys.set(lowerCaseKey, key);
+  }
+  return key;
+}
+
+/** Flat copy of a request written by the native side.
+ * Layout (u32 little endian): size, parameter count, header count, then (offset, length) pairs of
+ * method, url, query, every parameter, every header key and value. Fields are decoded only when read.
+ */
+class RequestSnapshot {
+  #bytes: Uint8Array;
+  #view: DataView;
+
+  constructor(bytes: Uint8Array) {
+    this.#bytes = bytes;
+    this.#view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  }
+
+  _reset(bytes: Uint8Array): void {
+    this.#bytes = bytes;
+    this.#view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  }
+
+  get parameterCount(): number {
+    return this.#view.getUint32(4, true);
+  }
+
+  get headerCount(): number {
+    return this.#view.getUint32(8, true);
+  }
+
+  #field(index: number): Uint8Array {
+    const offset = this.#view.getUint32(12 + index * 8, true);
+    const length = this.#view.getUint32(16 + index * 8, true);
+    return this.#bytes.subarray(offset, offset + length);
+  }
+
+  #string(index: number): string {
+    return decoder.decode(this.#field(index));
+  }
+
+  method(): string {
+    return this.#string(0);
+  }
+
+  url(): string {
+    return this.#string(1);
+  }
+
+  query(): string {
+    return this.#string(2);
+  }
+
+  parameter(index: number): string {
+    return index < this.parameterCount ? this.#string(3 + index) : "";
+  }
+
+  header(lowerCaseKey: string): string {
+    const key = encodeHeaderKey(lowerCaseKey);
+    const first = 3 + this.parameterCount;
+    for (let i = 0; i < this.headerCount; i++) {
+      if (bytesEqual(this.#field(first + i * 2), key)) {
+        return this.#string(first + i * 2 + 1);
+      }
+    }
+    return "";
+  }
+
+  forEach(cb: (key: string, value: string) => void): void {
+    const first = 3 + this.parameterCount;
+    for (let i = 0; i < this.headerCount; i++) {
+      cb(this.#string(first + i * 2), this.#string(first + i * 2 + 1));
+    }
+  }
+}
+
+/** An HttpRequest is stack allocated and only accessible during the callback invocation.
+ * Everything but setYield is read from a snapshot the native side fills before calling the handler.
+ */
 class HttpRequest {
   #reqHandler: Deno.PointerValue;
   #workerHandler: Deno.PointerValue;
+  #snapshot: RequestSnapshot;
 
-  constructor(workerHandler: Deno.PointerValue, reqHandler: Deno.PointerValue) {
+  constructor(workerHandler: Deno.PointerValue, reqHandler: Deno.PointerValue, snapshot: RequestSnapshot) {
     this.#workerHandler = workerHandler;
     this.#reqHandler = reqHandler;
+    this.#snapshot = snapshot;
+  }
+
+  static #pool: HttpRequest[] = [];
+
+  /** Internal, a request is only valid during its handler so the wrapper and its snapshot are recycled afterwards, see _release. */
+  static _acquire(workerHandler: Deno.PointerValue, reqHandler: Deno.PointerValue, snapshot: Deno.PointerValue, length: Deno.PointerValue): HttpRequest {
+    const bytes = new Uint8Array(getBuffer(snapshot, length));
+    const req = HttpRequest.#pool.pop();
+    if (!req) return new HttpRequest(workerHandler, reqHandler, new RequestSnapshot(bytes));
+    req.#workerHandler = workerHandler;
+    req.#reqHandler = reqHandler;
+    req.#snapshot._reset(bytes);
+    return req;
+  }
+
+  _release(): void {
+    if (HttpRequest.#pool.length < REQUEST_POOL_SIZE) {
+      HttpRequest.#pool.push(this);
+    }
   }
 
   /** Returns the lowercased header value or empty string. */
   getHeader(lowerCaseKey: string): string {
-    const headerBuffer = encoder.encode(lowerCaseKey);
-    // https://github.com/uNetworking/uWebSockets.js/blob/master/src/HttpRequestWrapper.h#L97
-    // as i see no one cares about overflows;
-    const dest = new Uint8Array();
-    const ptr = Deno.UnsafePointer.of(dest)
-    const size = uws_req_get_header(this.#workerHandler, this.#reqHandler, Deno.UnsafePointer.of(headerBuffer), headerBuffer.length, ptr);
-    return getStringFromPointer(ptr, size);
+    return this.#snapshot.header(lowerCaseKey);
   }
   /** Returns the parsed parameter at index. Corresponds to route. */
   getParameter(index: number): string {
-    const dest = new Uint8Array();
-    const ptr = Deno.UnsafePointer.of(dest)
-    const size = uws_req_get_parameter(this.#workerHandler, this.#reqHandler, index, ptr);
-    return getStringFromPointer(ptr, size);
+    return this.#snapshot.parameter(index);
   }
   /** Returns the URL including initial /slash */
   getUrl(): string {
-    const dest = new Uint8Array();
-    const ptr = Deno.UnsafePointer.of(dest)
-    const size = uws_req_get_url(this.#workerHandler, this.#reqHandler, ptr);
-    return getStringFromPointer(ptr, size);
+    return this.#snapshot.url();
   }
   /** Returns the lowercased HTTP method, useful for "any" routes. */
   getMethod(): string {
-    const dest = new Uint8Array();
-    const ptr = Deno.UnsafePointer.of(dest)
-    const size = uws_req_get_method(this.#workerHandler, this.#reqHandler, ptr);
-    return getStringFromPointer(ptr, size);
+    return this.#snapshot.method().toLowerCase();
   }
   /** Returns the HTTP method as-is. */
   getCaseSensitiveMethod(): string {
-    const dest = new Uint8Array();
-    const ptr = Deno.UnsafePointer.of(dest)
-    const size = uws_req_get_case_sensitive_method(this.#workerHandler, this.#reqHandler, ptr);
-    return getStringFromPointer(ptr, size);
+    return this.#snapshot.method();
   }
 
   /** Returns the raw querystring (the part of URL after ? sign) or empty string. */
   getQuery(): string;
   /** Returns a decoded query parameter value or empty string. */
   getQuery(key?: string): string {
-    const dest = new Uint8Array();
-    const ptr = Deno.UnsafePointer.of(dest)
-    let size;
+    const query = this.#snapshot.query();
     if (key) {
-      const keyBuffer = encoder.encode(key);
-      size = uws_req_get_query(this.#workerHandler, this.#reqHandler, Deno.UnsafePointer.of(keyBuffer), keyBuffer.length, ptr);
-    } else {
-      size = uws_req_get_query(this.#workerHandler, this.#reqHandler, null, 0, ptr);
+      return new URLSearchParams(query).get(key) ?? "";
     }
-    return getStringFromPointer(ptr, size);
+    return query;
   }
 
   /** Loops over all headers. */
   forEach(cb: (key: string, value: string) => void): void {
-    const handler = uws_get_headers_server_handler((key_ptr, key_size, val_ptr, val_size) => {
-      cb(getStringFromPointer(key_ptr, key_size), getStringFromPointer(val_ptr, val_size));
-    });
-    uws_req_for_each_header(this.#workerHandler, this.#reqHandler, handler.pointer);
+    this.#snapshot.forEach(cb);
   }
-  /** Setting yield to true is to say that this route handler did not handle the route, causing the router to continue looking for a matching route handler, or fail. */
+  /** Setting yield to true is to say that this route handler did not handle the route, causing the router to continue looking for a matching route handler, or fail.
+   * Has no effect on batched routes, they are answered asynchronously.
+   */
   setYield(yield_: boolean): HttpRequest {
-    uws_req_set_field(this.#workerHandler, this.#reqHandler, +yield_);
+    if (this.#reqHandler) {
+      uws_req_set_field(this.#workerHandler, this.#reqHandler, +yield_);
+    }
     return this;
   }
 }
 
+/** Same order as uws_method_t */
+export enum HttpMethod {
+  GET,
+  POST,
+  OPTIONS,
+  DELETE,
+  PATCH,
+  PUT,
+  HEAD,
+  CONNECT,
+  TRACE,
+  ANY
+}
+
+function copyBytes(data: RecognizedString): Uint8Array {
+  if (typeof data === "string") {
+    return encoder.encode(data);
+  }
+  if (ArrayBuffer.isView(data)) {
+    return new Uint8Array(data.buffer.slice(data.byteOffset, data.byteOffset + data.byteLength));
+  }
+  return new Uint8Array(data.slice(0));
+}
+
+/** Same values as uws_content_encoding_t */
+export enum ContentEncoding {
+  GZIP = 1,
+  DEFLATE = 2,
+  /** Only when the binding was built with WITH_BROTLI, otherwise skipped */
+  BROTLI = 4
+}
+
+/** Options of the route methods of TemplatedApp. */
+export interface RouteOptions {
+  /** Compress bodies given to HttpResponse.end natively, negotiated from Accept-Encoding. true enables every
+   * ContentEncoding with a 1 KiB threshold. Bodies written with write, tryEnd or the other end variants are untouched.
+   */
+  compress?: boolean | {
+    /** ContentEncoding flags, defaults to all of them */
+    encodings?: number;
+    /** Bodies shorter than this are sent uncompressed, defaults to 1024 */
+    minSize?: number;
+  };
+  /** Answer repeated requests from a native cache filled by responses which called HttpResponse.cacheFor, without
+   * calling into JS. Keyed by method and full URL plus the values of the vary request headers. Only accepted on GET
+   * and HEAD routes whose responses do not depend on anything else, see TemplatedApp.responseCacheLimit for the budget.
+   */
+  cache?: boolean | {
+    /** Lower case request header names which select different responses, e.g. accept-encoding */
+    vary?: string[];
+  };
+}
+
+/** Counters of one route of apps with enableMetrics. Loops of a pool share them. */
+export interface RouteMetrics {
+  method: string;
+  pattern: string;
+  requests: number;
+  /** Responses by status class, 1xx to 5xx */
+  statuses: [number, number, number, number, number];
+  /** Sum of the Content-Length of requests */
+  bytesIn: number;
+  /** Body bytes of responses */
+  bytesOut: number;
+  /** Microseconds from dispatch until the response was ended */
+  latency: {
+    count: number;
+    sum: number;
+    max: number;
+    /** p50, p90, p99 and p99.9, within 12.5% */
+    percentiles: [number, number, number, number];
+  };
+}
+
+export interface WebSocketMetrics {
+  pattern: string;
+  opened: number;
+  closed: number;
+  messages: number;
+  bytesIn: number;
+}
+
+export interface Metrics {
+  routes: RouteMetrics[];
+  websockets: WebSocketMetrics[];
+}
+
+/** Health of a native loop thread, see TemplatedApp.loopStats. Times are nanoseconds. */
+export interface LoopStats {
+  /** Loop iterations, each one handles all events of one wakeup */
+  iterations: number;
+  /** Wakeups requested from other threads, by deferred tasks and publishes */
+  wakeups: number;
+  /** Deferred tasks waiting for the loop, and the most since the maxima were reset */
+  deferred: number;
+  deferredMax: number;
+  /** Calls into JS and the time the loop was blocked by them */
+  callbacks: number;
+  callbackTime: number;
+  callbackMax: number;
+  /** Time spent waiting for events, busy time is uptime - idleTime. Sampled every 100ms */
+  idleTime: number;
+  uptime: number;
+  /** How late the 100ms loop timer fired last, and the most since the maxima were reset */
+  lag: number;
+  lagMax: number;
+}
+
+const loopStatsBuffer = new BigUint64Array(11);
+
+function readLoopStats(handle: Deno.PointerValue, resetMax: boolean): LoopStats {
+  uws_loop_stats(handle, Deno.UnsafePointer.of(loopStatsBuffer), +resetMax);
+  const [iterations, wakeups, deferred, deferredMax, callbacks, callbackTime, callbackMax, idleTime, uptime, lag, lagMax] =
+    Array.from(loopStatsBuffer, Number);
+  return { iterations, wakeups, deferred, deferredMax, callbacks, callbackTime, callbackMax, idleTime, uptime, lag, lagMax };
+}
+
+let metricsBuffer = new Uint8Array(64 * 1024);
+
+/** Snapshot of the natively recorded metrics of every app of this process. */
+export function getMetrics(): Metrics {
+  let length;
+  while ((length = Number(uws_get_metrics(Deno.UnsafePointer.of(metricsBuffer), metricsBuffer.length))) > metricsBuffer.length) {
+    metricsBuffer = new Uint8Array(length * 2);
+  }
+  return JSON.parse(decoder.decode(metricsBuffer.subarray(0, length)));
+}
+
+/** Options of TemplatedApp.serveStatic. */
+export interface ServeStaticOptions {
+  /** File served for URLs ending with a slash, defaults to index.html. */
+  index?: string;
+  /** Value of the Cache-Control header, none when empty. */
+  cacheControl?: string;
+  /** Bytes of mapped files kept cached per loop, defaults to 64 MiB. Larger files are mapped per request. */
+  cacheLimit?: number;
+  /** Serve .br/.gz siblings to clients accepting them, defaults to true. */
+  precompressed?: boolean;
+}
+
+/** A route waiting for the next uws_app_register_routes of its app. vary is null for routes which are not cached. */
+interface PendingRoute {
+  method: HttpMethod;
+  pattern: Uint8Array;
+  vary: Uint8Array | null;
+  handler: Deno.PointerValue;
+}
+
+// entry layout of uws_app_register_routes: u32 method, u32 pattern length, u32 vary length, u32 zero, u64 handler
+const ROUTE_ENTRY_SIZE = 24;
+const ROUTE_NOT_CACHED = 0xffffffff;
+
+function packRouteTable(routes: PendingRoute[]): Uint8Array {
+  let size = 4 + routes.length * ROUTE_ENTRY_SIZE;
+  for (const route of routes) {
+    size += route.pattern.length + (route.vary?.length ?? 0);
+  }
+  const table = new Uint8Array(size);
+  const view = new DataView(table.buffer);
+  view.setUint32(0, routes.length, true);
+  let entry = 4;
+  let offset = 4 + routes.length * ROUTE_ENTRY_SIZE;
+  for (const route of routes) {
+    view.setUint32(entry, route.method, true);
+    view.setUint32(entry + 4, route.pattern.length, true);
+    view.setUint32(entry + 8, route.vary ? route.vary.length : ROUTE_NOT_CACHED, true);
+    view.setBigUint64(entry + 16, BigInt(Deno.UnsafePointer.value(route.handler)), true);
+    table.set(route.pattern, offset);
+    offset += route.pattern.length;
+    if (route.vary) {
+      table.set(route.vary, offset);
+      offset += route.vary.length;
+    }
+    entry += ROUTE_ENTRY_SIZE;
+  }
+  return table;
+}
+
+/** Packs header key/value pairs as u32 length followed by the bytes, the format the binding parses. */
+function packHeaders(parts: Uint8Array[]): Uint8Array {
+  let length = 0;
+  for (const part of parts) {
+    length += 4 + part.length;
+  }
+  const packed = new Uint8Array(length);
+  const view = new DataView(packed.buffer);
+  let offset = 0;
+  for (const part of parts) {
+    view.setUint32(offset, part.length, true);
+    packed.set(part, offset + 4);
+    offset += 4 + part.length;
+  }
+  return packed;
+}
+
+/** Response of a batched route. The native side is not waiting for the handler, so status, headers and body
+ * are kept in JS and sent with one call when the response is ended. May be ended after the handler returned.
+ */
+class BatchedHttpResponse {
+  #native: Specialized;
+  #workerHandler: Deno.PointerValue;
+  #resHandler: Deno.PointerValue;
+  #status: Uint8Array | null = null;
+  #headers: Uint8Array[] = [];
+  // the request sequence the ring reported, the key of the pending batched responses. uWS reuses the address of
+  // aborted responses, the sequence makes the native side ignore an answer meant for an earlier request
+  #sequence: bigint;
+  #abortedHandler: (() => void) | null = null;
+  #done = false;
+  #finished: (sequence: bigint) => void;
+
+  constructor(native: Specialized, workerHandler: Deno.PointerValue, address: bigint, sequence: bigint, finished: (sequence: bigint) => void) {
+    this.#native = native;
+    this.#workerHandler = workerHandler;
+    this.#sequence = sequence;
+    this.#resHandler = Deno.UnsafePointer.create(address);
+    this.#finished = finished;
+  }
+
+  /** Whether end was called or the request was aborted. */
+  get done(): boolean {
+    return this.#done;
+  }
+
+  /** Writes the HTTP status message such as "200 OK". */
+  writeStatus(status: RecognizedString): BatchedHttpResponse {
+    this.#status = copyBytes(status);
+    return this;
+  }
+
+  /** Writes key and value to HTTP response. */
+  writeHeader(key: RecognizedString, value: RecognizedString): BatchedHttpResponse {
+    const keyBuffer = copyBytes(key);
+    const valueBuffer = copyBytes(value);
+    this.#headers.push(keyBuffer, valueBuffer);
+    return this;
+  }
+
+  /** Ends this response, status, headers and body are sent in one go. */
+  end(body?: RecognizedString, closeConnection?: boolean): BatchedHttpResponse {
+    if (this.#done) return this;
+    this.#done = true;
+    this.#finished(this.#sequence);
+    const headers = packHeaders(this.#headers);
+    const status = this.#status ?? new Uint8Array(0);
+    const data = body ? encode(body) : new Uint8Array(0);
+    this.#native.ring_res_end(
+      this.#workerHandler, this.#resHandler, this.#sequence,
+      Deno.UnsafePointer.of(status), status.length,
+      Deno.UnsafePointer.of(headers), headers.length,
+      Deno.UnsafePointer.of(data), data.length,
+      +!!closeConnection);
+    return this;
+  }
+
+  /** Called when the client went away before the response was ended. */
+  onAborted(handler: () => void): BatchedHttpResponse {
+    this.#abortedHandler = handler;
+    return this;
+  }
+
+  /** Responses are always sent corked, kept for compatibility with HttpResponse. */
+  cork(cb: () => void): BatchedHttpResponse {
+    cb();
+    return this;
+  }
+
+  /** @internal called when the ring reports the request as aborted */
+  _abort(): void {
+    if (this.#done) return;
+    this.#done = true;
+    this.#finished(this.#sequence);
+    this.#abortedHandler?.();
+  }
+
+  /** Arbitrary user data may be attached to this object */
+  [key: string]: any;
+}
+
+type BatchedHandler = (res: BatchedHttpResponse, req: HttpRequest) => void;
+
+/** Must match RequestRing::Shared and the record layout in libuwebsockets.cpp */
+const RING_HEADER_SIZE = 16;
+const RING_RECORD_HEADER_SIZE = 32;
+enum RingRecord {
+  PADDING,
+  REQUEST,
+  ABORTED
+}
+
 /** A structure holding settings and handlers for a WebSocket URL route handler. */
 export interface WebSocketBehavior<UserData> {
   /** Maximum length of received message. If a client tries to send you a message larger than this, the connection is immediately closed. Defaults to 16 * 1024. */
@@ -630,6 +1503,11 @@ export interface WebSocketBehavior<UserData> {
   open?: (ws: WebSocket<UserData>) => void;
   /** Handler for a WebSocket message. Messages are given as ArrayBuffer no matter if they are binary or not. Given ArrayBuffer is valid during the lifetime of this callback (until first await or return) and will be neutered. */
   message?: (ws: WebSocket<UserData>, message: ArrayBuffer, isBinary: boolean) => void;
+  /** Collects the messages of every socket of this route natively and calls message for all of them once per loop
+   * iteration, with a single wakeup of the deno thread. Replies and publishes made from message are sent in the
+   * same iteration. A socket's messages are delivered before its close. Defaults to false.
+   */
+  batchMessages?: boolean;
   /** Handler for when WebSocket backpressure drains. Check ws.getBufferedAmount(). Use this to guide / drive your backpressure throttling. */
   drain?: (ws: WebSocket<UserData>) => void;
   /** Handler for close event, no matter if error, timeout or graceful close. You may not use WebSocket after this event. Do not send on this WebSocket from within here, it is closed. */
@@ -674,18 +1552,22 @@ export enum CompressOptions {
     DEDICATED_COMPRESSOR = 15 << 4 | 8
 }
 
-const wss: Map<Deno.PointerValue, WebSocket<any>> = new Map();
-function getWebSocket<UserData>(ssl: number, workerHandler: Deno.PointerValue, wsHandler: Deno.PointerValue): WebSocket<UserData> {
+// keyed by address, every callback gets a new pointer object for the same socket
+const wss: Map<bigint, WebSocket<any>> = new Map();
+function getWebSocket<UserData>(native: Specialized, workerHandler: Deno.PointerValue, wsHandler: Deno.PointerValue): WebSocket<UserData> {
   // https://github.com/uNetworking/uWebSockets/blob/master/misc/READMORE.md#use-the-websocketgetuserdata-feature
   // if I have known method to ref deno objects I whould use getUserData instead
-  if (wss.has(wsHandler)) return wss.get(wsHandler) as WebSocket<UserData>;
-  const ws = new WebSocket(ssl, workerHandler, wsHandler);
-  wss.set(wsHandler, ws);
+  const address = BigInt(Deno.UnsafePointer.value(wsHandler));
+  const known = wss.get(address);
+  if (known) return known as WebSocket<UserData>;
+  const ws = new WebSocket(native, workerHandler, wsHandler);
+  wss.set(address, ws);
   return ws as WebSocket<UserData>;
 }
 
 export function packWebsocketBehaviorBuffer<UserData>(ssl: number, workerHandler: Deno.PointerValue, behavior: WebSocketBehavior<UserData>): Uint8Array {
-  return Struct.pack("<iiii???billllllll", [
+  const native = specializations[+!!ssl];
+  return Struct.pack("<iiii???billlllllll", [
     behavior.compression ?? CompressOptions.DISABLED,
     behavior.maxPayloadLength ?? 16 * 1024 * 1024,
     behavior.idleTimeout ?? 12,
@@ -695,53 +1577,144 @@ export function packWebsocketBehaviorBuffer<UserData>(ssl: number, workerHandler
     behavior.sendPingsAutomatically ?? true,
     0,
     behavior.maxLifetime ?? 0,
-    behavior.upgrade ? uws_websocket_upgrade_handler((res, req, context) => {
-      behavior.upgrade!(new HttpResponse(ssl, workerHandler, res), new HttpRequest(workerHandler, req), context);
+    behavior.upgrade ? uws_websocket_upgrade_handler((res, req, context, snapshot, length) => {
+      const request = HttpRequest._acquire(workerHandler, req, snapshot, length);
+      const response = HttpResponse._acquire(native, workerHandler, res, request);
+      try {
+        behavior.upgrade!(response, request, context);
+      } finally {
+        request._release();
+        response._recycle();
+      }
     }).pointer : 0,
     uws_websocket_handler((wsHandler) => {
-      const ws = getWebSocket<UserData>(ssl, workerHandler, wsHandler);
+      const ws = getWebSocket<UserData>(native, workerHandler, wsHandler);
       if (behavior.open) {
         behavior.open(ws);
       }
     }).pointer,
-    behavior.message ? uws_websocket_message_handler((ws, messagePtr, length, opcode) => {
-      behavior.message!(getWebSocket(ssl, workerHandler, ws), getBuffer(messagePtr, length), opcode === OpCode.BINARY);
+    behavior.message && !behavior.batchMessages ? uws_websocket_message_handler((ws, messagePtr, length, opcode) => {
+      behavior.message!(getWebSocket(native, workerHandler, ws), getBuffer(messagePtr, length), opcode === OpCode.BINARY);
     }).pointer : 0,
     behavior.drain ? uws_websocket_handler((ws) => {
-      behavior.drain!(getWebSocket(ssl, workerHandler, ws));
+      behavior.drain!(getWebSocket(native, workerHandler, ws));
     }).pointer : 0,
     behavior.ping ? uws_websocket_ping_pong_handler((ws, messagePtr, length) => {
-      behavior.ping!(getWebSocket(ssl, workerHandler, ws), messagePtr ? getBuffer(messagePtr, length) : new ArrayBuffer(0));
+      behavior.ping!(getWebSocket(native, workerHandler, ws), messagePtr ? getBuffer(messagePtr, length) : new ArrayBuffer(0));
     }).pointer : 0,
     behavior.pong ? uws_websocket_ping_pong_handler((ws, messagePtr, length) => {
-      behavior.pong!(getWebSocket(ssl, workerHandler, ws), messagePtr ? getBuffer(messagePtr, length) : new ArrayBuffer(0));
+      behavior.pong!(getWebSocket(native, workerHandler, ws), messagePtr ? getBuffer(messagePtr, length) : new ArrayBuffer(0));
     }).pointer : 0,
     uws_websocket_close_handler((wsHandler, code, messagePtr, length) => {
-      const ws = getWebSocket<UserData>(ssl, workerHandler, wsHandler);
+      const ws = getWebSocket<UserData>(native, workerHandler, wsHandler);
       if (behavior.close) {
         behavior.close(ws, code, messagePtr ? getBuffer(messagePtr, length) : new ArrayBuffer(0));
       }
-      wss.delete(wsHandler);
+      wss.delete(BigInt(Deno.UnsafePointer.value(wsHandler)));
     }).pointer,
     behavior.subscription ? uws_websocket_subscription_handler((ws, topicPtr, length, newCount, oldCount) => {
-      behavior.subscription!(getWebSocket(ssl, workerHandler, ws), getBuffer(topicPtr, length), newCount as number, oldCount as number);
+      behavior.subscription!(getWebSocket(native, workerHandler, ws), getBuffer(topicPtr, length), newCount as number, oldCount as number);
+    }).pointer : 0,
+    behavior.message && behavior.batchMessages ? uws_websocket_message_batch_handler((records, length, count) => {
+      // u64 ws, u32 length, u8 opcode, 3 bytes padding and the payload, each record padded to 8 bytes
+      const pointerView = new Deno.UnsafePointerView(records);
+      const view = new DataView(pointerView.getArrayBuffer(length as number));
+      let offset = 0;
+      for (let i = 0; i < count; i++) {
+        const size = view.getUint32(offset + 8, true);
+        // sockets closed by an earlier message of the batch are gone
+        const ws = wss.get(view.getBigUint64(offset, true));
+        if (ws) {
+          behavior.message!(ws, pointerView.getArrayBuffer(size, offset + 16), view.getUint8(offset + 12) === OpCode.BINARY);
+        }
+        offset += (16 + size + 7) & ~7;
+      }
     }).pointer : 0
   ]);
 }
 
+// listen fds passed by one handoff, see uws_send_fds
+const MAX_HANDOFF_FDS = 64;
+
+async function listenFds(handle: Deno.PointerValue): Promise<number[]> {
+  const fds = new Int32Array(MAX_HANDOFF_FDS);
+  const count = Number(await keepAlive(uws_app_listen_fds(handle, Deno.UnsafePointer.of(fds), fds.length), fds));
+  return [...fds.subarray(0, count)];
+}
+
+async function sendListenFds(path: string, fds: number[]): Promise<number> {
+  const pathBuffer = encoder.encode(path);
+  const fdsBuffer = Int32Array.from(fds);
+  const sent = await keepAlive(
+    uws_send_fds(Deno.UnsafePointer.of(pathBuffer), pathBuffer.length, Deno.UnsafePointer.of(fdsBuffer), fdsBuffer.length),
+    pathBuffer, fdsBuffer);
+  if (sent < 0) {
+    throw new Error('Failed to hand the listen sockets over to ' + path);
+  }
+  return sent;
+}
+
+/** Waits on the unix socket at path for the listen sockets of a predecessor's handoff and resolves with their fds,
+ * to be given to adoptListenSockets. A path starting with a zero byte is an abstract socket name.
+ */
+export async function receiveListenSockets(path: string): Promise<number[]> {
+  const pathBuffer = encoder.encode(path);
+  const fds = new Int32Array(MAX_HANDOFF_FDS);
+  const count = await keepAlive(
+    uws_receive_fds(Deno.UnsafePointer.of(pathBuffer), pathBuffer.length, Deno.UnsafePointer.of(fds), fds.length),
+    pathBuffer, fds);
+  if (count < 0) {
+    throw new Error('Failed to receive listen sockets on ' + path);
+  }
+  return [...fds.subarray(0, count)];
+}
+
+function listenWorker(ssl: number, handle: Deno.PointerValue, args: IArguments | any[]): void {
+  if (args.length === 2) {
+    const [port, cb] = args;
+    const listen_handler = uws_listen_handler((listen_socket: us_listen_socket) => cb(listen_socket));
+    uws_app_listen(ssl, handle, port, listen_handler.pointer);
+  }
+
+  if (args.length === 3) {
+    const [host, port, cb] = args;
+    const config = {} as ListenConfig;
+    if (typeof host === 'number') {
+      config.options = port;
+      config.port = host;
+    } else {
+      config.host = host;
+      config.port = port;
+    }
+    const listen_handler = uws_listen_handler((listen_socket: us_listen_socket) => cb(listen_socket));
+    const configBuffer = packListenConfigBuffer(config);
+    uws_app_listen_with_config(ssl, handle, configBuffer, listen_handler.pointer);
+  }
+}
+
 /** TemplatedApp is either an SSL or non-SSL app. See App for more info, read user manual. */
 class TemplatedApp {
   #handle: Deno.PointerValue
   #ssl = 0;
+  // uws_tcp_* or uws_tls_*, the per request calls do not pass ssl
+  #native: Specialized;
+  #ring: { buffer: ArrayBuffer, words: Uint32Array, view: DataView, mask: number } | null = null;
+  #batchedRoutes: BatchedHandler[] = [];
+  #batchedResponses: Map<bigint, BatchedHttpResponse> = new Map();
+  #pendingRoutes: PendingRoute[] = [];
 
   /** Unsafe Raw (pointer) to the uws_app object */
   get unsafeHandle(): Deno.PointerValue {
     return this.#handle;
   }
 
-  constructor(ssl: number, options?: AppOptions) {
+  constructor(ssl: number, options?: AppOptions, handle?: Deno.PointerValue) {
     this.#ssl = ssl;
-    if (this.#ssl) {
+    this.#native = specializations[+!!ssl];
+    if (handle) {
+      // loop already started natively, e.g. one of the loops of an AppPool
+      this.#handle = handle;
+    } else if (this.#ssl) {
       const optionsBuffer = packAppOptionsBuffer(options!);
       this.#handle = uws_create_app(this.#ssl, optionsBuffer.buffer);
     } else {
@@ -758,104 +1731,317 @@ class TemplatedApp {
   listen(port: number, options: ListenOptions, cb: (listenSocket: us_listen_socket | false) => void): TemplatedApp;
 
   listen(): TemplatedApp {
-    if (arguments.length === 2) {
-      const [port, cb] = arguments;
-      const listen_handler = uws_listen_handler((listen_socket: us_listen_socket) => cb(listen_socket));
-      uws_app_listen(this.#ssl, this.#handle, port, listen_handler.pointer);
-    }
-
-    if (arguments.length === 3) {
-      const [host, port, cb] = arguments;
-      const config = {} as ListenConfig;
-      if (typeof host === 'number') {
-        config.options = port;
-        config.port = host;
-      } else {
-        config.host = host;
-        config.port = port;
-      }
-      const listen_handler = uws_listen_handler((listen_socket: us_listen_socket) => cb(listen_socket));
-      const configBuffer = packListenConfigBuffer(config);
-      uws_app_listen_with_config(this.#ssl, this.#handle, configBuffer, listen_handler.pointer);
-    }
+    this.#flushRoutes();
+    listenWorker(this.#ssl, this.#handle, arguments);
+    return this;
+  }
 
+  /** Stops accepting connections, lets in-flight responses finish, ends WebSockets with code 1001 and closes
+   * keep-alive connections once idle, then stops the loop. What is left after timeoutMs is closed forcefully.
+   * Resolves with whether everything finished in time. The app serves no calls afterwards.
+   */
+  async drain(timeoutMs = 10000): Promise<boolean> {
+    return !!await uws_app_close(this.#ssl, this.#handle, timeoutMs);
+  }
+  /** Closes every connection right away and stops the loop, see drain. */
+  close(): Promise<boolean> {
+    return this.drain(0);
+  }
+  /** Hands the listen sockets to a successor waiting in receiveListenSockets(path), so that it accepts on them
+   * while this app drains and no connection is refused during a restart. Resolves with the number of sockets sent.
+   */
+  async handoff(path: string): Promise<number> {
+    this.#flushRoutes();
+    return sendListenFds(path, await listenFds(this.#handle));
+  }
+  /** Accepts connections from listen sockets received by receiveListenSockets, instead of or next to listen. */
+  adoptListenSockets(fds: number[]): TemplatedApp {
+    this.#flushRoutes();
+    for (const fd of fds) {
+      uws_app_adopt_listen_fd(this.#ssl, this.#handle, fd);
+    }
     return this;
   }
 
   #generateHTTPHandler(
-    method: typeof uws_app_any, // all http handler methods has same interface
+    httpMethod: HttpMethod,
     pattern: string,
-    handler: (res: HttpResponse, req: HttpRequest) => void
+    handler: (res: HttpResponse, req: HttpRequest) => void,
+    options?: RouteOptions
   ): TemplatedApp {
+    if (options?.cache && httpMethod !== HttpMethod.GET && httpMethod !== HttpMethod.HEAD) {
+      throw new Error('RouteOptions.cache is only supported on GET and HEAD routes');
+    }
+    const compress = options?.compress === true ? {} : options?.compress || undefined;
+    const encodings = compress ? compress.encodings ?? ContentEncoding.GZIP | ContentEncoding.DEFLATE | ContentEncoding.BROTLI : 0;
+    const minSize = compress?.minSize ?? 1024;
     const _handler = uws_method_handler(
-      (res: Deno.PointerValue, req: Deno.PointerValue) => handler(new HttpResponse(this.#ssl, this.#handle, res), new HttpRequest(this.#handle, req))
+      (res: Deno.PointerValue, req: Deno.PointerValue, snapshot: Deno.PointerValue, length: Deno.PointerValue) => {
+        const request = HttpRequest._acquire(this.#handle, req, snapshot, length);
+        const response = HttpResponse._acquire(this.#native, this.#handle, res, request);
+        if (encodings) {
+          response._compress(request.getHeader("accept-encoding"), encodings, minSize);
+        }
+        if (options?.cache) {
+          response._cache();
+        }
+        try {
+          handler(response, request);
+        } finally {
+          request._release();
+          response._recycle();
+        }
+      }
     );
-    method(this.#ssl, this.#handle, Deno.UnsafePointer.of(toCString(pattern)), _handler.pointer);
+    const vary = options?.cache ? encoder.encode(options.cache === true ? "" : (options.cache.vary ?? []).join(",")) : null;
+    // routes registered in the same tick are installed by one loop task, see #flushRoutes
+    if (!this.#pendingRoutes.length) {
+      queueMicrotask(() => this.#flushRoutes());
+    }
+    this.#pendingRoutes.push({ method: httpMethod, pattern: encoder.encode(pattern), vary, handler: _handler.pointer });
+    return this;
+  }
+
+  /** Hands the pending routes to the loop in one call. Everything else registering on the loop calls this first,
+   * so routes keep their order relative to websockets, static routes and listen.
+   */
+  #flushRoutes(): void {
+    if (!this.#pendingRoutes.length) {
+      return;
+    }
+    const table = packRouteTable(this.#pendingRoutes);
+    this.#pendingRoutes = [];
+    uws_app_register_routes(this.#ssl, this.#handle, Deno.UnsafePointer.of(table), table.length);
+  }
+
+  /** Measures the routes and websocket behaviors registered after this call natively, see getMetrics.
+   * With prometheusPattern set, GET requests to it are answered natively in prometheus text format.
+   */
+  enableMetrics(prometheusPattern?: string): TemplatedApp {
+    this.#flushRoutes();
+    uws_app_metrics(this.#handle);
+    if (prometheusPattern) {
+      uws_app_metrics_endpoint(this.#ssl, this.#handle, Deno.UnsafePointer.of(toCString(prometheusPattern)));
+    }
+    return this;
+  }
+
+  /** Reads the health counters of the native loop without stopping it. With resetMax the maxima start over. */
+  loopStats(resetMax = false): LoopStats {
+    return readLoopStats(this.#handle, resetMax);
+  }
+
+  /** Sets the bytes of responses the native cache of cached routes keeps, 16 MiB by default. */
+  responseCacheLimit(bytes: number): TemplatedApp {
+    this.#flushRoutes();
+    uws_app_response_cache_limit(this.#handle, bytes);
     return this;
   }
 
   /** Registers an HTTP GET handler matching specified URL pattern. */
-  get(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void): TemplatedApp {
-    return this.#generateHTTPHandler(uws_app_get, pattern, handler);
+  get(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void, options?: RouteOptions): TemplatedApp {
+    return this.#generateHTTPHandler(HttpMethod.GET, pattern, handler, options);
   }
   /** Registers an HTTP POST handler matching specified URL pattern. */
-  post(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void): TemplatedApp {
-    return this.#generateHTTPHandler(uws_app_post, pattern, handler);
+  post(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void, options?: RouteOptions): TemplatedApp {
+    return this.#generateHTTPHandler(HttpMethod.POST, pattern, handler, options);
   }
   /** Registers an HTTP OPTIONS handler matching specified URL pattern. */
-  options(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void): TemplatedApp {
-    return this.#generateHTTPHandler(uws_app_options, pattern, handler);
+  options(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void, options?: RouteOptions): TemplatedApp {
+    return this.#generateHTTPHandler(HttpMethod.OPTIONS, pattern, handler, options);
   }
   /** Registers an HTTP DELETE handler matching specified URL pattern. */
-  del(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void): TemplatedApp {
-    return this.#generateHTTPHandler(uws_app_delete, pattern, handler);
+  del(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void, options?: RouteOptions): TemplatedApp {
+    return this.#generateHTTPHandler(HttpMethod.DELETE, pattern, handler, options);
   }
   /** Registers an HTTP PATCH handler matching specified URL pattern. */
-  patch(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void): TemplatedApp {
-    return this.#generateHTTPHandler(uws_app_patch, pattern, handler);
+  patch(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void, options?: RouteOptions): TemplatedApp {
+    return this.#generateHTTPHandler(HttpMethod.PATCH, pattern, handler, options);
   }
   /** Registers an HTTP PUT handler matching specified URL pattern. */
-  put(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void): TemplatedApp {
-    return this.#generateHTTPHandler(uws_app_put, pattern, handler);
+  put(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void, options?: RouteOptions): TemplatedApp {
+    return this.#generateHTTPHandler(HttpMethod.PUT, pattern, handler, options);
   }
   /** Registers an HTTP HEAD handler matching specified URL pattern. */
-  head(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void): TemplatedApp {
-    return this.#generateHTTPHandler(uws_app_head, pattern, handler);
+  head(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void, options?: RouteOptions): TemplatedApp {
+    return this.#generateHTTPHandler(HttpMethod.HEAD, pattern, handler, options);
   }
   /** Registers an HTTP CONNECT handler matching specified URL pattern. */
-  connect(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void): TemplatedApp {
-    return this.#generateHTTPHandler(uws_app_connect, pattern, handler);
+  connect(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void, options?: RouteOptions): TemplatedApp {
+    return this.#generateHTTPHandler(HttpMethod.CONNECT, pattern, handler, options);
   }
   /** Registers an HTTP TRACE handler matching specified URL pattern. */
-  trace(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void): TemplatedApp {
-    return this.#generateHTTPHandler(uws_app_trace, pattern, handler);
+  trace(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void, options?: RouteOptions): TemplatedApp {
+    return this.#generateHTTPHandler(HttpMethod.TRACE, pattern, handler, options);
   }
   /** Registers an HTTP handler matching specified URL pattern on any HTTP method. */
-  any(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void): TemplatedApp {
-    return this.#generateHTTPHandler(uws_app_any, pattern, handler);
+  any(pattern: string, handler: (res: HttpResponse, req: HttpRequest) => void, options?: RouteOptions): TemplatedApp {
+    return this.#generateHTTPHandler(HttpMethod.ANY, pattern, handler, options);
+  }
+
+  /** Registers a response served entirely by the native loop, the handler never calls into JS.
+   * Status, headers and body are serialized once here. Useful for health checks, robots.txt and fixed payloads.
+   */
+  staticRoute(method: HttpMethod, pattern: string, status: string, headers: Record<string, string>, body: RecognizedString): TemplatedApp {
+    this.#flushRoutes();
+    const statusBuffer = encoder.encode(status);
+    const headersBuffer = packHeaders(Object.entries(headers).flat().map((part) => encoder.encode(part)));
+    const bodyBuffer = encode(body);
+    uws_app_static_response(
+      this.#ssl, this.#handle, method, Deno.UnsafePointer.of(toCString(pattern)),
+      Deno.UnsafePointer.of(statusBuffer), statusBuffer.length,
+      Deno.UnsafePointer.of(headersBuffer), headersBuffer.length,
+      Deno.UnsafePointer.of(bodyBuffer), bodyBuffer.length);
+    return this;
+  }
+
+  /** Serves files below root for GET and HEAD requests under prefix, without calling into JS.
+   * Files are memory mapped and cached, answered with ETag/If-None-Match and single byte Range support and streamed
+   * with backpressure. With precompressed set, .br and .gz siblings are picked from Accept-Encoding.
+   */
+  serveStatic(prefix: string, root: string, options: ServeStaticOptions = {}): TemplatedApp {
+    this.#flushRoutes();
+    uws_app_serve_static(
+      this.#ssl, this.#handle,
+      Deno.UnsafePointer.of(toCString(prefix)),
+      Deno.UnsafePointer.of(toCString(root)),
+      Deno.UnsafePointer.of(toCString(options.index ?? "index.html")),
+      Deno.UnsafePointer.of(toCString(options.cacheControl ?? "")),
+      options.cacheLimit ?? 64 * 1024 * 1024,
+      +(options.precompressed ?? true));
+    return this;
+  }
+
+  /** Enables batched dispatch. Instead of calling into JS for every request, the native loop writes requests into a
+   * shared memory ring of capacity bytes which is drained here once per wakeup. Requests arriving while the ring is
+   * full are answered with 503.
+   */
+  useRequestRing(capacity = 1024 * 1024): TemplatedApp {
+    if (this.#ring) return this;
+    const pointer = uws_app_request_ring(this.#handle, capacity);
+    const header = new Deno.UnsafePointerView(pointer);
+    const size = header.getUint32(8);
+    const buffer = header.getArrayBuffer(RING_HEADER_SIZE + size);
+    this.#ring = { buffer, words: new Uint32Array(buffer, 0, 4), view: new DataView(buffer), mask: size - 1 };
+    this.#drainRequestRing();
+    return this;
+  }
+
+  async #drainRequestRing() {
+    const ring = this.#ring!;
+    while (true) {
+      await uws_request_ring_wait(this.#handle);
+      const head = Atomics.load(ring.words, 0);
+      let tail = Atomics.load(ring.words, 1);
+      while (tail !== head) {
+        const offset = RING_HEADER_SIZE + (tail & ring.mask);
+        const size = ring.view.getUint32(offset, true);
+        const type = ring.view.getUint32(offset + 4, true);
+        if (type !== RingRecord.PADDING) {
+          const sequence = ring.view.getBigUint64(offset + 24, true);
+          if (type === RingRecord.REQUEST) {
+            const route = ring.view.getUint32(offset + 8, true);
+            const address = ring.view.getBigUint64(offset + 16, true);
+            const snapshotOffset = offset + RING_RECORD_HEADER_SIZE;
+            const snapshot = new Uint8Array(ring.buffer, snapshotOffset, ring.view.getUint32(snapshotOffset, true));
+            this.#dispatchBatched(route, address, sequence, snapshot);
+          } else if (type === RingRecord.ABORTED) {
+            this.#batchedResponses.get(sequence)?._abort();
+          }
+        }
+        tail = (tail + size) >>> 0;
+      }
+      // frees the records, snapshots must not be read after this
+      Atomics.store(ring.words, 1, tail);
+    }
+  }
+
+  #releaseBatched = (sequence: bigint) => {
+    this.#batchedResponses.delete(sequence);
+  };
+
+  #dispatchBatched(route: number, address: bigint, sequence: bigint, snapshot: Uint8Array) {
+    const res = new BatchedHttpResponse(this.#native, this.#handle, address, sequence, this.#releaseBatched);
+    try {
+      this.#batchedRoutes[route](res, new HttpRequest(this.#handle, null, new RequestSnapshot(snapshot)));
+    } catch (e) {
+      if (!res.done) res.writeStatus("500 Internal Server Error").end();
+      reportError(e);
+    }
+    if (!res.done) {
+      this.#batchedResponses.set(sequence, res);
+    }
+  }
+
+  /** Registers a batched HTTP handler, see useRequestRing. The handler may answer asynchronously. */
+  batched(method: HttpMethod, pattern: string, handler: BatchedHandler): TemplatedApp {
+    this.#flushRoutes();
+    this.useRequestRing();
+    const route = this.#batchedRoutes.push(handler) - 1;
+    uws_app_batched(this.#ssl, this.#handle, method, Deno.UnsafePointer.of(toCString(pattern)), route);
+    return this;
   }
 
   /** Registers a handler matching specified URL pattern where WebSocket upgrade requests are caught. */
   ws<UserData>(pattern: string, behavior: WebSocketBehavior<UserData>): TemplatedApp {
+    this.#flushRoutes();
     const behaviorBuffer = packWebsocketBehaviorBuffer(this.#ssl, this.#handle, behavior);
     uws_ws(this.#ssl, this.#handle, Deno.UnsafePointer.of(toCString(pattern)), behaviorBuffer);
     return this;
   }
-  /** Publishes a message under topic, for all WebSockets under this app. See WebSocket.publish. */
+  /** Publishes a message under topic, for all WebSockets under this app, or every loop of its pool. See WebSocket.publish.
+   * The message is queued and sent by the loop after its current iteration, so this never blocks and returns true once queued.
+   * Use publishAsync or publishBatch when the result is needed.
+   */
   publish(topic: string, message: RecognizedString, isBinary?: boolean, compress = false): boolean {
-    const topicBuffer = encoder.encode(topic);
-    const messageBuffer= encode(message);
+    const topicBuffer = encodeTransient(topic);
+    const messageBuffer = encodeTransient(message);
     return !!uws_publish(
       this.#ssl, this.#handle,
       Deno.UnsafePointer.of(topicBuffer), topicBuffer.length,
       Deno.UnsafePointer.of(messageBuffer), messageBuffer.length,
       isBinary ? OpCode.BINARY : OpCode.TEXT, +compress);
   }
-  /** Returns number of subscribers for this topic. */
+  /** Like publish, resolving with whether the message was published once the loop sent it. */
+  publishAsync(topic: string, message: RecognizedString, isBinary?: boolean, compress = false): Promise<boolean> {
+    return publishAsync(this.#ssl, this.#handle, null, topic, message, isBinary, compress);
+  }
+  /** Queues messages with one call into the binding, they are published in order within one loop iteration.
+   * Resolves with the result of every message.
+   */
+  publishBatch(messages: PublishMessage[]): Promise<boolean[]> {
+    if (!messages.length) return Promise.resolve([]);
+    const packed = packPublishBatch(messages);
+    const sequence = uws_publish_batch(this.#ssl, this.#handle, Deno.UnsafePointer.of(packed), packed.length, 1);
+    return trackPublish(this.#handle, sequence, messages.length);
+  }
+
+  /** Sends message to every socket in one native call, encoding it once. With compress it is deflated once for the
+   * sockets of SHARED_COMPRESSOR routes, see sendPrepared. The sockets must be open sockets of this app. Returns the
+   * SendStatus of each socket, in order.
+   */
+  sendMany(sockets: WebSocket<unknown>[], message: RecognizedString, isBinary?: boolean, compress?: boolean): Uint8Array {
+    const results = new Uint8Array(sockets.length);
+    if (!sockets.length) return results;
+    const handles = new BigUint64Array(sockets.length);
+    for (let i = 0; i < sockets.length; i++) {
+      handles[i] = BigInt(Deno.UnsafePointer.value(sockets[i]._handle()));
+    }
+    const data = encodeTransient(message);
+    this.#native.ws_send_batch(this.#handle, Deno.UnsafePointer.of(handles), sockets.length, Deno.UnsafePointer.of(data), data.length,
+      isBinary ? OpCode.BINARY : OpCode.TEXT, +!!compress, Deno.UnsafePointer.of(results));
+    return results;
+  }
+  /** Returns number of subscribers for this topic on this loop. */
   numSubscribers(topic: string): number {
     const topicBuffer = encoder.encode(topic);
     return uws_num_subscribers(this.#ssl, this.#handle, Deno.UnsafePointer.of(topicBuffer), topicBuffer.length);
   }
+  /** Returns number of subscribers for this topic summed over every loop of the pool this app belongs to. */
+  numSubscribersAll(topic: string): Promise<number> {
+    const topicBuffer = encoder.encode(topic);
+    return keepAlive(uws_num_subscribers_all(this.#ssl, this.#handle, Deno.UnsafePointer.of(topicBuffer), topicBuffer.length), topicBuffer);
+  }
   /** Adds a server name. */
   addServerName(hostname: string, options?: AppOptions): TemplatedApp {
     const hostnameBuffer = encoder.encode(hostname);
@@ -888,4 +2074,155 @@ export function App(options?: AppOptions) {
 }
 export function SSLApp(options: AppOptions) {
   return new TemplatedApp(1, options);
-}
\ No newline at end of file
+}
+/** Module run by every Deno Worker of an AppPool. Its default export registers the routes of one loop. */
+export type AppPoolSetup = (app: TemplatedApp, index: number) => void | Promise<void>;
+
+/** TemplatedAppPool runs several independent native loops listening on the same port (SO_REUSEPORT).
+ * Every loop dispatches its callbacks to its own Deno Worker, so routes are declared once in a setup module
+ * which is imported by each Worker. See AppPool.
+ */
+class TemplatedAppPool {
+  #handle: Deno.PointerValue;
+  #ssl: number;
+  #workers: Worker[] = [];
+  #handles: Deno.PointerValue[] = [];
+  #ready: Promise<void>;
+
+  /** Unsafe Raw (pointer) to the uws_pool object */
+  get unsafeHandle(): Deno.PointerValue {
+    return this.#handle;
+  }
+
+  /** Number of native loops in this pool */
+  get size(): number {
+    return this.#handles.length;
+  }
+
+  /** Resolves when every Worker ran its setup module */
+  get ready(): Promise<void> {
+    return this.#ready;
+  }
+
+  constructor(ssl: number, size: number, setupModule: string | URL, options?: AppOptions) {
+    this.#ssl = ssl;
+    if (this.#ssl) {
+      const optionsBuffer = packAppOptionsBuffer(options!);
+      this.#handle = uws_create_app_pool(this.#ssl, size, optionsBuffer.buffer);
+    } else {
+      this.#handle = uws_create_app_pool(this.#ssl, size, new ArrayBuffer(1));
+    }
+
+    const workerUrl = new URL('./pool_worker.ts', import.meta.url).href;
+    const ready: Promise<void>[] = [];
+    for (let index = 0; index < uws_pool_size(this.#handle); index++) {
+      const handle = uws_pool_get_worker(this.#handle, index);
+      const worker = new Worker(workerUrl, { type: 'module' });
+      ready.push(new Promise((resolve, reject) => {
+        worker.onmessage = () => resolve();
+        worker.onerror = (e) => {
+          e.preventDefault();
+          reject(e.error ?? new Error(e.message));
+        };
+      }));
+      // pointers cannot be cloned, the worker rebuilds the handle from its address
+      worker.postMessage({ ssl: this.#ssl, address: Deno.UnsafePointer.value(handle), index, setupModule: setupModule.toString() });
+      this.#handles.push(handle);
+      this.#workers.push(worker);
+    }
+    this.#ready = Promise.all(ready).then(() => {});
+  }
+
+  /** Listens to hostname & port on every loop. Callback is called once per loop, with either false or a listen socket. */
+  listen(host: string, port: number, cb: (listenSocket: us_listen_socket) => void): TemplatedAppPool;
+  /** Listens to port on every loop. Callback is called once per loop, with either false or a listen socket. */
+  listen(port: number, cb: (listenSocket: us_listen_socket | false) => void): TemplatedAppPool;
+  /** Listens to port and sets Listen Options on every loop. Callback is called once per loop, with either false or a listen socket. */
+  listen(port: number, options: ListenOptions, cb: (listenSocket: us_listen_socket | false) => void): TemplatedAppPool;
+
+  listen(): TemplatedAppPool {
+    const args = [...arguments];
+    // routes are registered by the workers, listen after them so no loop accepts requests without routes
+    this.#ready.then(() => {
+      for (const handle of this.#handles) {
+        listenWorker(this.#ssl, handle, args);
+      }
+    });
+    return this;
+  }
+
+  /** Publishes a message under topic to the subscribers of every loop. The payload is copied once and shared by the loops. */
+  publish(topic: string, message: RecognizedString, isBinary?: boolean, compress = false): boolean {
+    const topicBuffer = encodeTransient(topic);
+    const messageBuffer = encodeTransient(message);
+    return !!uws_publish(
+      this.#ssl, this.#handles[0],
+      Deno.UnsafePointer.of(topicBuffer), topicBuffer.length,
+      Deno.UnsafePointer.of(messageBuffer), messageBuffer.length,
+      isBinary ? OpCode.BINARY : OpCode.TEXT, +compress);
+  }
+
+  /** Returns number of subscribers for this topic summed over every loop. */
+  numSubscribers(topic: string): Promise<number> {
+    const topicBuffer = encoder.encode(topic);
+    return keepAlive(uws_num_subscribers_all(this.#ssl, this.#handles[0], Deno.UnsafePointer.of(topicBuffer), topicBuffer.length), topicBuffer);
+  }
+
+  /** Health counters of every native loop of the pool, see TemplatedApp.loopStats. */
+  loopStats(resetMax = false): LoopStats[] {
+    return this.#handles.map((handle) => readLoopStats(handle, resetMax));
+  }
+
+  /** Drains every loop, see TemplatedApp.drain. Resolves with whether all of them finished in time. */
+  async drain(timeoutMs = 10000): Promise<boolean> {
+    const drained = await Promise.all(this.#handles.map((handle) => uws_app_close(this.#ssl, handle, timeoutMs)));
+    return drained.every((loop) => !!loop);
+  }
+  /** Closes every connection of every loop right away, see drain. */
+  close(): Promise<boolean> {
+    return this.drain(0);
+  }
+  /** Hands the listen sockets of every loop to a successor, see TemplatedApp.handoff. */
+  async handoff(path: string): Promise<number> {
+    const fds = await Promise.all(this.#handles.map(listenFds));
+    return sendListenFds(path, fds.flat());
+  }
+  /** Every loop accepts from all of the given listen sockets once the routes are registered, see TemplatedApp.adoptListenSockets. */
+  adoptListenSockets(fds: number[]): TemplatedAppPool {
+    this.#ready.then(() => {
+      for (const handle of this.#handles) {
+        for (const fd of fds) {
+          uws_app_adopt_listen_fd(this.#ssl, handle, fd);
+        }
+      }
+    });
+    return this;
+  }
+
+  /** Terminates the Deno Workers. Native loops keep running, see drain. */
+  terminate(): void {
+    for (const worker of this.#workers) {
+      worker.terminate();
+    }
+  }
+}
+
+/** Wraps a loop started natively. Used by the Deno Workers of an AppPool. */
+export function attachApp(ssl: number, handle: Deno.PointerValue) {
+  return new TemplatedApp(ssl, undefined, handle);
+}
+
+export type { TemplatedApp, TemplatedAppPool, HttpRequest, HttpResponse, BatchedHttpResponse, WebSocket };
+
+/** Internal marshalling helpers measured by benchmarks/ffi_bench.ts, not part of the API. */
+export const _internals = { encode, encodeTransient, getBuffer, getStringFromPointer, packHeaders, getWebSocket, HttpRequest, HttpResponse };
+
+/** Starts size loops listening on the same port. setupModule default export (AppPoolSetup) registers the routes,
+ * it is imported once in every Worker.
+ */
+export function AppPool(size: number, setupModule: string | URL, options?: AppOptions) {
+  return new TemplatedAppPool(0, size, setupModule, options);
+}
+export function SSLAppPool(size: number, setupModule: string | URL, options: AppOptions) {
+  return new TemplatedAppPool(1, size, setupModule, options);
+}
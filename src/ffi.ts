@@ -43,8 +43,9 @@ const uws_app_listen_config_t: Deno.NativeType[] = ["u16", "pointer", "u8"];
 //     uws_websocket_ping_pong_handler pong;
 //     uws_websocket_close_handler close;
 //     uws_websocket_subscription_handler subscription;
+//     uws_websocket_message_batch_handler message_batch;
 // };
-const uws_socket_behavior_t: Deno.NativeType[] = ["u32", "u32", "u32", "u32", "u32", "u8", "u8", "u8", "u32", "pointer", "pointer", "pointer", "pointer", "pointer", "pointer", "pointer", "pointer"];
+const uws_socket_behavior_t: Deno.NativeType[] = ["u32", "u32", "u32", "u32", "u32", "u8", "u8", "u8", "u32", "pointer", "pointer", "pointer", "pointer", "pointer", "pointer", "pointer", "pointer", "pointer"];
 
 // struct uws_try_end_result_t {
 //   bool ok;
@@ -52,11 +53,130 @@ const uws_socket_behavior_t: Deno.NativeType[] = ["u32", "u32", "u32", "u32", "u
 // };
 const uws_try_end_result_t: Deno.NativeType[] = ["u8", "u8"];
 
+// the res and ws calls, exported once per kind of socket as uws_tcp_<name> and uws_tls_<name> without int ssl
+const specialized_symbols = {
+  // void uws_*_ring_res_end(uws_worker_t *worker, uws_res_t *res, uint64_t sequence, const char *status, size_t status_length, const char *headers, size_t headers_length, const char *data, size_t length, bool close_connection);
+  ring_res_end: { parameters: ["pointer", "pointer", "u64", "pointer", "usize", "pointer", "usize", "pointer", "usize", "u8"], result: "void" },
+  // void uws_*_ws_close(uws_worker_t *worker, uws_websocket_t *ws);
+  ws_close: { parameters: ["pointer", "pointer"], result: "void" },
+  // uws_sendstatus_t uws_*_ws_send(uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode);
+  ws_send: { parameters: ["pointer", "pointer", "pointer", "usize", "u8"], result: "u8" },
+  // uws_sendstatus_t uws_*_ws_send_with_options(uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode, bool compress, bool fin);
+  ws_send_with_options: { parameters: ["pointer", "pointer", "pointer", "usize", "u8", "u8", "u8"], result: "u8" },
+  // uws_sendstatus_t uws_*_ws_send_prepared(uws_worker_t *worker, uws_websocket_t *ws, uws_prepared_message_t *message);
+  ws_send_prepared: { parameters: ["pointer", "pointer", "pointer"], result: "u8" },
+  // void uws_*_ws_send_batch(uws_worker_t *worker, uws_websocket_t *const *sockets, size_t count, const char *message, size_t length, uws_opcode_t opcode, bool compress, uint8_t *results);
+  ws_send_batch: { parameters: ["pointer", "pointer", "usize", "pointer", "usize", "u8", "u8", "pointer"], result: "void" },
+  // void uws_*_ws_end(uws_worker_t *worker, uws_websocket_t *ws, int code, const char *message, size_t length);
+  ws_end: { parameters: ["pointer", "pointer", "u16", "pointer", "usize"], result: "void" },
+  // void uws_*_ws_cork(uws_worker_t *worker, uws_websocket_t *ws, void (*handler)(void *optional_data), void *optional_data);
+  ws_cork: { parameters: ["pointer", "pointer", "function", "pointer"], result: "void" },
+  // bool uws_*_ws_subscribe(uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length);
+  ws_subscribe: { parameters: ["pointer", "pointer", "pointer", "usize"], result: "u8" },
+  // bool uws_*_ws_unsubscribe(uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length);
+  ws_unsubscribe: { parameters: ["pointer", "pointer", "pointer", "usize"], result: "u8" },
+  // bool uws_*_ws_is_subscribed(uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length);
+  ws_is_subscribed: { parameters: ["pointer", "pointer", "pointer", "usize"], result: "u8" },
+  // void uws_*_ws_iterate_topics(uws_worker_t *worker, uws_websocket_t *ws, void (*callback)(const char *topic, size_t length, void *optional_data), void *optional_data);
+  ws_iterate_topics: { parameters: ["pointer", "pointer", "function", "pointer"], result: "void" },
+  // unsigned int uws_*_ws_get_buffered_amount(uws_worker_t *worker, uws_websocket_t *ws);
+  ws_get_buffered_amount: { parameters: ["pointer", "pointer"], result: "u32" },
+  // size_t uws_*_ws_get_remote_address(uws_worker_t *worker, uws_websocket_t *ws, const char **dest);
+  ws_get_remote_address: { parameters: ["pointer", "pointer", "pointer"], result: "usize" },
+  // size_t uws_*_ws_get_remote_address_as_text(uws_worker_t *worker, uws_websocket_t *ws, const char **dest);
+  ws_get_remote_address_as_text: { parameters: ["pointer", "pointer", "pointer"], result: "usize" },
+  // void uws_*_res_end(uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, bool close_connection);
+  res_end: { parameters: ["pointer", "pointer", "pointer", "usize", "u8"], result: "void" },
+  // void uws_*_res_end_prepared(uws_worker_t *worker, uws_res_t *res, unsigned int headers_id, unsigned int body_id, const char *body, size_t body_length, bool close_connection);
+  res_end_prepared: { parameters: ["pointer", "pointer", "u32", "u32", "pointer", "usize", "u8"], result: "void" },
+  // bool uws_*_res_end_owned(uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, bool close_connection, void (*release)(const char *data));
+  res_end_owned: { parameters: ["pointer", "pointer", "pointer", "usize", "u8", "function"], result: "u8" },
+  // void uws_*_res_end_cached(uws_worker_t *worker, uws_res_t *res, unsigned int ttl, const char *status, size_t status_length, const char *headers, size_t headers_length, const char *body, size_t body_length, bool close_connection);
+  res_end_cached: { parameters: ["pointer", "pointer", "u32", "pointer", "usize", "pointer", "usize", "pointer", "usize", "u8"], result: "void" },
+  // void uws_*_res_end_compressed(uws_worker_t *worker, uws_res_t *res, const char *accept_encoding, size_t accept_encoding_length, unsigned int encodings, size_t min_length, const char *data, size_t length, bool close_connection);
+  res_end_compressed: { parameters: ["pointer", "pointer", "pointer", "usize", "u32", "usize", "pointer", "usize", "u8"], result: "void" },
+  // void uws_*_res_stream_fd(uws_worker_t *worker, uws_res_t *res, int fd, uint64_t offset, uint64_t length, bool close_fd, void (*handler)(uws_res_t *res, bool completed, void *optional_data), void (*aborted)(uws_res_t *res, void *optional_data), void *optional_data);
+  res_stream_fd: { parameters: ["pointer", "pointer", "i32", "u64", "u64", "u8", "function", "function", "pointer"], result: "void" },
+  // size_t uws_*_res_get_remote_address(uws_worker_t *worker, uws_res_t *res, const char **dest);
+  res_get_remote_address: { parameters: ["pointer", "pointer", "pointer"], result: "usize" },
+  // size_t uws_*_res_get_remote_address_as_text(uws_worker_t *worker, uws_res_t *res, const char **dest);
+  res_get_remote_address_as_text: { parameters: ["pointer", "pointer", "pointer"], result: "usize" },
+  // size_t uws_*_res_get_proxied_remote_address(uws_worker_t *worker, uws_res_t *res, const char **dest);
+  res_get_proxied_remote_address: { parameters: ["pointer", "pointer", "pointer"], result: "usize" },
+  // size_t uws_*_res_get_proxied_remote_address_as_text(uws_worker_t *worker, uws_res_t *res, const char **dest);
+  res_get_proxied_remote_address_as_text: { parameters: ["pointer", "pointer", "pointer"], result: "usize" },
+  // uws_try_end_result_t uws_*_res_try_end(uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, uintmax_t total_size, bool close_connection);
+  res_try_end: { parameters: ["pointer", "pointer", "pointer", "usize", "usize", "u8"], result: { struct: uws_try_end_result_t } },
+  // void uws_*_res_cork(uws_worker_t *worker, uws_res_t *res, void(*callback)(uws_res_t *res, void *optional_data), void *optional_data);
+  res_cork: { parameters: ["pointer", "pointer", "function", "pointer"], result: "void" },
+  // void uws_*_res_pause(uws_worker_t *worker, uws_res_t *res);
+  res_pause: { parameters: ["pointer", "pointer"], result: "void" },
+  // void uws_*_res_resume(uws_worker_t *worker, uws_res_t *res);
+  res_resume: { parameters: ["pointer", "pointer"], result: "void" },
+  // void uws_*_res_write_continue(uws_worker_t *worker, uws_res_t *res);
+  res_write_continue: { parameters: ["pointer", "pointer"], result: "void" },
+  // void uws_*_res_write_status(uws_worker_t *worker, uws_res_t *res, const char *status, size_t length);
+  res_write_status: { parameters: ["pointer", "pointer", "pointer", "usize"], result: "void" },
+  // void uws_*_res_write_header(uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, const char *value, size_t value_length);
+  res_write_header: { parameters: ["pointer", "pointer", "pointer", "usize", "pointer", "usize"], result: "void" },
+  // void uws_*_res_write_header_int(uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, uint64_t value);
+  res_write_header_int: { parameters: ["pointer", "pointer", "pointer", "usize", "u64"], result: "void" },
+  // void uws_*_res_end_without_body(uws_worker_t *worker, uws_res_t *res, bool close_connection);
+  res_end_without_body: { parameters: ["pointer", "pointer", "u8"], result: "void" },
+  // bool uws_*_res_write(uws_worker_t *worker, uws_res_t *res, const char *data, size_t length);
+  res_write: { parameters: ["pointer", "pointer", "pointer", "usize"], result: "u8" },
+  // uintmax_t uws_*_res_get_write_offset(uws_worker_t *worker, uws_res_t *res);
+  res_get_write_offset: { parameters: ["pointer", "pointer"], result: "usize" },
+  // void uws_*_res_override_write_offset(uws_worker_t *worker, uws_res_t *res, uintmax_t offset);
+  res_override_write_offset: { parameters: ["pointer", "pointer", "usize"], result: "void" },
+  // bool uws_*_res_has_responded(uws_worker_t *worker, uws_res_t *res);
+  res_has_responded: { parameters: ["pointer", "pointer"], result: "u8" },
+  // void uws_*_res_collect_body(uws_worker_t *worker, uws_res_t *res, size_t max_length, size_t expected_length, void (*handler)(uws_res_t *res, const char *body, size_t length, bool ok, void *optional_data), void (*aborted)(uws_res_t *res, void *optional_data), void *optional_data);
+  res_collect_body: { parameters: ["pointer", "pointer", "usize", "usize", "function", "function", "pointer"], result: "void" },
+  // void uws_*_res_on_writable(uws_worker_t *worker, uws_res_t *res, bool (*handler)(uws_res_t *res, uintmax_t, void *optional_data), void *optional_data);
+  res_on_writable: { parameters: ["pointer", "pointer", "function", "pointer"], result: "void" },
+  // void uws_*_res_on_aborted(uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res, void *optional_data), void *optional_data);
+  res_on_aborted: { parameters: ["pointer", "pointer", "function", "pointer"], result: "void" },
+  // void uws_*_res_on_data(uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res, const char *chunk, size_t chunk_length, bool is_end, void *optional_data), void *optional_data);
+  res_on_data: { parameters: ["pointer", "pointer", "function", "pointer"], result: "void" },
+  // void uws_*_res_upgrade(uws_worker_t *worker, uws_res_t *res, void *data, const char *sec_web_socket_key, size_t sec_web_socket_key_length, const char *sec_web_socket_protocol, size_t sec_web_socket_protocol_length, const char *sec_web_socket_extensions, size_t sec_web_socket_extensions_length, uws_socket_context_t *ws);
+  res_upgrade: { parameters: ["pointer", "pointer", "pointer", "pointer", "usize", "pointer", "usize", "pointer", "usize", "pointer"], result: "void" },
+} as const;
+
+type Prefixed<P extends string, S> = { [K in keyof S & string as `${P}${K}`]: S[K] };
+
+function prefixed<P extends string, S extends Record<string, Deno.ForeignFunction>>(prefix: P, definitions: S): Prefixed<P, S> {
+  return Object.fromEntries(Object.entries(definitions).map(([name, def]) => [prefix + name, def])) as Prefixed<P, S>;
+}
+
 const symbols = {
+  ...prefixed("uws_tcp_", specialized_symbols),
+  ...prefixed("uws_tls_", specialized_symbols),
+
   // uws_app_t *uws_create_app(int ssl, struct us_socket_context_options_t options);
   uws_create_app: { parameters: ["u8", { struct: us_socket_context_options_t }], result: "pointer" },
+  // void uws_loop_stats(uws_worker_t *worker, uws_loop_stats_t *dest, bool reset_max);
+  uws_loop_stats: { parameters: ["pointer", "pointer", "u8"], result: "void" },
   // void uws_wait_app(uws_worker_t *worker);
   uws_wait_app: { parameters: ["pointer"], result: "void", nonblocking: true },
+  // bool uws_app_close(int ssl, uws_worker_t *worker, unsigned int timeout_ms);
+  uws_app_close: { parameters: ["u8", "pointer", "u32"], result: "u8", nonblocking: true },
+  // size_t uws_app_listen_fds(uws_worker_t *worker, int *dest, size_t max);
+  uws_app_listen_fds: { parameters: ["pointer", "pointer", "usize"], result: "usize", nonblocking: true },
+  // void uws_app_adopt_listen_fd(int ssl, uws_worker_t *worker, int fd);
+  uws_app_adopt_listen_fd: { parameters: ["u8", "pointer", "i32"], result: "void" },
+  // int uws_send_fds(const char *path, size_t path_length, const int *fds, size_t count);
+  uws_send_fds: { parameters: ["pointer", "usize", "pointer", "usize"], result: "i32", nonblocking: true },
+  // int uws_receive_fds(const char *path, size_t path_length, int *dest, size_t max);
+  uws_receive_fds: { parameters: ["pointer", "usize", "pointer", "usize"], result: "i32", nonblocking: true },
+  // uws_pool_t *uws_create_app_pool(int ssl, unsigned int size, struct us_socket_context_options_t options);
+  uws_create_app_pool: { parameters: ["u8", "u32", { struct: us_socket_context_options_t }], result: "pointer" },
+  // unsigned int uws_pool_size(uws_pool_t *pool);
+  uws_pool_size: { parameters: ["pointer"], result: "u32" },
+  // uws_worker_t *uws_pool_get_worker(uws_pool_t *pool, unsigned int index);
+  uws_pool_get_worker: { parameters: ["pointer", "u32"], result: "pointer" },
+  // bool uws_app_register_routes(int ssl, uws_worker_t *worker, const char *table, size_t length);
+  uws_app_register_routes: { parameters: ["u8", "pointer", "pointer", "usize"], result: "u8" },
   // void uws_app_get(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler);
   uws_app_get: { parameters: ["u8", "pointer", "pointer", "function"], result: "void" },
   // void uws_app_post(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler);
@@ -78,6 +198,27 @@ const symbols = {
   // void uws_app_any(int ssl, uws_worker_t *worker, const char *pattern, uws_method_handler handler);
   uws_app_any: { parameters: ["u8", "pointer", "pointer", "function"], result: "void" },
 
+  // void uws_app_cached_method(int ssl, uws_worker_t *worker, uws_method_t method, const char *pattern, const char *vary, size_t vary_length, uws_method_handler handler);
+  uws_app_cached_method: { parameters: ["u8", "pointer", "u8", "pointer", "pointer", "usize", "function"], result: "void" },
+  // void uws_app_response_cache_limit(uws_worker_t *worker, size_t limit);
+  uws_app_response_cache_limit: { parameters: ["pointer", "usize"], result: "void" },
+  // void uws_app_metrics(uws_worker_t *worker);
+  uws_app_metrics: { parameters: ["pointer"], result: "void" },
+  // void uws_app_metrics_endpoint(int ssl, uws_worker_t *worker, const char *pattern);
+  uws_app_metrics_endpoint: { parameters: ["u8", "pointer", "pointer"], result: "void" },
+  // size_t uws_get_metrics(char *dest, size_t capacity);
+  uws_get_metrics: { parameters: ["pointer", "usize"], result: "usize" },
+  // void uws_app_static_response(int ssl, uws_worker_t *worker, uws_method_t method, const char *pattern, const char *status, size_t status_length, const char *headers, size_t headers_length, const char *body, size_t body_length);
+  uws_app_static_response: { parameters: ["u8", "pointer", "u8", "pointer", "pointer", "usize", "pointer", "usize", "pointer", "usize"], result: "void" },
+  // void uws_app_serve_static(int ssl, uws_worker_t *worker, const char *prefix, const char *root, const char *index, const char *cache_control, size_t cache_limit, bool precompressed);
+  uws_app_serve_static: { parameters: ["u8", "pointer", "pointer", "pointer", "pointer", "pointer", "usize", "u8"], result: "void" },
+  // void *uws_app_request_ring(uws_worker_t *worker, unsigned int capacity);
+  uws_app_request_ring: { parameters: ["pointer", "u32"], result: "pointer" },
+  // void uws_request_ring_wait(uws_worker_t *worker);
+  uws_request_ring_wait: { parameters: ["pointer"], result: "void", nonblocking: true },
+  // void uws_app_batched(int ssl, uws_worker_t *worker, uws_method_t method, const char *pattern, unsigned int route);
+  uws_app_batched: { parameters: ["u8", "pointer", "u8", "pointer", "u32"], result: "void" },
+
   // void uws_app_listen(int ssl, uws_worker_t *worker, int port, uws_listen_handler handler);
   uws_app_listen: { parameters: ["u8", "pointer", "u16", "function"], result: "void" },
   // void uws_app_listen_with_config(int ssl, uws_worker_t *worker, uws_app_listen_config_t config, uws_listen_handler handler);
@@ -91,8 +232,18 @@ const symbols = {
   
   // unsigned int uws_num_subscribers(int ssl, uws_worker_t *worker, const char *topic, size_t topic_length);
   uws_num_subscribers: { parameters: ["u8", "pointer", "pointer", "usize"], result: "u32" },
+  // unsigned int uws_num_subscribers_all(int ssl, uws_worker_t *worker, const char *topic, size_t topic_length);
+  uws_num_subscribers_all: { parameters: ["u8", "pointer", "pointer", "usize"], result: "u32", nonblocking: true },
   // bool uws_publish(int ssl, uws_worker_t *worker, const char *topic, size_t topic_length, const char *message, size_t message_length, uws_opcode_t opcode, bool compress);
   uws_publish: { parameters: ["u8", "pointer", "pointer", "usize", "pointer", "usize", "u8", "u8"], result: "u32" },
+  // uint64_t uws_publish_enqueue(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t topic_length, const char *message, size_t message_length, uws_opcode_t opcode, bool compress, bool track);
+  uws_publish_enqueue: { parameters: ["u8", "pointer", "pointer", "pointer", "usize", "pointer", "usize", "u8", "u8", "u8"], result: "u64" },
+  // uint64_t uws_publish_batch(int ssl, uws_worker_t *worker, const char *messages, size_t messages_length, bool track);
+  uws_publish_batch: { parameters: ["u8", "pointer", "pointer", "usize", "u8"], result: "u64" },
+  // void uws_publish_wait(uws_worker_t *worker, uint64_t sequence);
+  uws_publish_wait: { parameters: ["pointer", "u64"], result: "void", nonblocking: true },
+  // size_t uws_publish_results(uws_worker_t *worker, uint64_t sequence, uint8_t *results, size_t capacity);
+  uws_publish_results: { parameters: ["pointer", "u64", "pointer", "usize"], result: "usize" },
   // void uws_remove_server_name(int ssl, uws_worker_t *worker, const char *hostname_pattern, size_t hostname_pattern_length);
   uws_remove_server_name: { parameters: ["u8", "pointer", "pointer", "usize"], result: "function" },
   // void uws_add_server_name(int ssl, uws_worker_t *worker, const char *hostname_pattern, size_t hostname_pattern_length);
@@ -108,84 +259,21 @@ const symbols = {
   
   // void uws_ws(int ssl, uws_worker_t *worker, const char *pattern, uws_socket_behavior_t behavior);
   uws_ws: { parameters: ["u8", "pointer", "pointer", { struct: uws_socket_behavior_t }], result: "void" },
-  // void uws_ws_close(int ssl, uws_worker_t *worker, uws_websocket_t *ws);
-  uws_ws_close: { parameters: ["u8", "pointer", "pointer"], result: "void" },
-  // uws_sendstatus_t uws_ws_send(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode);
-  uws_ws_send: { parameters: ["u8", "pointer", "pointer", "pointer", "usize", "u8"], result: "u8" },
-  // uws_sendstatus_t uws_ws_send_with_options(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *message, size_t length, uws_opcode_t opcode, bool compress, bool fin);
-  uws_ws_send_with_options: { parameters: ["u8", "pointer", "pointer", "pointer", "usize", "u8", "u8", "u8"], result: "u8" },
-  // void uws_ws_end(int ssl, uws_worker_t *worker, uws_websocket_t *ws, int code, const char *message, size_t length);
-  uws_ws_end: { parameters: ["u8", "pointer",  "pointer", "u16", "pointer", "usize"], result: "void" },
-  // void uws_ws_cork(int ssl, uws_worker_t *worker, uws_websocket_t *ws, void (*handler)());
-  uws_ws_cork: { parameters: ["u8", "pointer", "pointer", "function"], result: "void" },
-
-  // bool uws_ws_subscribe(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length);
-  uws_ws_subscribe: { parameters: ["u8", "pointer", "pointer", "pointer", "usize"], result: "u8" },
-  // bool uws_ws_unsubscribe(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length);
-  uws_ws_unsubscribe: { parameters: ["u8", "pointer", "pointer", "pointer", "usize"], result: "u8" },
-  // bool uws_ws_is_subscribed(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t length);
-  uws_ws_is_subscribed: { parameters: ["u8", "pointer", "pointer", "pointer", "usize"], result: "u8" },
-  // void uws_ws_iterate_topics(int ssl, uws_worker_t *worker, uws_websocket_t *ws, void (*callback)(const char *topic, size_t length));
-  uws_ws_iterate_topics: { parameters: ["u8", "pointer", "pointer", "function"], result: "void" },
+  // uws_prepared_message_t *uws_ws_prepare_message(const char *message, size_t length, uws_opcode_t opcode, bool compress);
+  uws_ws_prepare_message: { parameters: ["pointer", "usize", "u8", "u8"], result: "pointer" },
+  // void uws_ws_prepared_message_release(uws_prepared_message_t *message);
+  uws_ws_prepared_message_release: { parameters: ["pointer"], result: "void" },
   // bool uws_ws_publish(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t topic_length, const char *message, size_t message_length);
   uws_ws_publish: { parameters: ["u8", "pointer", "pointer", "pointer", "usize", "pointer", "usize"], result: "u8" },
   // bool uws_ws_publish_with_options(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char *topic, size_t topic_length, const char *message, size_t message_length, uws_opcode_t opcode, bool compress);
   uws_ws_publish_with_options: { parameters: ["u8", "pointer", "pointer", "pointer", "usize", "pointer", "usize", "u8", "u8"], result: "u8" },
-  // unsigned int uws_ws_get_buffered_amount(int ssl, uws_worker_t *worker, uws_websocket_t *ws);
-  uws_ws_get_buffered_amount: { parameters: ["u8", "pointer", "pointer"], result: "u32" },
-  // size_t uws_ws_get_remote_address(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char **dest);
-  uws_ws_get_remote_address: { parameters: ["u8", "pointer", "pointer", "pointer"], result: "usize" },
-  // size_t uws_ws_get_remote_address_as_text(int ssl, uws_worker_t *worker, uws_websocket_t *ws, const char **dest);
-  uws_ws_get_remote_address_as_text: { parameters: ["u8", "pointer", "pointer", "pointer"], result: "usize" },
-
-  // size_t uws_res_get_proxied_remote_address(int ssl, uws_worker_t *worker, uws_res_t *res, const char **dest);
-  uws_res_get_proxied_remote_address: { parameters: ["u8", "pointer", "pointer", "pointer"], result: "usize" },
-  // size_t uws_res_get_proxied_remote_address_as_text(int ssl, uws_worker_t *worker, uws_res_t *res, const char **dest);
-  uws_res_get_proxied_remote_address_as_text: { parameters: ["u8", "pointer", "pointer", "pointer"], result: "usize" },
 
   // Response
   
-  // void uws_res_end(int ssl, uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, bool close_connection);
-  uws_res_end: { parameters: ["u8", "pointer", "pointer", "pointer", "usize", "u8"], result: "void" },
-  // uws_try_end_result_t uws_res_try_end(int ssl, uws_worker_t *worker, uws_res_t *res, const char *data, size_t length, uintmax_t total_size, bool close_connection);
-  uws_res_try_end: { parameters: ["u8", "pointer", "pointer", "pointer", "usize", "usize", "u8"], result: { struct: uws_try_end_result_t } },
-  // void uws_res_cork(int ssl, uws_worker_t *worker, uws_res_t *res, void(*callback)(uws_res_t *res));
-  uws_res_cork: { parameters: ["u8", "pointer", "pointer", "function"], result: "void" },
-  // void uws_res_pause(int ssl, uws_worker_t *worker, uws_res_t *res);
-  uws_res_pause: { parameters: ["u8", "pointer", "pointer"], result: "void" },
-  // void uws_res_resume(int ssl, uws_worker_t *worker, uws_res_t *res);
-  uws_res_resume: { parameters: ["u8", "pointer", "pointer"], result: "void" },
-  // void uws_res_write_continue(int ssl, uws_worker_t *worker, uws_res_t *res);
-  uws_res_write_continue: { parameters: ["u8", "pointer", "pointer"], result: "void" },
-  // void uws_res_write_status(int ssl, uws_worker_t *worker, uws_res_t *res, const char *status, size_t length);
-  uws_res_write_status: { parameters: ["u8", "pointer", "pointer", "pointer", "usize"], result: "void" },
-  // void uws_res_write_header(int ssl, uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, const char *value, size_t value_length);
-  uws_res_write_header: { parameters: ["u8", "pointer", "pointer", "pointer", "usize", "pointer", "usize"], result: "void" },
-  
-  // void uws_res_write_header_int(int ssl, uws_worker_t *worker, uws_res_t *res, const char *key, size_t key_length, uint64_t value);
-  uws_res_write_header_int: { parameters: ["u8", "pointer", "pointer", "pointer", "usize", "u64"], result: "void" },
-  // void uws_res_end_without_body(int ssl, uws_worker_t *worker, uws_res_t *res, bool close_connection);
-  uws_res_end_without_body: { parameters: ["u8", "pointer", "pointer", "u8"], result: "void" },
-  // bool uws_res_write(int ssl, uws_worker_t *worker, uws_res_t *res, const char *data, size_t length);
-  uws_res_write: { parameters: ["u8", "pointer", "pointer", "pointer", "usize"], result: "u8" },
-  // uintmax_t uws_res_get_write_offset(int ssl, uws_worker_t *worker, uws_res_t *res);
-  uws_res_get_write_offset: { parameters: ["u8", "pointer", "pointer"], result: "usize" },
-  // void uws_res_override_write_offset(int ssl, uws_worker_t *worker, uws_res_t *res, uintmax_t offset);
-  uws_res_override_write_offset: { parameters: ["u8", "pointer", "pointer", "usize"], result: "void" },
-  // bool uws_res_has_responded(int ssl, uws_worker_t *worker, uws_res_t *res);
-  uws_res_has_responded: { parameters: ["u8", "pointer", "pointer"], result: "u8" },
-  // void uws_res_on_writable(int ssl, uws_worker_t *worker, uws_res_t *res, bool (*handler)(uws_res_t *res, uintmax_t));
-  uws_res_on_writable: { parameters: ["u8", "pointer", "pointer", "function"], result: "void" },
-  // void uws_res_on_aborted(int ssl, uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res));
-  uws_res_on_aborted: { parameters: ["u8", "pointer", "pointer", "function"], result: "void" },
-  // void uws_res_on_data(int ssl, uws_worker_t *worker, uws_res_t *res, void (*handler)(uws_res_t *res, const char *chunk, size_t chunk_length, bool is_end));
-  uws_res_on_data: { parameters: ["u8", "pointer", "pointer", "function"], result: "void" },
-  // void uws_res_upgrade(int ssl, uws_worker_t *worker, uws_res_t *res, void *data, const char *sec_web_socket_key, size_t sec_web_socket_key_length, const char *sec_web_socket_protocol, size_t sec_web_socket_protocol_length, const char *sec_web_socket_extensions, size_t sec_web_socket_extensions_length, uws_socket_context_t *ws);
-  uws_res_upgrade: { parameters: ["u8", "pointer", "pointer", "pointer", "pointer", "usize", "pointer", "usize", "pointer", "usize", "pointer"], result: "void" },
-  // size_t uws_res_get_remote_address(int ssl, uws_worker_t *worker, uws_res_t *res, const char **dest);
-  uws_res_get_remote_address: { parameters: ["u8", "pointer", "pointer", "pointer"], result: "usize" },
-  // size_t uws_res_get_remote_address_as_text(int ssl, uws_worker_t *worker, uws_res_t *res, const char **dest);
-  uws_res_get_remote_address_as_text: { parameters: ["u8", "pointer", "pointer", "pointer"], result: "usize" },
+  // unsigned int uws_prepare_headers(const char *status, size_t status_length, const char *headers, size_t headers_length);
+  uws_prepare_headers: { parameters: ["pointer", "usize", "pointer", "usize"], result: "u32" },
+  // unsigned int uws_prepare_body(const char *body, size_t body_length);
+  uws_prepare_body: { parameters: ["pointer", "usize"], result: "u32" },
 
   //Request
   
@@ -219,8 +307,8 @@ const handlers_symbols = {
   uws_listen_handler: { parameters: ["pointer", { struct: uws_app_listen_config_t }], result: "void" },
   // void (*uws_listen_domain_handler)(struct us_listen_socket_t *listen_socket, const char* domain, size_t domain_length, int options);
   uws_listen_domain_handler: { parameters: ["pointer", "pointer", "usize", "u64"], result: "void" },
-  // void (*uws_method_handler)(uws_res_t *response, uws_req_t *request);
-  uws_method_handler: { parameters: ["pointer", "pointer"], result: "void" },
+  // void (*uws_method_handler)(uws_res_t *response, uws_req_t *request, const char *snapshot, size_t snapshot_length);
+  uws_method_handler: { parameters: ["pointer", "pointer", "pointer", "usize"], result: "void" },
   // void (*uws_filter_handler)(uws_res_t *response, int);
   uws_filter_handler: { parameters: ["pointer", "u64"], result: "void" },
   // void (*uws_missing_server_handler)(const char *hostname, size_t hostname_length);
@@ -228,23 +316,32 @@ const handlers_symbols = {
   // void (*uws_get_headers_server_handler)(const char *header_name, size_t header_name_size, const char *header_value, size_t header_value_size);
   uws_get_headers_server_handler: { parameters: ["pointer", "usize", "pointer", "usize"], result: "void" },
   
-  // void (*handler)()
+  // void (*handler)(void *optional_data)
   uws_ws_cork_callback: { parameters: ["pointer"], result: "void" },
 
-  // void (*callback)(const char *topic, size_t length)
-  uws_ws_iterate_topics_handler: { parameters: ["pointer", "usize"], result: "void" },
+  // void (*callback)(const char *topic, size_t length, void *optional_data)
+  uws_ws_iterate_topics_handler: { parameters: ["pointer", "usize", "pointer"], result: "void" },
 
-  // void (*callback)(uws_res_t *res)
-  uws_res_cork_callback: { parameters: ["pointer"], result: "void" },
+  // void (*callback)(uws_res_t *res, void *optional_data)
+  uws_res_cork_callback: { parameters: ["pointer", "pointer"], result: "void" },
   
-  // bool (*handler)(uws_res_t *res, uintmax_t)
-  uws_res_on_writable_handler: { parameters: ["pointer", "usize"], result: "u8" },
+  // bool (*handler)(uws_res_t *res, uintmax_t, void *optional_data)
+  uws_res_on_writable_handler: { parameters: ["pointer", "usize", "pointer"], result: "u8" },
 
-  // void (*handler)(uws_res_t *res)
-  uws_res_on_aborted_handler: { parameters: ["pointer"], result: "void" },
+  // void (*release)(const char *data)
+  uws_res_release_handler: { parameters: ["pointer"], result: "void" },
+
+  // void (*handler)(uws_res_t *res, bool completed, void *optional_data)
+  uws_res_streamed_handler: { parameters: ["pointer", "u8", "pointer"], result: "void" },
+
+  // void (*handler)(uws_res_t *res, void *optional_data)
+  uws_res_on_aborted_handler: { parameters: ["pointer", "pointer"], result: "void" },
   
-  // void (*handler)(uws_res_t *res, const char *chunk, size_t chunk_length, bool is_end)
-  uws_res_on_data_handler: { parameters: ["pointer", "pointer", "usize", "u8"], result: "void" },
+  // void (*handler)(uws_res_t *res, const char *chunk, size_t chunk_length, bool is_end, void *optional_data)
+  uws_res_on_data_handler: { parameters: ["pointer", "pointer", "usize", "u8", "pointer"], result: "void" },
+
+  // void (*handler)(uws_res_t *res, const char *body, size_t length, bool ok, void *optional_data)
+  uws_res_collect_body_handler: { parameters: ["pointer", "pointer", "usize", "u8", "pointer"], result: "void" },
 
   // void (*uws_websocket_handler)(uws_websocket_t *ws);
   uws_websocket_handler: { parameters: ["pointer"], result: "void" },
@@ -254,10 +351,12 @@ const handlers_symbols = {
   uws_websocket_ping_pong_handler: { parameters: ["pointer", "pointer", "usize"], result: "void" },
   // void (*uws_websocket_close_handler)(uws_websocket_t *ws, int code, const char *message, size_t length);
   uws_websocket_close_handler: { parameters: ["pointer", "u8", "pointer", "usize"], result: "void" },
-  // void (*uws_websocket_upgrade_handler)(uws_res_t *response, uws_req_t *request, uws_socket_context_t *context);
-  uws_websocket_upgrade_handler: { parameters: ["pointer", "pointer", "pointer"], result: "void" },
+  // void (*uws_websocket_upgrade_handler)(uws_res_t *response, uws_req_t *request, uws_socket_context_t *context, const char *snapshot, size_t snapshot_length);
+  uws_websocket_upgrade_handler: { parameters: ["pointer", "pointer", "pointer", "pointer", "usize"], result: "void" },
   // void (*uws_websocket_subscription_handler)(uws_websocket_t *ws, const char *topic_name, size_t topic_name_length, int new_number_of_subscriber, int old_number_of_subscriber);
   uws_websocket_subscription_handler: { parameters: ["pointer", "pointer", "usize", "u64", "u64"], result: "void" },
+  // void (*uws_websocket_message_batch_handler)(const char *records, size_t length, unsigned int count);
+  uws_websocket_message_batch_handler: { parameters: ["pointer", "usize", "u32"], result: "void" },
 } as const;
 
 interface ForeignLibraryCallbacksInterface {
@@ -301,4 +400,16 @@ try {
   throw error;
 }
 
+/** uws_tcp_* or uws_tls_* without their prefix, ssl is kept for the calls taking it. */
+export type Specialized = { [K in keyof typeof specialized_symbols & string]: typeof lib[`uws_tcp_${K}`] } & { ssl: number };
+
+function specialization(ssl: number): Specialized {
+  const prefix = ssl ? "uws_tls_" : "uws_tcp_";
+  const calls = Object.keys(specialized_symbols).map((name) => [name, lib[prefix + name as keyof typeof lib]]);
+  return Object.assign(Object.fromEntries(calls), { ssl }) as Specialized;
+}
+
+/** Indexed by ssl, picked once per app. */
+export const specializations: readonly [Specialized, Specialized] = [specialization(0), specialization(1)];
+
 export default Object.assign({}, lib, handlers);
\ No newline at end of file
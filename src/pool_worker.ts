@@ -0,0 +1,11 @@
+/// <reference lib="deno.worker" />
+import { attachApp, type AppPoolSetup } from './app.ts';
+
+// one Worker per native loop of an AppPool, every callback of the loop runs in this isolate
+self.onmessage = async (event: MessageEvent) => {
+  const { ssl, address, index, setupModule } = event.data;
+  const app = attachApp(ssl, Deno.UnsafePointer.create(address));
+  const setup: AppPoolSetup = (await import(setupModule)).default;
+  await setup(app, index);
+  self.postMessage({ index });
+};